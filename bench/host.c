@@ -0,0 +1,22 @@
+// What the kernel would otherwise provide, for the host tools here.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "process.h"
+
+void panic(const char * why) {
+    printf("PANIC %s\n", why);
+    abort();
+}
+
+void call_user_function(struct process * proc) {
+    proc->entry();
+}
+
+void disable_interrupts() {}
+void enable_interrupts() {}
+uint64_t save_and_disable_interrupts() { return 0; }
+void restore_interrupts(uint64_t flags) {}
+
+void register_interrupt_handler(int interrupt, void* handler) { }
@@ -0,0 +1,289 @@
+// Host benchmark for the network stack: drives synthetic segments from a
+// pretend peer through netdev_receive, the way a driver's poll would, and
+// catches whatever the stack sends back on a capture device.
+//
+// usage: netbench [connections] [segments]
+//
+// Latencies are per exchange for handshake and teardown, per frame for bulk
+// receive and per application write for bulk send.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "memory.h"
+#include "net/device.h"
+#include "net/ethernet.h"
+#include "net/ip.h"
+#include "net/tcp.h"
+#include "net/arp.h"
+#include "net/gro.h"
+#include "net/sbuff.h"
+#include "net/ntox.h"
+
+#define Remote 0xc0a80309
+#define Local 0xc0a80302
+#define Port 80
+#define Mss 1460
+
+static mac remote = {1,2,3,4,5,6};
+
+// what the stack last said, and how much it has said
+static struct {
+    uint32_t seq;
+    uint32_t ack;
+    uint16_t window;
+    uint64_t frames;
+} sent;
+
+static void capture(struct netdevice * dev, sbuff * sb) {
+    add_ref(sb);
+    tcp_hdr * hdr = (tcp_hdr*)(sb->head + 14 + 20);
+    sent.seq = ntol(hdr->sequence);
+    sent.ack = ntol(hdr->ack);
+    sent.window = ntos(hdr->window);
+    sent.frames++;
+    release_ref(sb, sbuff_free);
+}
+
+static struct netdevice dev = {.ip = Local, .send = capture};
+
+static stream * accepted;
+static uint64_t received;
+
+static void on_read(stream * s, const uint8_t * data, uint32_t sz) {
+    if (!data) {
+        tcp_close(s);
+        return;
+    }
+    received += sz;
+}
+
+static tcp_read_fn accept(stream * s) {
+    accepted = s;
+    return on_read;
+}
+
+static uint8_t frame[1600];
+
+// ethernet, ip and tcp headers for a segment carrying `n` bytes
+static uint16_t build(uint16_t port, uint32_t seq, uint32_t ack, uint8_t flags, uint16_t n) {
+    struct ipv4_header * ip = (struct ipv4_header*)(frame + 14);
+    tcp_hdr * tcp = (tcp_hdr*)(ip + 1);
+    uint8_t opts = flags & TcpSyn ? 4 : 0;
+
+    ((struct ethernet_frame*)frame)->sizeOrType = ntos(0x0800);
+    ip->ihl = 5;
+    ip->version = 4;
+    ip->total_len = ntos(20 + sizeof(tcp_hdr) + opts + n);
+    ip->ttl = 64;
+    ip->proto = IPPROTO_TCP;
+    ip->src = ntol(Remote);
+    ip->dest = ntol(Local);
+
+    tcp->srcPort = ntos(port);
+    tcp->destPort = ntos(Port);
+    tcp->sequence = ntol(seq);
+    tcp->ack = ntol(ack);
+    tcp->offset = 5 + opts / 4;
+    tcp->flags = flags;
+    tcp->window = ntos(0xffff);
+    if (opts) {
+        uint8_t * o = (uint8_t*)tcp->options;
+        o[0] = 2;   // mss
+        o[1] = 4;
+        o[2] = Mss >> 8;
+        o[3] = Mss & 0xff;
+    }
+
+    return 14 + 20 + sizeof(tcp_hdr) + opts + n;
+}
+
+static uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+typedef struct {
+    const char * name;
+    uint64_t * samples;     // ns each
+    uint64_t count;
+    uint64_t packets;
+    uint64_t elapsed;
+    uint32_t allocations;
+} result;
+
+static void start(result * r, const char * name, uint64_t max) {
+    memset(r, 0, sizeof(*r));
+    r->name = name;
+    r->samples = malloc(max * sizeof(uint64_t));
+    r->allocations = kmem_allocations();
+}
+
+static void sample(result * r, uint64_t ns) {
+    r->samples[r->count++] = ns;
+    r->elapsed += ns;
+}
+
+static int by_value(const void * a, const void * b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t percentile(const result * r, double p) {
+    uint64_t i = (uint64_t)(p * (r->count - 1));
+    return r->samples[i];
+}
+
+static void report(result * r) {
+    double secs = r->elapsed / 1e9;
+    uint32_t allocations = kmem_allocations() - r->allocations;
+
+    qsort(r->samples, r->count, sizeof(uint64_t), by_value);
+    printf("%-10s %10lu %12.0f %10.1f %8.2f %8lu %8lu %8lu\n",
+            r->name, r->packets,
+            r->packets / secs, (double)r->elapsed / r->packets,
+            (double)allocations / r->packets,
+            percentile(r, 0.5), percentile(r, 0.99), percentile(r, 0.999));
+    free(r->samples);
+}
+
+static void check(int ok, const char * what) {
+    if (ok) return;
+    printf("FAILED: %s\n", what);
+    exit(1);
+}
+
+// syn in, syn-ack out, ack in; returns the first sequence the peer is owed.
+// `r` may be NULL for connections only there to carry a bulk run.
+static uint32_t handshake(result * r, uint16_t port, uint32_t iss) {
+    uint64_t t = now();
+    uint16_t len = build(port, iss, 0, TcpSyn, 0);
+    netdev_receive(&dev, frame, len);
+    uint32_t ack = sent.seq + 1;
+    len = build(port, iss + 1, ack, TcpAck, 0);
+    netdev_receive(&dev, frame, len);
+    gro_flush();
+    if (r) {
+        sample(r, now() - t);
+        r->packets += 2;
+    }
+
+    check(sent.ack == iss + 1, "handshake");
+    return ack;
+}
+
+// peer's fin in; we close on the eof, so our fin out and its ack in
+static void teardown(result * r, uint16_t port, uint32_t seq, uint32_t ack) {
+    uint64_t t = now();
+    uint16_t len = build(port, seq, ack, TcpAck | TcpFin, 0);
+    netdev_receive(&dev, frame, len);
+    len = build(port, seq + 1, ack + 1, TcpAck, 0);
+    netdev_receive(&dev, frame, len);
+    gro_flush();
+    if (r) {
+        sample(r, now() - t);
+        r->packets += 2;
+    }
+
+    check(sent.ack == seq + 1, "teardown");
+}
+
+static void connections(uint32_t n) {
+    result open, close;
+    start(&open, "handshake", n);
+    start(&close, "teardown", n);
+
+    uint32_t live = kmem_current_objects();
+    for (uint32_t i = 0; i < n; i++) {
+        uint16_t port = 1024 + i % 60000;
+        uint32_t ack = handshake(&open, port, i * 7919);
+        teardown(&close, port, i * 7919 + 1, ack);
+    }
+    check(kmem_current_objects() == live, "connections leaked");
+
+    report(&open);
+    report(&close);
+}
+
+// in order segments, a poll's worth at a time. The peer keeps to the window
+// we offered and pushes at the end of each one, which is when we empty it.
+static void bulk_receive(uint32_t n) {
+    result r;
+    uint16_t port = 999;
+    uint32_t seq = 1000;
+    uint32_t ack = handshake(NULL, port, seq - 1);
+    uint16_t window = sent.window;
+    uint16_t inFlight = 0;
+    uint64_t bytes = 0;
+
+    start(&r, "bulk rx", n);
+    received = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        uint16_t sz = window - inFlight < Mss ? window - inFlight : Mss;
+        inFlight += sz;
+        uint8_t flags = TcpAck;
+        if (inFlight == window) {
+            flags |= TcpPsh;
+            inFlight = 0;
+        }
+
+        uint64_t t = now();
+        uint16_t len = build(port, seq, ack, flags, sz);
+        netdev_receive(&dev, frame, len);
+        if (i % NetdevPollBudget == NetdevPollBudget - 1) gro_flush();
+        sample(&r, now() - t);
+        seq += sz;
+        bytes += sz;
+    }
+    gro_flush();
+    r.packets = n;
+    check(received == bytes - inFlight, "bulk receive");
+    report(&r);
+
+    teardown(NULL, port, seq, ack);
+}
+
+// the application writing in large chunks, the peer acking each
+static void bulk_send(uint32_t n) {
+    static uint8_t data[16 * Mss];
+    result r;
+    uint16_t port = 998;
+    uint32_t ack = handshake(NULL, port, 0);
+    stream * s = accepted;
+
+    uint32_t writes = n / 16 + 1;
+    start(&r, "bulk tx", writes);
+    uint64_t frames = sent.frames;
+    for (uint32_t i = 0; i < writes; i++) {
+        uint64_t t = now();
+        tcp_send(s, data, sizeof(data));
+        uint16_t len = build(port, 1, sent.seq + Mss, TcpAck, 0);
+        netdev_receive(&dev, frame, len);
+        gro_flush();
+        sample(&r, now() - t);
+    }
+    r.packets = sent.frames - frames;
+    check(sent.seq == ack + (writes - 1) * sizeof(data) + 15 * Mss, "bulk send");
+    report(&r);
+}
+
+int main(int argc, char**argv) {
+    uint32_t n = argc > 1 ? atoi(argv[1]) : 100000;
+    uint32_t segments = argc > 2 ? atoi(argv[2]) : 2000000;
+
+    // the kernel's heap shape, so nothing fits here that wouldn't there
+    size_t size = 64*1024*1024;
+    kmem_add_block(malloc(size), size, 0x400);
+    arp_store(remote, Remote);
+    tcp_listen(Port, accept);
+
+    printf("%-10s %10s %12s %10s %8s %8s %8s %8s\n",
+            "", "packets", "packets/s", "ns/packet", "allocs", "p50 ns", "p99 ns", "p99.9 ns");
+    connections(n);
+    bulk_receive(segments);
+    bulk_send(segments);
+    return 0;
+}
@@ -0,0 +1,137 @@
+// Replays a pcap file through the network stack on the host as fast as it
+// will go, to profile or debug against a recorded traffic mix.
+//
+// usage: pcapreplay <in.pcap> [repeat] [out.pcap]
+//
+// The stack takes the address of the first IPv4 frame's destination, and
+// listens on every TCP port a SYN is sent to. With out.pcap, the last of
+// what went in and came back out is written there.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "memory.h"
+#include "errno.h"
+#include "net/device.h"
+#include "net/ethernet.h"
+#include "net/ip.h"
+#include "net/tcp.h"
+#include "net/gro.h"
+#include "net/pcap.h"
+#include "net/sbuff.h"
+#include "net/ntox.h"
+
+#define Ring (31 * 1024)   // as big as the heap here gives in one piece
+
+static void discard(struct netdevice * dev, sbuff * sb) {
+    add_ref(sb);
+    release_ref(sb, sbuff_free);
+}
+
+static struct netdevice dev = {.send = discard};
+
+static void on_read(stream * s, const uint8_t * data, uint32_t sz) {
+    if (!data) tcp_close(s);
+}
+
+static tcp_read_fn accept(stream * s) { return on_read; }
+
+static const struct ipv4_header * ipv4(const uint8_t * frame, uint32_t len) {
+    const struct ethernet_frame * eth = (const struct ethernet_frame*) frame;
+    if (len < sizeof(*eth) + sizeof(struct ipv4_header)) return NULL;
+    if (eth->sizeOrType != ntos(0x0800)) return NULL;
+    return (const struct ipv4_header*)(eth + 1);
+}
+
+// first pass: who we are and what we serve
+static void survey(void * user, const uint8_t * frame, uint32_t len) {
+    const struct ipv4_header * ip = ipv4(frame, len);
+    if (!ip) return;
+    if (!dev.ip) dev.ip = ntol(ip->dest);
+
+    const tcp_hdr * tcp = (const tcp_hdr*)((const uint8_t*)ip + ip->ihl * 4);
+    if (ip->proto != IPPROTO_TCP || ntol(ip->dest) != dev.ip) return;
+    if ((const uint8_t*)(tcp + 1) > frame + len) return;
+    if ((tcp->flags & (TcpSyn | TcpAck)) == TcpSyn) {
+        tcp_listen(ntos(tcp->destPort), accept); // EADDRINUSE after the first
+    }
+}
+
+static uint64_t frames;
+
+static void deliver(void * user, const uint8_t * frame, uint32_t len) {
+    if (len > 0xffff) return;
+    netdev_receive(&dev, frame, len);
+    if (++frames % NetdevPollBudget == 0) gro_flush();
+}
+
+static void save(void * user, const void * data, uint32_t len) {
+    fwrite(data, 1, len, (FILE*) user);
+}
+
+static uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int main(int argc, char**argv) {
+    if (argc < 2) {
+        printf("usage: %s <in.pcap> [repeat] [out.pcap]\n", argv[0]);
+        return 1;
+    }
+    int repeat = argc > 2 ? atoi(argv[2]) : 1;
+
+    FILE * in = fopen(argv[1], "rb");
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    uint8_t * file = malloc(size);
+    if (fread(file, 1, size, in) != size) {
+        perror(argv[1]);
+        return 1;
+    }
+    fclose(in);
+
+    size_t heap = 64*1024*1024;
+    kmem_add_block(malloc(heap), heap, 0x400);
+
+    if (pcap_replay(file, size, survey, NULL) < 0) {
+        printf("%s: not an ethernet pcap file\n", argv[1]);
+        return 1;
+    }
+    if (argc > 3) pcap_start(Ring);
+
+    uint32_t allocations = kmem_allocations();
+    uint64_t start = now();
+    for (int i = 0; i < repeat; i++) {
+        pcap_replay(file, size, deliver, NULL);
+    }
+    gro_flush();
+    uint64_t elapsed = now() - start;
+    allocations = kmem_allocations() - allocations;
+    if (!frames) {
+        printf("%s: no frames\n", argv[1]);
+        return 1;
+    }
+
+    printf("%lu frames in %.3f s: %.0f frames/s, %.1f ns/frame, %.2f allocs/frame\n",
+            frames, elapsed / 1e9, frames / (elapsed / 1e9),
+            (double)elapsed / frames, (double)allocations / frames);
+
+    if (argc > 3) {
+        FILE * out = fopen(argv[3], "wb");
+        if (!out) {
+            perror(argv[3]);
+            return 1;
+        }
+        pcap_export(save, out);
+        fclose(out);
+    }
+    return 0;
+}
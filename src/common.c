@@ -30,6 +30,14 @@ uint32_t inl(uint16_t port) {
     return ret;
 }
 
+void insw(uint16_t port, void * dest, size_t count) {
+    asm volatile ("rep insw" : "+D" (dest), "+c" (count) : "d" (port) : "memory");
+}
+
+void outsw(uint16_t port, const void * src, size_t count) {
+    asm volatile ("rep outsw" : "+S" (src), "+c" (count) : "d" (port) : "memory");
+}
+
 void bzero(void *dest, uint64_t count) {
     for (uint64_t i = 0; i < count; i++) {
         ((char*)dest)[i] = 0;
@@ -63,7 +71,7 @@ char* to_str(uint32_t d, char * buff) {
     if (!d) {
         buff[0] = '0';
         buff[1] = 0;
-        return buff + 2;
+        return buff + 1;
     }
 
     char * p = buff;
@@ -84,6 +92,14 @@ void * memcpy(void * dest, const void * src, size_t n) {
     return dest;
 }
 
+void * memmove(void * dest, const void * src, size_t n) {
+    if (dest <= src) return memcpy(dest, src, n);
+    for (size_t i = n; i > 0; i--) {
+        ((char*)dest)[i - 1] = ((const char*)src)[i - 1];
+    }
+    return dest;
+}
+
 int strncmp(const char * a, const char * b, size_t n) {
     for( ; *a && *b && n; a++, b++, n--) {
         if (*a < *b) return -1;
@@ -97,9 +113,9 @@ int strncmp(const char * a, const char * b, size_t n) {
 }
 
 int memcmp(const void * a, const void *b, size_t n) {
-    const char * ac = a;
-    const char * bc = b;
-    for (; n; --n) {
+    const unsigned char * ac = a;
+    const unsigned char * bc = b;
+    for (; n; --n, ++ac, ++bc) {
         if (*ac < *bc) return -1;
         if (*ac > *bc) return 1;
     }
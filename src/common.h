@@ -14,8 +14,13 @@ uint8_t inb(uint16_t port);
 uint16_t inw(uint16_t port);
 uint32_t inl(uint16_t port);
 
+// `count` 16 bit words between `port` and memory
+void insw(uint16_t port, void * dest, size_t count);
+void outsw(uint16_t port, const void * src, size_t count);
+
 void bzero(void * dest, size_t count);
 void *memcpy(void * dest, const void * src, size_t n);
+void *memmove(void * dest, const void * src, size_t n);
 int memcmp(const void * a, const void *b, size_t n);
 
 size_t strlen(const char * what);
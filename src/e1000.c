@@ -0,0 +1,311 @@
+#include "e1000.h"
+#include "interrupt.h"
+#include "pci.h"
+
+#include "console.h"
+#include "memory.h"
+
+#include "net/ethernet.h"
+#include "net/ip.h"
+#include "net/sbuff.h"
+#include "net/device.h"
+
+// 8254x registers
+#define CTRL 0x0000
+#define EERD 0x0014
+#define ICR 0x00c0
+#define ITR 0x00c4
+#define IMS 0x00d0
+#define IMC 0x00d8
+#define RCTL 0x0100
+#define TCTL 0x0400
+#define TIPG 0x0410
+#define RDBAL 0x2800
+#define RDBAH 0x2804
+#define RDLEN 0x2808
+#define RDH 0x2810
+#define RDT 0x2818
+#define TDBAL 0x3800
+#define TDBAH 0x3804
+#define TDLEN 0x3808
+#define TDH 0x3810
+#define TDT 0x3818
+#define MTA 0x5200
+#define RAL0 0x5400
+#define RAH0 0x5404
+
+enum CtrlBits {
+    CtrlAutoSpeed = 1 << 5,
+    CtrlSetLinkUp = 1 << 6,
+    CtrlReset = 1 << 26
+};
+
+enum InterruptBits {
+    IntTxDone = 1 << 0,
+    IntLinkChange = 1 << 2,
+    IntRxMinThreshold = 1 << 4,
+    IntRxOverrun = 1 << 6,
+    IntRxTimer = 1 << 7,
+
+    IntRx = IntRxTimer | IntRxOverrun | IntRxMinThreshold
+};
+
+enum RctlBits {
+    RctlEnable = 1 << 1,
+    RctlBroadcast = 1 << 15,
+    RctlStripCrc = 1 << 26      // buffer size bits left at 0: 2048 bytes
+};
+
+enum TctlBits {
+    TctlEnable = 1 << 1,
+    TctlPadShort = 1 << 3,
+    TctlCollisionThreshold = 0x10 << 4,
+    TctlCollisionDistance = 0x40 << 12
+};
+
+enum DescBits {
+    DescDone = 1 << 0,          // status
+    DescEop = 1 << 1,           // rx status
+    TxEop = 1 << 0,             // tx command
+    TxInsertCrc = 1 << 1,
+    TxInsertChecksum = 1 << 2,
+    TxReportStatus = 1 << 3
+};
+
+#define RxDescriptors 128
+#define TxDescriptors 128
+#define RxBufferSize 2048
+
+// interrupt throttling, in 256ns units: about 8000 a second at most
+#define ItrInterval 488
+
+struct rx_desc {
+    uint64_t addr;
+    uint16_t length;
+    uint16_t checksum;
+    uint8_t status;
+    uint8_t errors;
+    uint16_t special;
+} __attribute__ ((packed));
+
+struct tx_desc {
+    uint64_t addr;
+    uint16_t length;
+    uint8_t cso;
+    uint8_t cmd;
+    uint8_t status;
+    uint8_t css;
+    uint16_t special;
+} __attribute__ ((packed));
+
+typedef struct e1000_t {
+    struct netdevice netdev;    // first, the stack hands us this
+    volatile uint8_t * mmio;
+    volatile struct rx_desc * rx;
+    volatile struct tx_desc * tx;
+    uint8_t * rxBuffers[RxDescriptors];     // allocated once, the card fills them
+    sbuff * txBuffers[TxDescriptors];
+    uint16_t rxNext;
+    uint16_t txNext;
+    uint16_t txClean;
+} e1000;
+
+static uint32_t myIp = 0xC0A80302;
+static uint32_t gateway = 0xC0A80301;
+
+static inline uint32_t rd(e1000 * nic, uint32_t reg) {
+    return *(volatile uint32_t*)(nic->mmio + reg);
+}
+
+static inline void wr(e1000 * nic, uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(nic->mmio + reg) = value;
+}
+
+// descriptor rings want 16 byte alignment; take 128 to be safe
+static void * alloc_ring(uint32_t bytes, void ** raw) {
+    *raw = kmem_alloc(bytes + 128);
+    uint8_t * ring = (uint8_t*)(((uint64_t)*raw + 127) & ~127ul);
+    bzero(ring, bytes);
+    return ring;
+}
+
+static uint16_t eeprom_read(e1000 * nic, uint8_t word) {
+    wr(nic, EERD, 1 | word << 8);
+    uint32_t v;
+    while (!((v = rd(nic, EERD)) & (1 << 4))) ;
+    return v >> 16;
+}
+
+static void reclaim_tx(e1000 * nic) {
+    while (nic->txClean != nic->txNext && (nic->tx[nic->txClean].status & DescDone)) {
+        release_ref(nic->txBuffers[nic->txClean], sbuff_free);
+        nic->txBuffers[nic->txClean] = NULL;
+        nic->txClean = (nic->txClean + 1) % TxDescriptors;
+    }
+}
+
+// the card holds a descriptor back until RDT passes it, so frames go up
+// straight from the receive buffers
+static int e1000_poll(struct netdevice * self, int budget) {
+    e1000 * nic = (e1000*) self;
+    int done = 0;
+
+    uint16_t last = RxDescriptors;
+    while (done < budget) {
+        volatile struct rx_desc * d = &nic->rx[nic->rxNext];
+        if (!(d->status & DescDone)) break;
+
+        if ((d->status & DescEop) && !d->errors) {
+            netdev_receive(self, nic->rxBuffers[nic->rxNext], d->length);
+        }
+        done++;
+
+        d->status = 0;
+        last = nic->rxNext;
+        nic->rxNext = (nic->rxNext + 1) % RxDescriptors;
+    }
+    if (last != RxDescriptors) wr(nic, RDT, last);
+
+    return done;
+}
+
+static void e1000_rx_unmask(struct netdevice * self) {
+    wr((e1000*) self, IMS, IntRx);
+}
+
+static void e1000_irq(registers_t * regs, void * user) {
+    e1000 * nic = (e1000*) user;
+    uint32_t cause = rd(nic, ICR); // reading clears it
+    if (!cause) return;
+
+    if (cause & IntRx) {
+        wr(nic, IMC, IntRx);
+        netdev_rx_schedule(&nic->netdev);
+    }
+
+    if (cause & IntTxDone) reclaim_tx(nic);
+}
+
+static int queue_tx(e1000 * nic, sbuff * sb) {
+    add_ref(sb);
+    uint16_t next = (nic->txNext + 1) % TxDescriptors;
+    if (next == nic->txClean) {
+        release_ref(sb, sbuff_free); // ring full, drop it
+        return 0;
+    }
+
+    volatile struct tx_desc * d = &nic->tx[nic->txNext];
+    d->addr = (uint64_t)sb->head;
+    d->length = sb->currSize;
+    d->cmd = TxEop | TxInsertCrc | TxReportStatus;
+    d->status = 0;
+    if (sb->csumStart) {
+        // legacy descriptors sum from css to the end and store it at cso
+        d->css = sb->data + sb->csumStart - sb->head;
+        d->cso = d->css + sb->csumOffset;
+        d->cmd |= TxInsertChecksum;
+    }
+    nic->txBuffers[nic->txNext] = sb;
+    nic->txNext = next;
+    return 1;
+}
+
+static void e1000_send(struct netdevice * dev, sbuff * sb) {
+    e1000 * nic = (e1000*) dev;
+
+    disable_interrupts();
+    reclaim_tx(nic);
+    if (queue_tx(nic, sb)) wr(nic, TDT, nic->txNext);
+    enable_interrupts();
+}
+
+// one tail update for the lot
+static void e1000_send_batch(struct netdevice * dev, sbuff ** sbuffs, uint16_t count) {
+    e1000 * nic = (e1000*) dev;
+
+    disable_interrupts();
+    reclaim_tx(nic);
+    for (uint16_t i = 0; i < count; i++) {
+        queue_tx(nic, sbuffs[i]);
+    }
+    wr(nic, TDT, nic->txNext);
+    enable_interrupts();
+}
+
+static void initialize(const pci_device * pci) {
+    int io;
+    uint64_t bar0 = pci_bar(pci, 0, &io);
+    if (io) {
+        warn("e1000: expected a memory BAR");
+        return;
+    }
+
+    e1000 * nic = kmem_alloc(sizeof(e1000));
+    bzero(nic, sizeof(e1000));
+    nic->mmio = (volatile uint8_t*) bar0;
+
+    wr(nic, IMC, 0xffffffff);
+    wr(nic, CTRL, rd(nic, CTRL) | CtrlReset);
+    while (rd(nic, CTRL) & CtrlReset) ;
+    wr(nic, IMC, 0xffffffff);
+    wr(nic, CTRL, rd(nic, CTRL) | CtrlSetLinkUp | CtrlAutoSpeed);
+
+    struct netdevice * self = &nic->netdev;
+    self->send = e1000_send;
+    self->send_batch = e1000_send_batch;
+    self->features = NetdevTxCsum;
+    init_netdev_poll(self, e1000_poll, e1000_rx_unmask);
+
+    uint32_t lo = rd(nic, RAL0), hi = rd(nic, RAH0);
+    if (!lo) {
+        uint16_t w0 = eeprom_read(nic, 0), w1 = eeprom_read(nic, 1), w2 = eeprom_read(nic, 2);
+        lo = w0 | (uint32_t)w1 << 16;
+        hi = w2;
+    }
+    console_print_string("Found e1000 on IRQ %d with MAC ", pci->intr);
+    for (int i = 0; i < 6; i++) {
+        self->mac[i] = (i < 4 ? lo >> (i * 8) : hi >> ((i - 4) * 8)) & 0xff;
+        if (i) console_print_string(":");
+        console_put_hex8(self->mac[i]);
+    }
+    console_print_string("\n");
+    wr(nic, RAL0, lo);
+    wr(nic, RAH0, (hi & 0xffff) | 1u << 31);
+
+    for (int i = 0; i < 128; i++) wr(nic, MTA + i * 4, 0);
+
+    // receive: every descriptor gets its buffer up front
+    void * raw;
+    nic->rx = alloc_ring(RxDescriptors * sizeof(struct rx_desc), &raw);
+    for (int i = 0; i < RxDescriptors; i++) {
+        nic->rxBuffers[i] = kmem_alloc(RxBufferSize);
+        nic->rx[i].addr = (uint64_t)nic->rxBuffers[i];
+    }
+    wr(nic, RDBAL, (uint64_t)nic->rx);
+    wr(nic, RDBAH, (uint64_t)nic->rx >> 32);
+    wr(nic, RDLEN, RxDescriptors * sizeof(struct rx_desc));
+    wr(nic, RDH, 0);
+    wr(nic, RDT, RxDescriptors - 1);
+    wr(nic, RCTL, RctlEnable | RctlBroadcast | RctlStripCrc);
+
+    nic->tx = alloc_ring(TxDescriptors * sizeof(struct tx_desc), &raw);
+    wr(nic, TDBAL, (uint64_t)nic->tx);
+    wr(nic, TDBAH, (uint64_t)nic->tx >> 32);
+    wr(nic, TDLEN, TxDescriptors * sizeof(struct tx_desc));
+    wr(nic, TDH, 0);
+    wr(nic, TDT, 0);
+    wr(nic, TCTL, TctlEnable | TctlPadShort | TctlCollisionThreshold | TctlCollisionDistance);
+    wr(nic, TIPG, 10 | 8 << 10 | 6 << 20);
+
+    wr(nic, ITR, ItrInterval);
+
+    register_interrupt_handler(pci->intr + 32, e1000_irq, nic);
+    rd(nic, ICR);
+    wr(nic, IMS, IntRx | IntTxDone | IntLinkChange);
+
+    ip_configure(self, myIp, 24, gateway);
+}
+
+void init_e1000() {
+    register_pci_dma_device(0x8086, 0x100e, initialize);
+}
@@ -59,12 +59,25 @@ typedef struct directory_entry {
     uint32_t fileSize;
 } __attribute((packed)) directory_entry;
 
+#define SectorSize 512
+#define EndOfChain 0x0ffffff8
+
 typedef struct {
-    file_system fs;
+    file_system fs;             // first, the vfs hands us this
+    // both packed, so they're read in together as on disk
     bios_parameter_block  bpb;
     fat32_boot_sector  bs;
     storage_device * store;
-} __attribute__((packed)) fat_device;
+
+    // where the last read left off in a chain, so the next can carry on
+    uint32_t cursorFirst;
+    uint32_t cursorIndex;
+    uint32_t cursorCluster;
+
+    uint32_t fatLba;            // of the table sector held in fat
+    uint8_t fat[SectorSize];
+    uint8_t sector[SectorSize]; // for reads that don't start on a sector
+} fat_device;
 
 uint32_t lbaOfCluster(fat_device* self, uint32_t cluster) {
     uint32_t fatSectors = self->bs.tableSize * self->bpb.noFats;
@@ -111,34 +124,122 @@ static int find(file_system * fs, const char * filename, directory_entry * buf)
     return ENOTFOUND;
 }
 
-static int slurp(file_system *fs, const char * filename, char * buf, size_t size) {
+// the cluster after `cluster` in its chain
+static uint32_t next_cluster(fat_device * dev, uint32_t cluster) {
+    uint32_t byte = cluster * 4;
+    uint32_t lba = dev->bpb.reservedSectors + byte / SectorSize;
+    if (lba != dev->fatLba) {
+        if (dev->store->read_sector(dev->store, lba, dev->fat, SectorSize)) return EndOfChain;
+        dev->fatLba = lba;
+    }
 
-    directory_entry e;
-    int r = find(fs, filename, &e);
-    if (r == EOK) {
-        if (e.attributes != 0x20) {
-            return EINVALID;
-        }
+    return *(uint32_t*)(dev->fat + byte % SectorSize) & 0x0fffffff;
+}
 
-        fat_device * dev = (fat_device*) fs;
+// the `index`th cluster of the chain from `first`, or 0 if it's shorter
+static uint32_t cluster_at(fat_device * dev, uint32_t first, uint32_t index) {
+    uint32_t cluster = first;
+    uint32_t at = 0;
+    if (dev->cursorFirst == first && dev->cursorIndex <= index) {
+        cluster = dev->cursorCluster;
+        at = dev->cursorIndex;
+    }
 
-        uint32_t cluster = (e.clusterHigh << 16) + e.clusterLow;
-        uint32_t lba = lbaOfCluster(dev, cluster);
+    for (; at < index; at++) {
+        cluster = next_cluster(dev, cluster);
+        if (cluster < 2 || cluster >= EndOfChain) return 0;
+    }
 
-        if (size > e.fileSize) size = e.fileSize;
+    dev->cursorFirst = first;
+    dev->cursorIndex = index;
+    dev->cursorCluster = cluster;
+    return cluster;
+}
 
-        if (EOK == (r = dev->store->read_sector(dev->store, lba, buf, size))) {
-            return size;
+static int read_file(fat_device * dev, const directory_entry * e, uint32_t offset,
+        char * buf, size_t size) {
+    if (offset >= e->fileSize) return 0;
+    if (size > e->fileSize - offset) size = e->fileSize - offset;
+
+    uint32_t clusterBytes = SectorSize * dev->bpb.sectorsPerCluster;
+    uint32_t first = (e->clusterHigh << 16) + e->clusterLow;
+
+    size_t done = 0;
+    while (done < size) {
+        uint32_t at = offset + done;
+        uint32_t cluster = cluster_at(dev, first, at / clusterBytes);
+        if (!cluster) return EINVALID;
+
+        uint32_t within = at % clusterBytes;
+        uint32_t lba = lbaOfCluster(dev, cluster) + within / SectorSize;
+        uint32_t skip = within % SectorSize;
+
+        // the rest of this cluster in one go, if it lines up
+        uint32_t n = clusterBytes - within;
+        if (n > size - done) n = size - done;
+        if (!skip && n % 2 == 0) {
+            if (dev->store->read_sector(dev->store, lba, buf + done, n)) return EINVALID;
         }
+        else {
+            if (dev->store->read_sector(dev->store, lba, dev->sector, SectorSize)) return EINVALID;
+            if (n > SectorSize - skip) n = SectorSize - skip;
+            memcpy(buf + done, dev->sector + skip, n);
+        }
+        done += n;
     }
 
-    return r;
+    return done;
+}
+
+static int read_file_at(file_system *fs, const char * filename, uint32_t offset,
+        char * buf, size_t size) {
+    directory_entry e;
+    int r = find(fs, filename, &e);
+    if (r != EOK) return r;
+    if (e.attributes != 0x20) return EINVALID;
+
+    return read_file((fat_device*) fs, &e, offset, buf, size);
+}
+
+static int slurp(file_system *fs, const char * filename, char * buf, size_t size) {
+    return read_file_at(fs, filename, 0, buf, size);
 }
 
 static int exists(file_system* fs, const char * filename) {
     return find(fs, filename, NULL);
 }
 
+// days from 1970-01-01 to a date in the proleptic Gregorian calendar
+static uint32_t days_from_civil(uint32_t y, uint32_t m, uint32_t d) {
+    y -= m <= 2;
+    uint32_t era = y / 400;
+    uint32_t yoe = y - era * 400;
+    uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// FAT keeps local time, which we take to be UTC, to two seconds
+static uint32_t fat_time(uint16_t date, uint16_t time) {
+    uint32_t year = 1980 + (date >> 9);
+    uint32_t month = (date >> 5) & 0xf;
+    uint32_t day = date & 0x1f;
+    if (!month || !day) return 0;
+
+    uint32_t secs = (time >> 11) * 3600 + ((time >> 5) & 0x3f) * 60 + (time & 0x1f) * 2;
+    return days_from_civil(year, month, day) * 86400 + secs;
+}
+
+static int stat_file(file_system * fs, const char * filename, file_info * info) {
+    directory_entry e;
+    int r = find(fs, filename, &e);
+    if (r != EOK) return r;
+
+    info->size = e.fileSize;
+    info->mtime = fat_time(e.modify_d, e.modify_t);
+    return EOK;
+}
+
 
 void init_fat32(storage_device * dev) {
     fat_device * self = kmem_alloc(sizeof(fat_device));
@@ -182,6 +283,8 @@ void init_fat32(storage_device * dev) {
 
     self->fs.exists = exists;
     self->fs.slurp = slurp;
+    self->fs.stat = stat_file;
+    self->fs.read_at = read_file_at;
     register_fs(&self->fs);
     return;
 
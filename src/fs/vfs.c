@@ -19,3 +19,30 @@ int read(const char * filename, char * buf, size_t sz) {
 
     return ENOTFOUND;
 }
+
+int stat(const char * filename, file_info * info) {
+    list_node * node;
+    for (node = file_systems.head; node; node = node->next) {
+        file_system * fs = node->payload;
+        if (fs->exists(fs, filename) == EOK) {
+            if (!fs->stat) return EINVALID;
+            return fs->stat(fs, filename, info);
+        }
+    }
+
+    return ENOTFOUND;
+}
+
+int read_at(const char * filename, uint32_t offset, char * buf, size_t sz) {
+    list_node * node;
+    for (node = file_systems.head; node; node = node->next) {
+        file_system * fs = node->payload;
+        if (fs->exists(fs, filename) == EOK) {
+            if (fs->read_at) return fs->read_at(fs, filename, offset, buf, sz);
+            if (offset) return EINVALID;
+            return fs->slurp(fs, filename, buf, sz);
+        }
+    }
+
+    return ENOTFOUND;
+}
@@ -6,13 +6,25 @@ typedef struct storage_device_t {
     int (*read_sector)(struct storage_device_t *, uint64_t lba, void * buf, size_t sz);
 } storage_device;
 
+typedef struct file_info_t {
+    uint32_t size;
+    uint32_t mtime;     // seconds since 1970 UTC, 0 if not known
+} file_info;
+
 typedef struct file_system_t {
     int (*exists)(struct file_system_t *, const char * filename);
     int (*slurp)(struct file_system_t *, const char * filename, char * buf, size_t sz);
+    // optional
+    int (*stat)(struct file_system_t *, const char * filename, file_info * info);
+    int (*read_at)(struct file_system_t *, const char * filename, uint32_t offset,
+            char * buf, size_t sz);
 } file_system;
 
 
 void register_fs(file_system * dev);
 
 int read(const char * filename, char * buf, size_t sz);
+int stat(const char * filename, file_info * info);
+// `sz` bytes from `offset` on, or fewer at the end; returns how many
+int read_at(const char * filename, uint32_t offset, char * buf, size_t sz);
 
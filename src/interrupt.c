@@ -116,3 +116,13 @@ void init_interrupts() {
 
 void disable_interrupts() {asm("cli");}
 void enable_interrupts() {asm("sti");}
+
+uint64_t save_and_disable_interrupts() {
+    uint64_t flags;
+    asm volatile("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+void restore_interrupts(uint64_t flags) {
+    if (flags & 0x200) asm volatile("sti" : : : "memory"); // IF
+}
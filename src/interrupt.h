@@ -39,3 +39,8 @@ void register_interrupt_handler(uint8_t interrupt, isr_t, void * user);
 
 void disable_interrupts();
 void enable_interrupts();
+
+// For code that may run from an interrupt handler as well as outside one:
+// turns interrupts off, and restore_interrupts puts them back how they were.
+uint64_t save_and_disable_interrupts();
+void restore_interrupts(uint64_t flags);
@@ -4,8 +4,14 @@
 #include "memory.h"
 #include "interrupt.h"
 #include "task.h"
+#include "timer.h"
 #include "pci.h"
 #include "ne2k.h"
+#include "virtio_net.h"
+#include "e1000.h"
+#include "net/ip.h"
+#include "net/arp.h"
+#include "net/loopback.h"
 #include "ata.h"
 #include "entry.h"
 #include "process.h"
@@ -15,6 +21,7 @@
 #include "service/http.h"
 #include "service/echo.h"
 #include "service/clock.h"
+#include "service/capture.h"
 
 static void dump_stack(registers_t* regs) {
     uint32_t * start = (uint32_t*)(regs + 1);
@@ -252,8 +259,16 @@ int main() {
     kmem_init();
     parse_memory_map();
 
+    init_timer();
+
+    init_ip();
+    init_arp();
+    init_loopback();
+
     init_pci();
     init_ne2k();
+    init_virtio_net();
+    init_e1000();
 
     init_keyboard();
 
@@ -261,6 +276,7 @@ int main() {
 
     init_http();
     init_echo();
+    init_capture();
     init_clock();
 
     char buf[256];
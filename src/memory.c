@@ -10,6 +10,8 @@ typedef struct BlockT {
     uint32_t chunkMasks[];
 } Block;
 
+#define ChunksPerMask 32   // bits in a chunkMasks word
+
 typedef struct AllocationHeaderT {
     uint32_t chunks;
     uint32_t sequence;
@@ -27,6 +29,10 @@ uint32_t kmem_current_objects() {
     return heap.currentObjects;
 }
 
+uint32_t kmem_allocations() {
+    return heap.sequence;
+}
+
 void kmem_add_block(void* start, uint64_t size, size_t chunkSize) {
     Block * newb = (Block*) start;
     newb->next = heap.block;
@@ -35,13 +41,12 @@ void kmem_add_block(void* start, uint64_t size, size_t chunkSize) {
     newb->size = size - sizeof(Block);
     newb->chunkSize = chunkSize;
 
-    newb->nChunks = newb->size / newb->chunkSize;
-    // if (newb->nChunks * newb->chunkSize < newb->size) newb->nChunks++;
+    // every chunk costs its size plus a bit of mask, and whole mask words
+    // only; keep 8 bytes spare for alignment
+    newb->nChunks = (newb->size - 8) * 8 / (8 * newb->chunkSize + 1);
+    newb->nChunks -= newb->nChunks % ChunksPerMask;
 
-    size_t maskSize = sizeof(newb->chunkMasks[0]);
-    newb->nChunks = (newb->nChunks / maskSize) * maskSize;
-
-    bzero(newb+1, newb->nChunks);
+    bzero(newb+1, newb->nChunks / 8);
 }
 
 void kmem_init() {
@@ -69,7 +74,11 @@ static char * align8(char * p) {
  * chunk masks
  */
 static char * kmem_block_start(Block* block) {
-    return align8((char*)(block + 1) + block->nChunks / sizeof(block->chunkMasks[0]));
+    return align8((char*)(block + 1) + block->nChunks / 8);
+}
+
+static inline uint32_t mask_of(uint32_t chunks) {
+    return ((uint64_t)1 << chunks) - 1;
 }
 
 void* kmem_alloc(size_t size) {
@@ -83,16 +92,16 @@ void* kmem_alloc(size_t size) {
 
         if (block->chunkSize * requiredChunks < size) requiredChunks ++;
 
-        if (requiredChunks > 32) continue;
+        if (requiredChunks > ChunksPerMask) continue;
 
-        for(uint32_t chunk = 0; chunk < block->nChunks; chunk++) {
-            uint32_t mask = (1 << requiredChunks) - 1;
-            int nBits = sizeof(block->chunkMasks[0]) * 8 - requiredChunks + 1;
+        for(uint32_t chunk = 0; chunk < block->nChunks / ChunksPerMask; chunk++) {
+            uint32_t mask = mask_of(requiredChunks);
+            int nBits = ChunksPerMask - requiredChunks + 1;
             for (int bit = 0; bit < nBits; bit++, mask <<= 1) {
                 if (test_bits(~block->chunkMasks[chunk], mask)) {
                     block->chunkMasks[chunk] |= mask;
 
-                    size_t offset = block->chunkSize * (chunk * 8 * sizeof(block->chunkMasks[0]) + bit);
+                    size_t offset = block->chunkSize * (chunk * ChunksPerMask + bit);
                     char *memory = kmem_block_start(block) + offset;
                     ((AllocationHeader*)memory)->chunks = requiredChunks;
                     ((AllocationHeader*)memory)->sequence = heap.sequence++;
@@ -107,13 +116,21 @@ void* kmem_alloc(size_t size) {
     panic("out of memory");
 }
 
+size_t kmem_largest() {
+    size_t largest = 0;
+    for (Block * block = heap.block; block; block = block->next) {
+        size_t size = block->chunkSize * ChunksPerMask - sizeof(AllocationHeader);
+        if (size > largest) largest = size;
+    }
+    return largest;
+}
+
 static void kmem_free_from_block(Block* block, AllocationHeader * header) {
-    size_t offset = (char*)header - kmem_block_start(block);
-    uint32_t chunkSet = (offset / block->chunkSize) / (sizeof(block->chunkMasks[0]));
-    char* firstForChunkSet = kmem_block_start(block) + 8 * sizeof(block->chunkMasks[0]) * chunkSet;
-    uint32_t shift = ((char*)header - firstForChunkSet) / block->chunkSize;
+    size_t index = ((char*)header - kmem_block_start(block)) / block->chunkSize;
+    uint32_t chunkSet = index / ChunksPerMask;
+    uint32_t shift = index % ChunksPerMask;
 
-    uint32_t mask = ((1 << header->chunks) - 1) << shift;
+    uint32_t mask = mask_of(header->chunks) << shift;
     block->chunkMasks[chunkSet] &= ~mask;
 
     heap.currentObjects--;
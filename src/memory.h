@@ -5,4 +5,8 @@ void kmem_add_block(void * start, size_t size, size_t chunkSize);
 void *kmem_alloc(size_t size);
 void kmem_free(void*);
 
+// the most one kmem_alloc could ever hand out
+size_t kmem_largest();
+
 uint32_t kmem_current_objects();
+uint32_t kmem_allocations();  // ever made, wrapping
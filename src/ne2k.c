@@ -4,10 +4,10 @@
 
 #include "console.h"
 #include "memory.h"
-#include "task.h"
 
 #include "net/ethernet.h"
 #include "net/arp.h"
+#include "net/ip.h"
 #include "net/ntox.h"
 #include "net/device.h"
 
@@ -64,151 +64,230 @@ static int tx_start_page = 0x40; // start of NE2000 buffer
 static int rx_start_page = 0x4c;
 static int stop_page = 0x80;     // end of NE2000 buffer
 
-struct recv_data {
-    struct netdevice * self;
-    uint8_t buffer[];
-};
+// The transmit area holds two frames: one goes out on the wire while the
+// next is copied into the other, and PacketTransmitted swaps them over.
+#define TxPagesPerBuffer 6
+#define TxQueueLen 32
+#define MinFrame 60
+
+typedef struct ne2k_t {
+    struct netdevice netdev;    // first, the stack hands us this
+    sbuff * queue[TxQueueLen];
+    uint8_t queueHead;
+    uint8_t queueCount;
+    uint16_t staged[2];         // frame length waiting in each buffer, 0 if free
+    int sending;                // buffer on the wire, -1 if idle
+} ne2k;
+
+static uint8_t tx_page(int buffer) {
+    return tx_start_page + buffer * TxPagesPerBuffer;
+}
 
-static void dispatch(void* user) {
-    struct recv_data *data = (struct recv_data*) user;
-    ethernet_packet(data->self, data->buffer);
-    kmem_free(data);
+static void start_transmit(ne2k * nic, int buffer) {
+    struct netdevice * self = &nic->netdev;
+    uint16_t size = nic->staged[buffer];
+
+    outb(self->iomem, NoDma|Page0);
+    outb(TXCNTLO, size & 0xff);
+    outb(TXCNTHI, size >> 8);
+    outb(TSTART, tx_page(buffer));
+    outb(self->iomem, NoDma|Transmit|Start);
+    nic->sending = buffer;
 }
 
-// TODO: * larger reads, DMA
-static void ne2k_irq(registers_t* regs, void * ptr) {
-    struct netdevice* self = (struct netdevice*) ptr;
-    uint8_t wtf = inb(ISR);
+// copy a frame into the card's memory with remote DMA
+static void stage(ne2k * nic, int buffer, sbuff * sb) {
+    struct netdevice * self = &nic->netdev;
+    uint16_t size = sb->currSize;
+    // runts go out padded, with zeros rather than whatever was there before
+    uint16_t len = size < MinFrame ? MinFrame : size;
+    uint16_t even = (len + 1) & ~1;
+
+    outb(self->iomem, NoDma|Page0|Start);
+    outb(ISR, RemoteDmaComplete);
+    outb(REMBCOUNTLO, even & 0xff);
+    outb(REMBCOUNTHI, even >> 8);
+    outb(REMSTARTADDRLO, 0);
+    outb(REMSTARTADDRHI, tx_page(buffer));
+    outb(self->iomem, RemoteWrite|Start);
 
-    if (wtf & RemoteDmaComplete) {
-        outb(ISR, RemoteDmaComplete);
+    outsw(DATA, sb->head, size / 2);
+    if (size & 1) outw(DATA, sb->head[size - 1]);
+    for (uint16_t at = (size + 1) & ~1; at < even; at += 2) outw(DATA, 0);
+
+    for (int spin = 0; spin < 10000 && !(inb(ISR) & RemoteDmaComplete); spin++) ;
+    outb(ISR, RemoteDmaComplete);
+
+    nic->staged[buffer] = len;
+}
+
+// fill whichever buffers are free, and keep the wire busy
+static void pump(ne2k * nic) {
+    for (int b = 0; b < 2 && nic->queueCount; b++) {
+        if (nic->staged[b] || nic->sending == b) continue;
+
+        sbuff * sb = nic->queue[nic->queueHead];
+        nic->queueHead = (nic->queueHead + 1) % TxQueueLen;
+        nic->queueCount--;
+
+        stage(nic, b, sb);
+        release_ref(sb, sbuff_free);
     }
 
-    if (wtf & PacketReceived) {
-        outb(self->iomem, NoDma | Page1);
-        uint8_t rxpage = inb(CURPAGE);
-        outb(self->iomem, NoDma | Start);
-        uint8_t frame = inb(BOUNDRY) + 1;
-        if (frame == stop_page)
-            frame = rx_start_page;
-
-        while (rxpage != frame) {
-
-            // Read the four byte header
-            outb(self->iomem, NoDma | Start);
-            outb(REMBCOUNTLO, 4);
-            outb(REMBCOUNTHI, 0);
-            outb(REMSTARTADDRLO, 0);
-            outb(REMSTARTADDRHI, frame);
-            outb(self->iomem, RemoteRead | Start);
-
-            union {
-                struct {
-                    uint8_t status;
-                    uint8_t next;
-                    uint16_t count;
-                } header;
-                uint32_t val;
-            } hdr;
-
-            hdr.val = inl(self->iomem + 0x10);
-            uint16_t size = hdr.header.count - sizeof(hdr);
-
-            outb(self->iomem, NoDma | Start);
-            outb(REMSTARTADDRLO, 4);
-            outb(REMBCOUNTLO, size & 0xff);
-            outb(REMBCOUNTHI, hdr.header.count >> 8);
-
-            struct recv_data * mem = kmem_alloc(size + sizeof(struct recv_data));
-            mem->self = self;
-            uint8_t * buffer = mem->buffer;
-
-            // 16 bits at a time, up to a page (TODO handle larger reads)
-            for (uint16_t s = 0; s < size; s+=2) {
-               uint16_t d = inw(DATA);
-               buffer[s+1] = d >> 8;
-               buffer[s] = d & 0xff;
-            }
-            if (size & 1) {
-               uint8_t d = inb(DATA);
-               buffer[size - 1] = d;
+    if (nic->sending < 0) {
+        for (int b = 0; b < 2; b++) {
+            if (nic->staged[b]) {
+                start_transmit(nic, b);
+                break;
             }
+        }
+    }
+}
 
-            task_enqueue_easy(dispatch, mem);
+static void transmitted(ne2k * nic) {
+    if (nic->sending < 0) return;
 
-            frame = hdr.header.next;
-            outb(BOUNDRY, frame - 1);
-        }
+    int done = nic->sending;
+    nic->staged[done] = 0;
+    nic->sending = -1;
+
+    if (nic->staged[!done]) start_transmit(nic, !done);
+    pump(nic);
+}
 
-        outb(ISR, PacketReceived);
+static void ne2k_send(struct netdevice * dev, sbuff * sbuff) {
+    ne2k * nic = (ne2k*) dev;
+
+    disable_interrupts();
+    if (nic->queueCount == TxQueueLen) {
+        enable_interrupts();
+        add_ref(sbuff);
+        release_ref(sbuff, sbuff_free); // full, drop it
+        return;
     }
 
-    outb(self->iomem, Start|NoDma|Page0);
-    outb(ISR, 0xff); // clear ISR
+    add_ref(sbuff);
+    nic->queue[(nic->queueHead + nic->queueCount) % TxQueueLen] = sbuff;
+    nic->queueCount++;
+    pump(nic);
+    enable_interrupts();
 }
 
-struct PendingSend {
-    struct TaskT *task;
-    struct sbuff_t * data;
-    struct netdevice * dev;
-};
+// Next frame out of the receive ring, or NULL once it's empty. Remote DMA
+// is shared with transmit, so this runs with interrupts off.
+static uint8_t * read_frame(struct netdevice * self, uint16_t * len) {
+    outb(self->iomem, NoDma | Page1);
+    uint8_t rxpage = inb(CURPAGE);
+    outb(self->iomem, NoDma | Start);
+    uint8_t frame = inb(BOUNDRY) + 1;
+    if (frame == stop_page)
+        frame = rx_start_page;
 
-static void send_sync(void * user) {
-    struct PendingSend *send = (struct PendingSend*)user;
-    struct netdevice *self = send->dev;
-    uint16_t nextSize = send->data->currSize;
-    uint8_t* next = send->data->data;
+    if (rxpage == frame) return NULL;
 
-    // stage
-    outb(self->iomem, NoDma|Page0);
-    outb(IMR, 0); // disable interrupts
-    outb(REMBCOUNTLO, nextSize & 0xff);
-    outb(REMBCOUNTHI, nextSize >> 8);
+    // Read the four byte header
+    outb(REMBCOUNTLO, 4);
+    outb(REMBCOUNTHI, 0);
     outb(REMSTARTADDRLO, 0);
-    outb(REMSTARTADDRHI, tx_start_page);
-
-    //console_print_string("\nSend: ");
-    for(int i = 0; i < nextSize; i+=2) {
-        uint16_t lo = next[i];
-        uint16_t hi = next[i+1];
-        uint16_t data = lo | hi << 8;
-        //console_put_hex16(ntos(data));
-        //console_print_string(" ");
-        outw(DATA, data);
+    outb(REMSTARTADDRHI, frame);
+    outb(self->iomem, RemoteRead | Start);
+
+    union {
+        struct {
+            uint8_t status;
+            uint8_t next;
+            uint16_t count;
+        } header;
+        uint32_t val;
+    } hdr;
+
+    hdr.val = inl(self->iomem + 0x10);
+    uint16_t size = hdr.header.count - sizeof(hdr);
+
+    outb(self->iomem, NoDma | Start);
+    outb(REMSTARTADDRLO, 4);
+    outb(REMBCOUNTLO, size & 0xff);
+    outb(REMBCOUNTHI, size >> 8);
+    outb(self->iomem, RemoteRead | Start);
+
+    uint8_t * mem = kmem_alloc(size);
+
+    // the data port is 16 bits wide; the card's word order is
+    // already memory order, so straight into the buffer
+    insw(DATA, mem, size / 2);
+    if (size & 1) {
+       mem[size - 1] = inb(DATA);
     }
-    if (nextSize % 2) outb(DATA, next[nextSize - 1]);
 
-    outb(ISR, 0x40);
+    frame = hdr.header.next;
+    outb(BOUNDRY, frame == rx_start_page ? stop_page - 1 : frame - 1);
+    *len = size;
+    return mem;
+}
 
-    // trigger
-    outb(self->iomem, NoDma|Page0);
-    outb(TXCNTLO, nextSize & 0xff);
-    outb(TXCNTHI, nextSize >> 8);
-    outb(TSTART, tx_start_page);
-    outb(IMR, ImrAllIsr);
-    outb(self->iomem, NoDma|Transmit|Start);
+static int ne2k_poll(struct netdevice * self, int budget) {
+    int done = 0;
 
-    release_ref(send->data, sbuff_free);
+    disable_interrupts();
+    outb(ISR, PacketReceived); // anything arriving from now on sets it again
+    enable_interrupts();
+
+    while (done < budget) {
+        uint16_t len;
+        disable_interrupts();
+        uint8_t * frame = read_frame(self, &len);
+        enable_interrupts();
+        if (!frame) break;
+
+        netdev_receive(self, frame, len);
+        kmem_free(frame);
+        done++;
+    }
+
+    return done;
 }
 
-static void ne2k_send(struct netdevice * dev, sbuff * sbuff) {
-    struct PendingSend *send = kmem_alloc(sizeof(struct PendingSend));
-    send->task = task_alloc(send_sync, send);
-    send->data = sbuff;
-    add_ref(send->data);
-    send->dev = dev;
+static void ne2k_rx_unmask(struct netdevice * self) {
+    disable_interrupts();
+    outb(IMR, ImrAllIsr);
+    enable_interrupts();
+}
 
-    task_enqueue(send->task);
+static void ne2k_irq(registers_t* regs, void * ptr) {
+    ne2k * nic = (ne2k*) ptr;
+    struct netdevice* self = &nic->netdev;
+    uint8_t wtf = inb(ISR);
+
+    if (wtf & RemoteDmaComplete) {
+        outb(ISR, RemoteDmaComplete);
+    }
+
+    // leave PacketReceived set; the poll acknowledges it
+    if (wtf & PacketReceived) {
+        outb(IMR, ImrAllIsr & ~PacketReceived);
+        netdev_rx_schedule(self);
+    }
+
+    if (wtf & (PacketTransmitted | TxError)) {
+        outb(ISR, PacketTransmitted | TxError);
+        transmitted(nic);
+    }
+
+    outb(self->iomem, Start|NoDma|Page0);
+    outb(ISR, wtf & ~PacketReceived); // only what we've handled, a new one may be pending
 }
 
 static uint32_t myIp = 0xC0A80302;
 static uint32_t gateway = 0xC0A80301;
 
 static void initialize(uint8_t intr, uint32_t bar0) {
-    struct netdevice * self = kmem_alloc(sizeof(struct netdevice));
-    self = kmem_alloc(sizeof(struct netdevice));
+    ne2k * nic = kmem_alloc(sizeof(ne2k));
+    bzero(nic, sizeof(ne2k));
+    nic->sending = -1;
+
+    struct netdevice * self = &nic->netdev;
     self->send = ne2k_send;
-    self->ip = myIp;
+    init_netdev_poll(self, ne2k_poll, ne2k_rx_unmask);
 
     self->iomem = bar0 & ~3;
     console_print_string("Found ne2k on IRQ %d with MAC ", intr);
@@ -255,7 +334,7 @@ static void initialize(uint8_t intr, uint32_t bar0) {
         outb(self->iomem+8+i, 0xff);
     }
 
-    register_interrupt_handler(intr + 32, ne2k_irq, self);
+    register_interrupt_handler(intr + 32, ne2k_irq, nic);
 
     // Game On!
     outb(self->iomem, NoDma|Start|Page0);
@@ -265,8 +344,7 @@ static void initialize(uint8_t intr, uint32_t bar0) {
     outb(RCR, 0x1c);  // RCR: everything
     outb(TCR, 0x00);  // TCR - normal
 
-    gratuitous_arp(self);
-    arp_lookup(self, gateway, NULL);
+    ip_configure(self, myIp, 24, gateway);
 }
 
 void init_ne2k() {
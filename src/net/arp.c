@@ -3,6 +3,8 @@
 #include "net/sbuff.h"
 #include "net/ntox.h"
 #include "net/ethernet.h"
+#include "timer.h"
+#include "errno.h"
 
 static const mac BROADCAST_MAC = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
 
@@ -60,54 +62,231 @@ static void arp_request(struct netdevice * device, uint32_t targetIp) {
 
 void gratuitous_arp(struct netdevice * device) {
     static mac zeros = {0,0,0,0,0,0};
+    if (device->flags & NetdevNoArp) return;
     reply(device, zeros, device->ip, 1);
 }
 
-struct arp_table {
-    uint32_t ips[128];
-    mac macs[128];
-    uint16_t count;
-};
+#define ArpSlots 128
+#define ArpBuckets 64
+#define ArpMaxPending 4
+#define ArpMaxTries 3
+#define ArpRetryMs 1000
+#define ArpReachableMs 60000 // after this we still use it, but ask again
+#define ArpExpireMs 120000  // and after this it's forgotten
 
-extern int printf(const char*, ...);
-static struct arp_table table;
-int arp_lookup(struct netdevice* dev, uint32_t ip, mac dest) {
-    for (int e = 0; e < table.count; e++) {
-        if (table.ips[e] == ip) {
-            memcpy(dest, table.macs[e], 6);
-            return 1;
+enum ArpState { Free, Incomplete, Reachable };
+
+typedef struct {
+    uint32_t ip;
+    mac mac;
+    uint8_t state;
+    uint8_t tries;
+    uint8_t nPending;
+    uint16_t next;          // slot + 1 of the next in the bucket
+    uint64_t confirmed;
+    uint64_t requested;
+    struct netdevice * dev;
+    sbuff * pending[ArpMaxPending];
+} neighbour;
+
+static neighbour slots[ArpSlots];
+static uint16_t buckets[ArpBuckets];
+static uint32_t unresolved;
+static timer retry_timer;
+
+static inline uint64_t ms_ticks(uint32_t ms) {
+    return (uint64_t)ms * TIMER_HZ / 1000;
+}
+
+static uint32_t bucket_for(uint32_t ip) {
+    return (ip * 2654435761u) >> 26;
+}
+
+static neighbour * find(uint32_t ip) {
+    for (uint16_t n = buckets[bucket_for(ip)]; n; n = slots[n - 1].next) {
+        if (slots[n - 1].ip == ip) return &slots[n - 1];
+    }
+    return NULL;
+}
+
+static void drop_pending(neighbour * n) {
+    for (int i = 0; i < n->nPending; i++) {
+        release_ref(n->pending[i], sbuff_free);
+    }
+    n->nPending = 0;
+}
+
+static void set_state(neighbour * n, uint8_t state) {
+    if (n->state == Incomplete) unresolved--;
+    if (state == Incomplete) unresolved++;
+    n->state = state;
+}
+
+static void forget(neighbour * n) {
+    uint16_t * p = &buckets[bucket_for(n->ip)];
+    uint16_t me = n - slots + 1;
+    while (*p != me) p = &slots[*p - 1].next;
+    *p = n->next;
+
+    drop_pending(n);
+    set_state(n, Free);
+}
+
+// a free slot, or failing that the one heard from longest ago
+static neighbour * alloc(uint32_t ip) {
+    neighbour * victim = NULL;
+    for (int i = 0; i < ArpSlots; i++) {
+        neighbour * n = &slots[i];
+        if (n->state == Free) {
+            victim = n;
+            break;
+        }
+        if (!victim || n->confirmed < victim->confirmed) victim = n;
+    }
+
+    if (victim->state != Free) forget(victim);
+
+    bzero(victim, sizeof(*victim));
+    victim->ip = ip;
+    uint16_t * bucket = &buckets[bucket_for(ip)];
+    victim->next = *bucket;
+    *bucket = victim - slots + 1;
+    return victim;
+}
+
+static void retry(void * unused);
+
+// ask, at most once per ArpRetryMs for any one address
+static void solicit(neighbour * n) {
+    uint64_t now = timer_ticks();
+    if (n->tries && now - n->requested < ms_ticks(ArpRetryMs)) return;
+
+    n->requested = now;
+    n->tries++;
+    arp_request(n->dev, n->ip);
+
+    if (n->state == Incomplete && !retry_timer.pending) {
+        timer_start(&retry_timer, ArpRetryMs, retry, NULL);
+    }
+}
+
+static void retry(void * unused) {
+    for (int i = 0; i < ArpSlots && unresolved; i++) {
+        neighbour * n = &slots[i];
+        if (n->state != Incomplete) continue;
+
+        if (n->tries >= ArpMaxTries) forget(n);
+        else solicit(n);
+    }
+
+    if (unresolved) timer_start(&retry_timer, ArpRetryMs, retry, NULL);
+}
+
+// returns the entry if its mac can be used
+static neighbour * resolve(struct netdevice * dev, uint32_t ip) {
+    neighbour * n = find(ip);
+    uint64_t now = timer_ticks();
+
+    if (n && n->state == Reachable) {
+        uint64_t age = now - n->confirmed;
+        if (age < ms_ticks(ArpReachableMs)) return n;
+
+        n->dev = dev;
+        if (age < ms_ticks(ArpExpireMs)) {
+            solicit(n);
+            return n;
         }
+
+        set_state(n, Incomplete);
+        n->tries = 0;
+    }
+
+    if (!n) {
+        n = alloc(ip);
+        set_state(n, Incomplete);
+    }
+
+    n->dev = dev;
+    solicit(n);
+    return NULL;
+}
+
+int arp_lookup(struct netdevice* dev, uint32_t ip, mac dest) {
+    if (dev->flags & NetdevNoArp) {
+        if (dest) memcpy(dest, dev->mac, 6);
+        return 1;
     }
 
-    arp_request(dev, ip);
-    return 0;
+    neighbour * n = resolve(dev, ip);
+    if (!n) return 0;
+
+    if (dest) memcpy(dest, n->mac, 6);
+    return 1;
+}
+
+int arp_send(struct sbuff_t * sbuff, uint32_t ip, struct netdevice * dev) {
+    if (dev->flags & NetdevNoArp) {
+        ethernet_send(sbuff, 0x0800u, dev->mac, dev);
+        return EOK;
+    }
+
+    neighbour * n = resolve(dev, ip);
+    if (n) {
+        ethernet_send(sbuff, 0x0800u, n->mac, dev);
+        return EOK;
+    }
+
+    // hold on to it until the reply arrives; the oldest goes if too many
+    n = find(ip);
+    if (n->nPending == ArpMaxPending) {
+        release_ref(n->pending[0], sbuff_free);
+        n->nPending--;
+        for (int i = 0; i < n->nPending; i++) n->pending[i] = n->pending[i + 1];
+    }
+    add_ref(sbuff);
+    n->pending[n->nPending++] = sbuff;
+    return EOK;
 }
 
 void arp_store(mac dest, uint32_t ip) {
-    table.ips[table.count] = ip;
-    memcpy(table.macs[table.count], dest, 6);
+    neighbour * n = find(ip);
+    if (!n) n = alloc(ip);
 
-    table.count++;
+    memcpy(n->mac, dest, 6);
+    set_state(n, Reachable);
+    n->confirmed = timer_ticks();
+    n->tries = 0;
 
-    //TODO overflow of table
+    for (int i = 0; i < n->nPending; i++) {
+        ethernet_send(n->pending[i], 0x0800u, n->mac, n->dev);
+        release_ref(n->pending[i], sbuff_free);
+    }
+    n->nPending = 0;
 }
 
 void arp_packet(struct netdevice* dev, const uint8_t * data) {
     struct arp_packet * arp = (struct arp_packet*) data;
 
+    uint32_t sender = ntol(arp->senderIp);
+
+    // RFC 826: refresh anyone we already know about, learn those asking us
+    int known = find(sender) != NULL;
+    if (known) arp_store(arp->senderMac, sender);
+
     if (ntol(arp->targetIp) != dev-> ip) return;
 
+    if (!known) arp_store(arp->senderMac, sender);
+
     int request = ntos(arp->operation) == 1;
     if (request) {
-        // store(arp->senderMac, ntol(arp->senderIp));
-        reply(dev, arp->senderMac, ntol(arp->senderIp), 0);
-    }
-    else {
-        arp_store(arp->senderMac, ntol(arp->senderIp));
+        reply(dev, arp->senderMac, sender, 0);
     }
 }
 
 void init_arp() {
-    table.count = 0;
+    for (int i = 0; i < ArpSlots; i++) {
+        if (slots[i].state != Free) forget(&slots[i]);
+    }
+    timer_stop(&retry_timer);
 }
 
@@ -10,4 +10,10 @@ void gratuitous_arp(struct netdevice* device);
 void arp_packet(struct netdevice* dev, const uint8_t* data);
 void arp_store(mac dest, uint32_t ip);
 
+// Fills in `dest` (which may be NULL) and returns 1 if `ip` is known,
+// otherwise asks for it and returns 0.
 int arp_lookup(struct netdevice * dev, uint32_t ip, mac dest);
+
+// Send an IP packet to `ip` on the local link, holding it until the
+// address is resolved if need be.
+int arp_send(struct sbuff_t * sbuff, uint32_t ip, struct netdevice * dev);
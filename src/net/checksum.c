@@ -0,0 +1,74 @@
+#include "net/checksum.h"
+
+typedef uint16_t __attribute__((aligned(1), may_alias)) u16_unaligned;
+typedef uint32_t __attribute__((aligned(1), may_alias)) u32_unaligned;
+
+// 32 bit words into a 64 bit accumulator: the carries pile up in the top
+// half and get folded back once at the end.
+static inline uint32_t fold64(uint64_t sum) {
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    return sum;
+}
+
+uint32_t csum_partial(const void * buf, uint32_t len, uint32_t sum) {
+    const uint8_t * p = (const uint8_t*) buf;
+    uint64_t acc = sum;
+
+    for (; len >= 16; len -= 16, p += 16) {
+        const u32_unaligned * w = (const u32_unaligned*) p;
+        acc += w[0];
+        acc += w[1];
+        acc += w[2];
+        acc += w[3];
+    }
+    for (; len >= 4; len -= 4, p += 4) {
+        acc += *(const u32_unaligned*) p;
+    }
+    if (len >= 2) {
+        acc += *(const u16_unaligned*) p;
+        len -= 2;
+        p += 2;
+    }
+    if (len) {
+        acc += *p; // padded with a zero byte, little endian
+    }
+
+    return fold64(acc);
+}
+
+uint32_t csum_copy(void * dest, const void * src, uint32_t len, uint32_t sum) {
+    const uint8_t * s = (const uint8_t*) src;
+    uint8_t * d = (uint8_t*) dest;
+    uint64_t acc = sum;
+
+    for (; len >= 16; len -= 16, s += 16, d += 16) {
+        const u32_unaligned * from = (const u32_unaligned*) s;
+        u32_unaligned * to = (u32_unaligned*) d;
+        uint32_t a = from[0], b = from[1], c = from[2], e = from[3];
+        to[0] = a; to[1] = b; to[2] = c; to[3] = e;
+        acc += a;
+        acc += b;
+        acc += c;
+        acc += e;
+    }
+    for (; len >= 4; len -= 4, s += 4, d += 4) {
+        uint32_t w = *(const u32_unaligned*) s;
+        *(u32_unaligned*) d = w;
+        acc += w;
+    }
+    if (len >= 2) {
+        uint16_t w = *(const u16_unaligned*) s;
+        *(u16_unaligned*) d = w;
+        acc += w;
+        len -= 2;
+        s += 2;
+        d += 2;
+    }
+    if (len) {
+        *d = *s;
+        acc += *s;
+    }
+
+    return fold64(acc);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "common.h"
+#include "net/ntox.h"
+
+// Internet checksum (RFC 1071) helpers.
+//
+// Partial sums are 32 bit ones-complement accumulators over the data as it
+// sits in memory, so they can be stored straight into a header once folded.
+// Partials can only be combined when the second block starts at an even
+// offset.
+
+uint32_t csum_partial(const void * buf, uint32_t len, uint32_t sum);
+
+// memcpy that sums what it copies on the way through
+uint32_t csum_copy(void * dest, const void * src, uint32_t len, uint32_t sum);
+
+static inline uint32_t csum_add(uint32_t a, uint32_t b) {
+    a += b;
+    return a + (a < b);
+}
+
+static inline uint16_t csum_fold(uint32_t sum) {
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum;
+}
+
+// TCP/UDP pseudo header, addresses in host order
+static inline uint32_t csum_pseudo(uint32_t src, uint32_t dest, uint8_t proto, uint16_t len) {
+    uint32_t sum = csum_add(ntol(src), ntol(dest));
+    return csum_add(sum, ntos(proto) + ntos(len));
+}
+
+// RFC 1624: patch a checksum after a 16 bit field changes from `from` to
+// `to`, without summing the rest again. All values as stored in the packet.
+static inline void csum_replace2(uint16_t * check, uint16_t from, uint16_t to) {
+    uint32_t sum = (uint16_t)~*check;
+    sum = csum_add(sum, (uint16_t)~from);
+    sum = csum_add(sum, to);
+    *check = csum_fold(sum);
+}
+
+static inline void csum_replace4(uint16_t * check, uint32_t from, uint32_t to) {
+    csum_replace2(check, from >> 16, to >> 16);
+    csum_replace2(check, from, to);
+}
@@ -0,0 +1,97 @@
+#include "net/device.h"
+#include "net/sbuff.h"
+#include "net/gso.h"
+#include "net/gro.h"
+#include "net/pcap.h"
+#include "net/ethernet.h"
+#include "task.h"
+#include "memory.h"
+
+static void run_poll(void * user) {
+    struct netdevice * dev = (struct netdevice*) user;
+
+    int done = dev->poll(dev, NetdevPollBudget);
+    gro_flush();
+
+    if (done < NetdevPollBudget) {
+        dev->rx_unmask(dev);
+    }
+    else {
+        // still more in the ring; go to the back of the queue
+        task_enqueue(dev->pollTask);
+    }
+}
+
+void init_netdev_poll(struct netdevice * dev,
+        int (*poll)(struct netdevice *, int), void (*rx_unmask)(struct netdevice *)) {
+    dev->poll = poll;
+    dev->rx_unmask = rx_unmask;
+    if (!dev->pollTask) {
+        dev->pollTask = task_alloc(run_poll, dev);
+        add_ref(dev->pollTask); // lives as long as the device
+    }
+}
+
+void netdev_rx_schedule(struct netdevice * dev) {
+    task_enqueue(dev->pollTask);
+}
+
+void netdev_receive(struct netdevice * dev, const uint8_t * frame, uint16_t len) {
+    pcap_capture(frame, len);
+    if (!gro_receive(dev, frame, len)) ethernet_packet(dev, frame);
+}
+
+static void prepare(struct netdevice * dev, sbuff * sb) {
+    if (sb->csumStart && !(dev->features & NetdevTxCsum)) sbuff_csum_complete(sb);
+}
+
+static int needs_gso(struct netdevice * dev, sbuff * sb) {
+    return sb->gsoSize && !(dev->features & NetdevTso);
+}
+
+static void send_all(struct netdevice * dev, sbuff ** sbuffs, uint16_t count) {
+    if (!count) return;
+
+    for (uint16_t i = 0; i < count; i++) {
+        pcap_capture(sbuffs[i]->head, sbuffs[i]->currSize);
+    }
+
+    // optional, otherwise one at a time
+    if (dev->send_batch) {
+        dev->send_batch(dev, sbuffs, count);
+        return;
+    }
+
+    for (uint16_t i = 0; i < count; i++) {
+        dev->send(dev, sbuffs[i]);
+    }
+}
+
+// the device can't take a super-segment, so cut it up here
+static void xmit_gso(struct netdevice * dev, sbuff * sb) {
+    sbuff * segs[GsoMaxSegments];
+
+    add_ref(sb);
+    int n = gso_segment(sb, segs, GsoMaxSegments, dev->features & NetdevTxCsum);
+    release_ref(sb, sbuff_free);
+
+    send_all(dev, segs, n);
+}
+
+void netdev_xmit(struct netdevice * dev, sbuff * sb) {
+    netdev_xmit_batch(dev, &sb, 1);
+}
+
+void netdev_xmit_batch(struct netdevice * dev, sbuff ** sbuffs, uint16_t count) {
+    uint16_t first = 0;
+    for (uint16_t i = 0; i <= count; i++) {
+        if (i < count && !needs_gso(dev, sbuffs[i])) {
+            prepare(dev, sbuffs[i]);
+            continue;
+        }
+
+        send_all(dev, sbuffs + first, i - first);
+        if (i < count) xmit_gso(dev, sbuffs[i]);
+        first = i + 1;
+    }
+}
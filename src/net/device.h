@@ -7,9 +7,60 @@ typedef char mac[6];
 struct TaskT;
 struct sbuff_t;
 
+#define NetdevDefaultMtu 1500
+
+// what a device can take off the stack's hands
+enum NetdevFeatures {
+    NetdevTxCsum = 1,   // fills in checksums left owed on an sbuff
+    NetdevTso = 2,      // cuts TCP super-segments itself (needs NetdevTxCsum)
+};
+
+enum NetdevFlags {
+    NetdevNoArp = 1,    // no link layer neighbours to resolve
+};
+
 struct netdevice {
     void (*send)(struct netdevice * self, struct sbuff_t * sbuff);
+    // optional: several frames in one go, otherwise send is called for each
+    void (*send_batch)(struct netdevice * self, struct sbuff_t ** sbuffs, uint16_t count);
     uint32_t ip;
     mac mac;
     uint16_t iomem;
+    uint16_t mtu;       // 0 for the ethernet default
+    uint32_t features;  // NetdevFeatures
+    uint8_t flags;      // NetdevFlags
+    uint8_t ifindex;    // slot in the ip interface table + 1, 0 if none
+
+    // optional polled receive, see netdev_rx_schedule
+    int (*poll)(struct netdevice * self, int budget);
+    void (*rx_unmask)(struct netdevice * self);
+    struct TaskT * pollTask;
 };
+
+// frames a driver hands up per poll before others get a turn
+#define NetdevPollBudget 16
+
+// Sets up polled receive. The driver's irq masks its receive interrupt and
+// calls netdev_rx_schedule; `poll` then runs as a task and passes up to
+// `budget` frames to ethernet_packet, returning how many. Until it comes
+// back short the task keeps rescheduling itself, after which `rx_unmask`
+// turns the interrupt back on.
+void init_netdev_poll(struct netdevice * dev,
+        int (*poll)(struct netdevice *, int), void (*rx_unmask)(struct netdevice *));
+
+// safe from an interrupt handler; does nothing if a poll is already due,
+// even while it's still waiting behind other tasks
+void netdev_rx_schedule(struct netdevice * dev);
+
+// A poll hands each frame up through here. TCP segments may be held to be
+// merged with the ones after (see gro.h) until the poll is over, so the
+// frame is copied if it's kept.
+void netdev_receive(struct netdevice * dev, const uint8_t * frame, uint16_t len);
+
+static inline uint16_t netdev_mtu(const struct netdevice * dev) {
+    return dev->mtu ? dev->mtu : NetdevDefaultMtu;
+}
+
+// Hand frames to the device, first doing in software whatever it can't.
+void netdev_xmit(struct netdevice * dev, struct sbuff_t * sbuff);
+void netdev_xmit_batch(struct netdevice * dev, struct sbuff_t ** sbuffs, uint16_t count);
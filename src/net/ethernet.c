@@ -20,14 +20,25 @@ inline static void assign(mac dest, const mac src) {
     memcpy(dest, src, 6);
 }
 
-void ethernet_send(sbuff* sbuff, uint16_t proto, const mac dest, struct netdevice* device) {
+static void add_header(sbuff* sbuff, uint16_t proto, const mac dest, struct netdevice* device) {
     sbuff_pop(sbuff, sizeof(struct ethernet_frame));
     struct ethernet_frame* frame = (struct ethernet_frame*) sbuff->head;
     assign(frame->destination, dest);
     assign(frame->source, device->mac);
     frame->sizeOrType = ntos(proto);
+}
+
+void ethernet_send(sbuff* sbuff, uint16_t proto, const mac dest, struct netdevice* device) {
+    add_header(sbuff, proto, dest, device);
+    netdev_xmit(device, sbuff);
+}
+
+void ethernet_send_batch(sbuff** sbuffs, uint16_t count, uint16_t proto, const mac dest, struct netdevice* device) {
+    for (uint16_t i = 0; i < count; i++) {
+        add_header(sbuffs[i], proto, dest, device);
+    }
 
-    device->send(device, sbuff);
+    netdev_xmit_batch(device, sbuffs, count);
 }
 
 sbuff * ethernet_sbuff_alloc(uint16_t size) {
@@ -13,4 +13,5 @@ struct ethernet_frame {
 
 void ethernet_packet(struct netdevice * device, const uint8_t *packet);
 void ethernet_send(sbuff* sbuff, uint16_t proto, const mac dest, struct netdevice* device);
+void ethernet_send_batch(sbuff** sbuffs, uint16_t count, uint16_t proto, const mac dest, struct netdevice* device);
 sbuff * ethernet_sbuff_alloc(uint16_t size);
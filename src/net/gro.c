@@ -0,0 +1,133 @@
+#include "net/gro.h"
+#include "net/ethernet.h"
+#include "net/device.h"
+#include "net/ip.h"
+#include "net/tcp.h"
+#include "memory.h"
+
+typedef struct gro_flow_t {
+    struct netdevice * dev;     // NULL when the slot is free
+    uint8_t * buf;              // ip header, tcp header, payload so far
+    uint16_t len;
+    uint32_t nextSeq;
+} gro_flow;
+
+static gro_flow flows[GroFlows];
+
+static inline struct ipv4_header * ip_of(const gro_flow * f) {
+    return (struct ipv4_header*) f->buf;
+}
+
+static inline tcp_hdr * tcp_of(const gro_flow * f) {
+    return (tcp_hdr*)(f->buf + sizeof(struct ipv4_header));
+}
+
+static void flush(gro_flow * f) {
+    struct ipv4_header * ip = ip_of(f);
+    ip->total_len = ntos(f->len);
+    ip->checksum = 0;
+    ip->checksum = csum_fold(csum_partial(ip, sizeof(*ip), 0));
+    // the tcp checksum covers only the first segment now; nothing checks it
+
+    struct netdevice * dev = f->dev;
+    uint8_t * buf = f->buf;
+    f->dev = NULL;
+    f->buf = NULL;
+
+    ip_packet(dev, buf);
+    kmem_free(buf);
+}
+
+static gro_flow * find(struct netdevice * dev, const struct ipv4_header * ip, const tcp_hdr * tcp) {
+    for (int i = 0; i < GroFlows; i++) {
+        gro_flow * f = &flows[i];
+        if (f->dev != dev) continue;
+
+        const struct ipv4_header * held = ip_of(f);
+        const tcp_hdr * heldTcp = tcp_of(f);
+        if (held->src == ip->src && held->dest == ip->dest &&
+                heldTcp->srcPort == tcp->srcPort && heldTcp->destPort == tcp->destPort) {
+            return f;
+        }
+    }
+
+    return NULL;
+}
+
+// same ack and options, and carries on where the held data stops
+static int follows(const gro_flow * f, const tcp_hdr * tcp, uint16_t tcpLen, uint16_t payload) {
+    const tcp_hdr * held = tcp_of(f);
+    return ntol(tcp->sequence) == f->nextSeq &&
+        held->offset * 4 == tcpLen &&
+        held->ack == tcp->ack &&
+        !memcmp(held->options, tcp->options, tcpLen - sizeof(tcp_hdr)) &&
+        f->len + payload <= GroMaxSize;
+}
+
+int gro_receive(struct netdevice * dev, const uint8_t * frame, uint16_t len) {
+    const struct ethernet_frame * eth = (const struct ethernet_frame*) frame;
+    if (eth->sizeOrType != ntos(0x0800)) return 0;
+
+    const struct ipv4_header * ip = (const struct ipv4_header*)(frame + sizeof(struct ethernet_frame));
+    if (ip->ihl != 5 || ip->proto != IPPROTO_TCP) return 0;
+    if (ntos(ip->fragment) & (IpMoreFragments | IpOffsetMask)) return 0;
+
+    uint16_t total = ntos(ip->total_len);
+    const tcp_hdr * tcp = (const tcp_hdr*)(ip + 1);
+    uint16_t tcpLen = tcp->offset * 4;
+    if (total + sizeof(struct ethernet_frame) > len || sizeof(*ip) + tcpLen > total) return 0;
+    uint16_t payload = total - sizeof(*ip) - tcpLen;
+
+    gro_flow * f = find(dev, ip, tcp);
+
+    // only plain data segments merge; anything else has to come after
+    // whatever is held for its flow
+    if (!payload || (tcp->flags & ~TcpPsh) != TcpAck) {
+        if (f) flush(f);
+        return 0;
+    }
+
+    if (f && !follows(f, tcp, tcpLen, payload)) {
+        flush(f);
+        f = NULL;
+    }
+
+    if (f) {
+        memcpy(f->buf + f->len, (const uint8_t*)tcp + tcpLen, payload);
+        f->len += payload;
+        f->nextSeq += payload;
+
+        tcp_hdr * held = tcp_of(f);
+        held->window = tcp->window;
+        if (tcp->flags & TcpPsh) {
+            held->flags |= TcpPsh;
+            flush(f);
+        }
+        return 1;
+    }
+
+    // a push with nothing to join goes straight up, without the copy,
+    // as does anything too big to start a flow with
+    if ((tcp->flags & TcpPsh) || total > GroMaxSize) return 0;
+
+    for (int i = 0; i < GroFlows && !f; i++) {
+        if (!flows[i].dev) f = &flows[i];
+    }
+    if (!f) {
+        f = &flows[0];
+        flush(f);
+    }
+
+    f->dev = dev;
+    f->buf = kmem_alloc(GroMaxSize);
+    f->len = total;
+    f->nextSeq = ntol(tcp->sequence) + payload;
+    memcpy(f->buf, ip, total);
+    return 1;
+}
+
+void gro_flush() {
+    for (int i = 0; i < GroFlows; i++) {
+        if (flows[i].dev) flush(&flows[i]);
+    }
+}
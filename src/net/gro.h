@@ -0,0 +1,16 @@
+#pragma once
+
+#include "common.h"
+
+struct netdevice;
+
+// Consecutive in-order TCP segments of a flow are held and merged, so the
+// stack sees one big segment instead of several. Nothing is held past
+// gro_flush, which the receive poll calls when it's done.
+#define GroMaxSize 7680     // five full frames, in one small allocation
+#define GroFlows 4
+
+// Returns 1 if the frame was taken, otherwise it's the caller's to deliver.
+int gro_receive(struct netdevice * dev, const uint8_t * frame, uint16_t len);
+
+void gro_flush();
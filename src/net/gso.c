@@ -0,0 +1,52 @@
+#include "net/gso.h"
+#include "net/ethernet.h"
+#include "net/ip.h"
+#include "net/tcp.h"
+#include "net/sbuff.h"
+
+int gso_segment(sbuff * sb, sbuff ** out, int max, int csumOffload) {
+    uint8_t * frame = sb->head;
+    struct ipv4_header * ip = (struct ipv4_header*)(frame + sizeof(struct ethernet_frame));
+    uint16_t ipLen = ip->ihl * 4;
+    tcp_hdr * tcp = (tcp_hdr*)((uint8_t*)ip + ipLen);
+    uint16_t tcpLen = tcp->offset * 4;
+    uint16_t hdrLen = sizeof(struct ethernet_frame) + ipLen + tcpLen;
+    uint16_t payload = sb->currSize - hdrLen;
+    uint32_t seq = ntol(tcp->sequence);
+    uint32_t src = ntol(ip->src), dest = ntol(ip->dest);
+
+    int n = 0;
+    for (uint16_t off = 0; off < payload && n < max; off += sb->gsoSize) {
+        uint16_t sz = payload - off < sb->gsoSize ? payload - off : sb->gsoSize;
+        sbuff * seg = raw_sbuff_alloc(hdrLen + sz);
+        memcpy(seg->head, frame, hdrLen);
+
+        // only the length changes in the IP header
+        struct ipv4_header * sip = (struct ipv4_header*)(seg->head + sizeof(struct ethernet_frame));
+        uint16_t len = ntos(ipLen + tcpLen + sz);
+        uint16_t check = sip->checksum;
+        csum_replace2(&check, sip->total_len, len);
+        sip->checksum = check;
+        sip->total_len = len;
+
+        tcp_hdr * st = (tcp_hdr*)((uint8_t*)sip + ipLen);
+        st->sequence = ntol(seq + off);
+        if (off + sz < payload) st->flags &= ~(TcpFin | TcpPsh); // last piece only
+
+        uint32_t sum = csum_pseudo(src, dest, IPPROTO_TCP, tcpLen + sz);
+        if (csumOffload) {
+            memcpy(seg->head + hdrLen, frame + hdrLen + off, sz);
+            st->chksum = ~csum_fold(sum);
+            sbuff_csum_partial(seg, st, &st->chksum);
+        }
+        else {
+            sum = csum_copy(seg->head + hdrLen, frame + hdrLen + off, sz, sum);
+            st->chksum = 0;
+            st->chksum = csum_fold(csum_partial(st, tcpLen, sum));
+        }
+
+        out[n++] = seg;
+    }
+
+    return n;
+}
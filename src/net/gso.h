@@ -0,0 +1,16 @@
+#pragma once
+
+#include "common.h"
+
+struct sbuff_t;
+
+// TCP hands the device super-segments of up to this much, cut to the
+// segment size by the card if it can, or by gso_segment otherwise.
+#define GsoMaxSize 24576
+#define GsoMaxSegments 64
+
+// Cuts an ethernet/IPv4/TCP super-segment into frames carrying at most
+// gsoSize bytes each, their headers copied from it. Checksums are left
+// owed when `csumOffload`, otherwise filled in. Returns how many went
+// into `out`, at most `max`; the original is untouched.
+int gso_segment(struct sbuff_t * sb, struct sbuff_t ** out, int max, int csumOffload);
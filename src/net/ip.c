@@ -6,30 +6,18 @@
 #include "net/udp.h"
 #include "net/tcp.h"
 #include "net/sbuff.h"
-
-#include "util/map.h"
+#include "net/route.h"
+#include "net/ipfrag.h"
+#include "memory.h"
 
 #include "errno.h"
 
 #include "console.h"
 
-struct ipv4_header {
-    uint8_t ihl : 4;
-    uint8_t version : 4;
-    uint8_t ecn : 2;
-    uint8_t dscp : 6;
-    uint16_t total_len;
-    uint16_t id;
-    uint16_t fragmentOffset : 13;
-    uint16_t flags : 3;
-    uint8_t ttl;
-    uint8_t proto;
-    uint16_t checksum;
-    uint32_t src;
-    uint32_t dest;
-} __attribute__ ((packed));
-
-static struct map_t ip_devices;
+#define MaxInterfaces 8
+
+// devices remember their slot, so device -> interface needs no lookup
+static struct netdevice * interfaces[MaxInterfaces];
 
 static void console_put_ip(uint32_t ip) {
     console_print_string("%d.%d.%d.%d",
@@ -69,19 +57,19 @@ void icmp_segment(uint32_t sender, struct netdevice* dev, const uint8_t* data, u
         sbuff* buf = ip_sbuff_alloc(len);
         add_ref(buf);
         icmp_header * pong = (icmp_header*) buf->head;
-        bzero(pong, sizeof(icmp_header));
+        memcpy(pong, icmp, len);
+
+        // only the type changes, so patch the checksum rather than redo it
+        uint16_t request = *(uint16_t*)pong;
         pong->type = pong->code = 0;
-        pong->id = icmp->id;
-        pong->sequence = icmp->sequence;
-        pong->checksum = 0;
-        checksum(pong, len, &pong->checksum);
-        memcpy(pong->payload, icmp->payload, len - sizeof(icmp_header));
+        csum_replace2(&pong->checksum, request, *(uint16_t*)pong);
         ip_send(buf, 1, sender, dev);
         release_ref(buf, sbuff_free);
     }
 }
 
-int ip_send(sbuff* sbuff, uint8_t proto, uint32_t dest, struct netdevice* device) {
+static void fill_header(sbuff * sbuff, uint8_t proto, uint32_t src, uint32_t dest,
+        uint16_t id, uint16_t fragment) {
     sbuff_pop(sbuff, sizeof(struct ipv4_header));
     uint16_t len = sbuff->currSize;
     struct ipv4_header *hdr = (struct ipv4_header*)sbuff->head;
@@ -89,63 +77,190 @@ int ip_send(sbuff* sbuff, uint8_t proto, uint32_t dest, struct netdevice* device
     hdr->version = 4;
     hdr->dscp = hdr->ecn = 0;
     hdr->total_len = ntos(len);
-    hdr->id = 0;
-    hdr->flags = 0;
-    hdr->fragmentOffset = 0;
+    hdr->id = ntos(id);
+    hdr->fragment = ntos(fragment);
     hdr->ttl = 64;
     hdr->proto = proto;
     hdr->checksum = 0;
-    hdr->src = ntol(device->ip);
+    hdr->src = ntol(src);
     hdr->dest = ntol(dest);
-    checksum(hdr, sizeof(*hdr), &hdr->checksum);
+    hdr->checksum = csum_fold(csum_partial(hdr, sizeof(*hdr), 0));
+}
+
+// Too big for the link: send it as a train of fragments, each carrying a
+// multiple of 8 bytes except the last.
+static int fragment(sbuff * whole, uint8_t proto, uint32_t src, uint32_t dest,
+        uint32_t nextHop, struct netdevice * out, uint16_t mtu) {
+    static uint16_t next_id;
+    uint16_t id = ++next_id;
+    uint16_t step = (mtu - sizeof(struct ipv4_header)) & ~7;
+    uint16_t len = whole->currSize;
+    int rc = EOK;
 
-    static mac destMac;
-    if (arp_lookup(device, dest, destMac)) {
-        ethernet_send(sbuff, 0x0800u, destMac, device);
-        return EOK;
+    add_ref(whole);
+    sbuff_csum_complete(whole); // the pieces can't carry it
+    for (uint16_t offset = 0; offset < len && rc == EOK; offset += step) {
+        uint16_t sz = len - offset < step ? len - offset : step;
+        sbuff * piece = ip_sbuff_alloc(sz);
+        memcpy(piece->head, whole->head + offset, sz);
+
+        uint16_t more = offset + sz < len ? IpMoreFragments : 0;
+        fill_header(piece, proto, src, dest, id, more | offset / 8);
+        rc = arp_send(piece, nextHop, out);
     }
+    release_ref(whole, sbuff_free);
 
-    return ENOTFOUND;
+    return rc;
 }
 
-void ip_packet(struct netdevice* dev, const uint8_t* data) {
-    struct ipv4_header* ip = (struct ipv4_header*) data;
+int ip_send(sbuff* sbuff, uint8_t proto, uint32_t dest, struct netdevice* device) {
+    // the route picks the way out; without one, assume `device`'s link
+    uint32_t nextHop = dest;
+    const route * r = route_lookup(dest, &nextHop);
+    struct netdevice * out = r ? r->dev : device;
+    if (!out) return ENOTFOUND;
+    uint32_t src = out->ip;     // replies come back the way it goes
+
+    // a super-segment is cut up at the device, not here
+    uint16_t mtu = netdev_mtu(out);
+    if (!sbuff->gsoSize && sbuff->currSize + sizeof(struct ipv4_header) > mtu) {
+        return fragment(sbuff, proto, src, dest, nextHop, out, mtu);
+    }
+
+    fill_header(sbuff, proto, src, dest, 0, 0);
+    return arp_send(sbuff, nextHop, out);
+}
+
+int ip_send_batch(sbuff** sbuffs, uint16_t count, uint8_t proto, uint32_t dest, struct netdevice* device) {
+    uint32_t nextHop = dest;
+    const route * r = route_lookup(dest, &nextHop);
+    struct netdevice * out = r ? r->dev : device;
+    if (!out) return ENOTFOUND;
+    uint32_t src = out->ip;
+    int rc = EOK;
+
+    uint16_t mtu = netdev_mtu(out);
+    mac destMac;
+    int resolved = arp_lookup(out, nextHop, destMac);
+
+    // consecutive packets that fit go down together, in order
+    uint16_t first = 0;
+    for (uint16_t i = 0; i <= count; i++) {
+        int big = i < count && !sbuffs[i]->gsoSize &&
+                sbuffs[i]->currSize + sizeof(struct ipv4_header) > mtu;
+        if (i < count && !big && resolved) {
+            fill_header(sbuffs[i], proto, src, dest, 0, 0);
+            continue;
+        }
 
-    // move me to ip_init when there is an ip_init
-    if (ip_devices.data == NULL) {
-        map_init(&ip_devices, map_int_hash);
+        if (i > first) ethernet_send_batch(sbuffs + first, i - first, 0x0800u, destMac, out);
+        first = i + 1;
+        if (i == count) break;
+
+        // the rest still go, but the first failure is what's reported
+        int err;
+        if (big) {
+            err = fragment(sbuffs[i], proto, src, dest, nextHop, out, mtu);
+        }
+        else {
+            fill_header(sbuffs[i], proto, src, dest, 0, 0);
+            err = arp_send(sbuffs[i], nextHop, out);
+        }
+        if (rc == EOK) rc = err;
     }
 
-    map_add(&ip_devices, dev->ip, dev);
+    return rc;
+}
 
-    uint16_t hdrLen = ip->ihl * 4;
-    switch(ip->proto) {
+static void deliver(struct netdevice* dev, uint8_t proto, uint32_t src,
+        const uint8_t * data, uint16_t len) {
+    switch(proto) {
         case(1) :
-            icmp_segment(ntol(ip->src), dev,
-                          data + hdrLen,
-                          ntos(ip->total_len) - hdrLen);
+            icmp_segment(src, dev, data, len);
             break;
 
         case(2) :
             warn("No habla igmp\n");
             break;
         case(IPPROTO_TCP) :
-            tcp_segment(dev, data + hdrLen,
-                    ntos(ip->total_len) - hdrLen, ntol(ip->src));
+            tcp_segment(dev, data, len, src);
             break;
         case(17) :
-            udp_datagram(dev, data + hdrLen, ntol(ip->src));
+            udp_datagram(dev, data, len, src);
             break;
         default:
-            console_put_hex16(ip->proto);
+            console_put_hex16(proto);
             warn("Unsupported IP protocol");
     }
 }
 
-void ip_add_device(struct netdevice * dev) {
-    map_add(&ip_devices, dev->ip, dev);
+void ip_packet(struct netdevice* dev, const uint8_t* data) {
+    struct ipv4_header* ip = (struct ipv4_header*) data;
+
+    uint16_t hdrLen = ip->ihl * 4;
+    uint16_t len = ntos(ip->total_len) - hdrLen;
+    uint16_t fragment = ntos(ip->fragment);
+
+    if (fragment & (IpMoreFragments | IpOffsetMask)) {
+        uint16_t total;
+        uint8_t * whole = ipfrag_add(ntol(ip->src), ntol(ip->dest), ntos(ip->id), ip->proto,
+                (fragment & IpOffsetMask) * 8, fragment & IpMoreFragments,
+                data + hdrLen, len, &total);
+        if (whole) {
+            deliver(dev, ip->proto, ntol(ip->src), whole, total);
+            kmem_free(whole);
+        }
+        return;
+    }
+
+    deliver(dev, ip->proto, ntol(ip->src), data + hdrLen, len);
+}
+
+void init_ip() {
+    bzero(interfaces, sizeof(interfaces));
+    init_route();
+    init_ipfrag();
+}
+
+int ip_add_device(struct netdevice * dev) {
+    if (dev->ifindex && interfaces[dev->ifindex - 1] == dev) return EOK;
+
+    for (int i = 0; i < MaxInterfaces; i++) {
+        if (!interfaces[i]) {
+            interfaces[i] = dev;
+            dev->ifindex = i + 1;
+            return EOK;
+        }
+    }
+
+    warn("Too many network interfaces");
+    return EINVALID;
+}
+
+void ip_configure(struct netdevice * dev, uint32_t addr, uint8_t prefixLen, uint32_t gateway) {
+    dev->ip = addr;
+    ip_add_device(dev);
+
+    uint32_t mask = prefixLen ? 0xffffffff << (32 - prefixLen) : 0;
+    route_add(addr & mask, prefixLen, 0, dev);
+    if (gateway) route_add(0, 0, gateway, dev);
+
+    gratuitous_arp(dev);
+    if (gateway) arp_lookup(dev, gateway, NULL);
+}
+
+void ip_remove_device(struct netdevice * dev) {
+    route_remove_device(dev);
+    if (dev->ifindex && interfaces[dev->ifindex - 1] == dev) {
+        interfaces[dev->ifindex - 1] = NULL;
+    }
+    dev->ifindex = 0;
 }
 
 struct netdevice * ip_resolve_local(uint32_t addr) {
-    return map_lookup(&ip_devices, ntol(addr));
+    addr = ntol(addr);
+    for (int i = 0; i < MaxInterfaces; i++) {
+        if (interfaces[i] && interfaces[i]->ip == addr) return interfaces[i];
+    }
+    return NULL;
 }
@@ -2,35 +2,60 @@
 
 #include "common.h"
 #include "net/ntox.h"
+#include "net/checksum.h"
 
 struct netdevice;
 struct sbuff_t;
 
 #define IPPROTO_TCP 6
+#define IPPROTO_UDP 17
+
+struct ipv4_header {
+    uint8_t ihl : 4;
+    uint8_t version : 4;
+    uint8_t ecn : 2;
+    uint8_t dscp : 6;
+    uint16_t total_len;
+    uint16_t id;
+    uint16_t fragment;      // flags and offset, network order
+    uint8_t ttl;
+    uint8_t proto;
+    uint16_t checksum;
+    uint32_t src;
+    uint32_t dest;
+} __attribute__ ((packed));
+
+#define IpDontFragment 0x4000
+#define IpMoreFragments 0x2000
+#define IpOffsetMask 0x1fff
 
 void ip_packet(struct netdevice* dev, const uint8_t* data);
+// `dest` in host order. The routing table picks the interface and next
+// hop; with no matching route the packet goes out on the given device.
+// Either way it carries the address of the interface it leaves by.
 int ip_send(struct sbuff_t* sbuff, uint8_t proto, uint32_t dest, struct netdevice *);
+
+// Several packets for the same destination: routed and resolved once, and
+// handed to the driver together. Returns the first failure, if any.
+int ip_send_batch(struct sbuff_t** sbuffs, uint16_t count, uint8_t proto, uint32_t dest, struct netdevice *);
 struct sbuff_t* ip_sbuff_alloc(uint16_t sz);
 
-struct netdevice * ip_resolve_local(uint32_t addr);
-void ip_add_device(struct netdevice * dev);
+void init_ip();
 
-static inline uint16_t checksum(const void *buf, uint32_t len, uint16_t* dest) {
-    const uint8_t* data= (const uint8_t*)buf;
-    uint32_t sum = 0;
-    *dest = 0;
+// Interfaces are registered once, when the device comes up.
+int ip_add_device(struct netdevice * dev);
+void ip_remove_device(struct netdevice * dev);
 
-    for (int i = 0; i < len; i+=2) {
-        uint16_t w = ((data[i]<<8) & 0xff00) +
-                        (data[i+1] & 0xff);
-        sum += w;
-    }
-    while(sum >> 16) {
-        sum = (sum & 0xffff) + (sum >> 16);
-    }
+// Static configuration for a device that's just come up: address, the
+// connected route, a default route if `gateway` isn't 0, and announce it.
+void ip_configure(struct netdevice * dev, uint32_t addr, uint8_t prefixLen, uint32_t gateway);
 
-    sum = ~sum;
-    *dest = ntos(sum);
+// the interface owning `addr` (network order), if any
+struct netdevice * ip_resolve_local(uint32_t addr);
 
-    return sum;
+// fills in `dest` (network order) and returns the checksum in host order
+static inline uint16_t checksum(const void *buf, uint32_t len, uint16_t* dest) {
+    *dest = 0;
+    *dest = csum_fold(csum_partial(buf, len, 0));
+    return ntos(*dest);
 }
@@ -0,0 +1,174 @@
+#include "net/ipfrag.h"
+#include "memory.h"
+#include "timer.h"
+
+#define ReassemblySlots 16
+#define ReassemblyBuckets 16
+#define ReassemblyTimeoutMs 30000
+#define ReassemblyMaxSize 16384     // what we're willing to ask kmem_alloc for
+#define ReassemblyMaxHeld 65536     // across everything in progress
+
+typedef struct frag_t {
+    struct frag_t * next;   // in offset order
+    uint16_t offset;
+    uint16_t len;
+    uint8_t data[];
+} frag;
+
+typedef struct {
+    uint32_t src;
+    uint32_t dest;
+    uint16_t id;
+    uint8_t proto;
+    uint8_t live;
+    uint8_t next;           // hash chain, slot + 1
+    uint16_t total;         // 0 until the last fragment shows up
+    uint16_t received;
+    uint64_t expires;
+    frag * frags;
+} reassembly;
+
+static reassembly slots[ReassemblySlots];
+static uint8_t buckets[ReassemblyBuckets];
+static uint32_t live;
+static uint32_t held;
+static timer expiry;
+
+static uint32_t bucket_for(uint32_t src, uint32_t dest, uint16_t id, uint8_t proto) {
+    uint32_t h = src ^ dest ^ ((uint32_t)id << 8 | proto);
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h % ReassemblyBuckets;
+}
+
+static void forget(reassembly * r) {
+    uint8_t * p = &buckets[bucket_for(r->src, r->dest, r->id, r->proto)];
+    uint8_t me = r - slots + 1;
+    while (*p != me) p = &slots[*p - 1].next;
+    *p = r->next;
+
+    for (frag * f = r->frags; f; ) {
+        frag * next = f->next;
+        held -= f->len;
+        kmem_free(f);
+        f = next;
+    }
+
+    bzero(r, sizeof(*r));
+    live--;
+}
+
+static void expire(void * unused) {
+    uint64_t now = timer_ticks();
+    for (int i = 0; i < ReassemblySlots; i++) {
+        if (slots[i].live && slots[i].expires <= now) forget(&slots[i]);
+    }
+
+    if (live) timer_start(&expiry, 1000, expire, NULL);
+}
+
+static reassembly * oldest() {
+    reassembly * r = NULL;
+    for (int i = 0; i < ReassemblySlots; i++) {
+        if (slots[i].live && (!r || slots[i].expires < r->expires)) r = &slots[i];
+    }
+    return r;
+}
+
+static reassembly * find_or_start(uint32_t src, uint32_t dest, uint16_t id, uint8_t proto) {
+    uint8_t * bucket = &buckets[bucket_for(src, dest, id, proto)];
+    for (uint8_t i = *bucket; i; i = slots[i - 1].next) {
+        reassembly * r = &slots[i - 1];
+        if (r->id == id && r->src == src && r->dest == dest && r->proto == proto) return r;
+    }
+
+    if (live == ReassemblySlots) forget(oldest());
+
+    reassembly * r = slots;
+    while (r->live) r++;
+
+    r->src = src;
+    r->dest = dest;
+    r->id = id;
+    r->proto = proto;
+    r->live = 1;
+    r->expires = timer_ticks() + (uint64_t)ReassemblyTimeoutMs * TIMER_HZ / 1000;
+    r->next = *bucket;
+    *bucket = r - slots + 1;
+    live++;
+
+    if (!expiry.pending) timer_start(&expiry, 1000, expire, NULL);
+    return r;
+}
+
+void init_ipfrag() {
+    for (int i = 0; i < ReassemblySlots; i++) {
+        if (slots[i].live) forget(&slots[i]);
+    }
+    timer_stop(&expiry);
+}
+
+uint32_t ipfrag_pending() {
+    return live;
+}
+
+uint8_t * ipfrag_add(uint32_t src, uint32_t dest, uint16_t id, uint8_t proto,
+        uint16_t offset, int more, const uint8_t * data, uint16_t len, uint16_t * total) {
+    uint32_t end = (uint32_t)offset + len;
+
+    // all but the last carry a multiple of 8 bytes
+    if (!len || end > ReassemblyMaxSize || (more && (len & 7))) return NULL;
+
+    reassembly * r = find_or_start(src, dest, id, proto);
+
+    if ((!more && r->total && r->total != end) || (r->total && end > r->total)) {
+        forget(r);
+        return NULL;
+    }
+
+    frag * before = NULL, * after = r->frags;
+    while (after && after->offset < offset) {
+        before = after;
+        after = after->next;
+    }
+
+    // a repeat is fine, anything else overlapping is suspect: give up on it
+    if (after && after->offset == offset && after->len == len) return NULL;
+    if ((before && before->offset + before->len > offset) || (after && end > after->offset)) {
+        forget(r);
+        return NULL;
+    }
+
+    while (held + len > ReassemblyMaxHeld) {
+        reassembly * victim = oldest();
+        if (victim == r) {
+            forget(r);
+            return NULL;
+        }
+        forget(victim);
+    }
+
+    frag * f = kmem_alloc(sizeof(frag) + len);
+    f->offset = offset;
+    f->len = len;
+    memcpy(f->data, data, len);
+    f->next = after;
+    if (before) before->next = f;
+    else r->frags = f;
+
+    held += len;
+    r->received += len;
+    if (!more) r->total = end;
+
+    if (!r->total || r->received != r->total) return NULL;
+
+    uint8_t * whole = kmem_alloc(r->total);
+    for (f = r->frags; f; f = f->next) {
+        memcpy(whole + f->offset, f->data, f->len);
+    }
+    *total = r->total;
+
+    forget(r);
+    return whole;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "common.h"
+
+// IPv4 reassembly. A handful of datagrams can be in progress at once;
+// those left incomplete are dropped after a timeout.
+
+void init_ipfrag();
+
+// Adds one fragment, `offset` and `len` in bytes. Once the datagram is
+// complete its payload is returned (kmem_free it when done) and `total`
+// set to its size; until then NULL.
+uint8_t * ipfrag_add(uint32_t src, uint32_t dest, uint16_t id, uint8_t proto,
+        uint16_t offset, int more, const uint8_t * data, uint16_t len, uint16_t * total);
+
+uint32_t ipfrag_pending();
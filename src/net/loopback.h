@@ -0,0 +1,9 @@
+#pragma once
+
+#include "common.h"
+
+#define LoopbackAddr 0x7f000001
+
+// 127.0.0.1, with 127.0.0.0/8 routed to it. Frames sent come back in on
+// a later pass of the task queue, as if they'd been received.
+void init_loopback();
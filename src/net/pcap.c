@@ -0,0 +1,143 @@
+#include "net/pcap.h"
+#include "net/ntox.h"
+#include "memory.h"
+#include "timer.h"
+#include "errno.h"
+
+// records as they'll be written out, header then frame, wrapping at the end
+static struct {
+    uint8_t * buf;
+    uint32_t size;
+    uint32_t head;      // oldest record
+    uint32_t used;
+    uint32_t overwritten;
+    int paused;
+} ring;
+
+static void ring_put(uint32_t at, const void * data, uint32_t len) {
+    uint32_t first = ring.size - at < len ? ring.size - at : len;
+    memcpy(ring.buf + at, data, first);
+    memcpy(ring.buf, (const uint8_t*)data + first, len - first);
+}
+
+static void ring_get(uint32_t at, void * data, uint32_t len) {
+    uint32_t first = ring.size - at < len ? ring.size - at : len;
+    memcpy(data, ring.buf + at, first);
+    memcpy((uint8_t*)data + first, ring.buf, len - first);
+}
+
+static uint32_t record_size(uint32_t at) {
+    pcap_record_header h;
+    ring_get(at, &h, sizeof(h));
+    return sizeof(h) + h.capLen;
+}
+
+int pcap_start(uint32_t size) {
+    pcap_stop();
+    if (size < sizeof(pcap_record_header) + 64) return EINVALID;
+
+    ring.buf = kmem_alloc(size);
+    ring.size = size;
+    ring.head = 0;
+    ring.used = 0;
+    ring.overwritten = 0;
+    return EOK;
+}
+
+void pcap_stop() {
+    if (ring.buf) kmem_free(ring.buf);
+    ring.buf = 0;
+}
+
+void pcap_capture(const uint8_t * frame, uint32_t len) {
+    if (!ring.buf || ring.paused) return;
+
+    uint32_t capLen = len < PcapSnapLen ? len : PcapSnapLen;
+    uint32_t need = sizeof(pcap_record_header) + capLen;
+    if (need > ring.size) return;
+
+    while (ring.size - ring.used < need) {
+        uint32_t oldest = record_size(ring.head);
+        ring.head = (ring.head + oldest) % ring.size;
+        ring.used -= oldest;
+        ring.overwritten++;
+    }
+
+    // time since boot; all that's wanted is the gaps
+    uint64_t ticks = timer_ticks();
+    pcap_record_header h = {
+        .sec = ticks / TIMER_HZ,
+        .usec = ticks % TIMER_HZ * (1000000 / TIMER_HZ),
+        .capLen = capLen,
+        .len = len };
+
+    uint32_t tail = (ring.head + ring.used) % ring.size;
+    ring_put(tail, &h, sizeof(h));
+    ring_put((tail + sizeof(h)) % ring.size, frame, capLen);
+    ring.used += need;
+}
+
+uint32_t pcap_overwritten() {
+    return ring.overwritten;
+}
+
+// a stretch of the ring, in at most two pieces
+static void write_out(pcap_write_fn write, void * user, uint32_t at, uint32_t len) {
+    uint32_t first = ring.size - at < len ? ring.size - at : len;
+    write(user, ring.buf + at, first);
+    if (len > first) write(user, ring.buf, len - first);
+}
+
+uint32_t pcap_export(pcap_write_fn write, void * user) {
+    pcap_file_header h = {
+        .magic = PcapMagic,
+        .versionMajor = 2,
+        .versionMinor = 4,
+        .snapLen = PcapSnapLen,
+        .linkType = PcapLinkEthernet };
+
+    write(user, &h, sizeof(h));
+    if (!ring.buf) return sizeof(h);
+
+    ring.paused = 1;
+    uint32_t at = ring.head;
+    for (uint32_t done = 0; done < ring.used; ) {
+        uint32_t len = record_size(at);
+        write_out(write, user, at, len);
+        at = (at + len) % ring.size;
+        done += len;
+    }
+    ring.paused = 0;
+
+    return sizeof(h) + ring.used;
+}
+
+int pcap_replay(const uint8_t * file, uint32_t size, pcap_frame_fn fn, void * user) {
+    pcap_file_header h;
+    if (size < sizeof(h)) return EINVALID;
+    memcpy(&h, file, sizeof(h));
+
+    // written on a machine of the other endianness?
+    int swapped = h.magic == ntol(PcapMagic) || h.magic == ntol(PcapMagicNsec);
+    if (!swapped && h.magic != PcapMagic && h.magic != PcapMagicNsec) return EINVALID;
+
+    uint32_t link = swapped ? ntol(h.linkType) : h.linkType;
+    if (link != PcapLinkEthernet) return EINVALID;
+
+    int frames = 0;
+    uint32_t at = sizeof(h);
+    while (size - at >= sizeof(pcap_record_header)) {
+        pcap_record_header r;
+        memcpy(&r, file + at, sizeof(r));
+        at += sizeof(r);
+
+        uint32_t capLen = swapped ? ntol(r.capLen) : r.capLen;
+        if (capLen > size - at) break;
+
+        fn(user, file + at, capLen);
+        at += capLen;
+        frames++;
+    }
+
+    return frames;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "common.h"
+
+// Classic libpcap files, ethernet link type, as tcpdump and wireshark read
+// and write them.
+#define PcapMagic 0xa1b2c3d4
+#define PcapMagicNsec 0xa1b23c4d
+#define PcapLinkEthernet 1
+#define PcapSnapLen 2048
+
+typedef struct pcap_file_header_t {
+    uint32_t magic;
+    uint16_t versionMajor;
+    uint16_t versionMinor;
+    uint32_t thisZone;  // signed, but always 0
+    uint32_t sigFigs;
+    uint32_t snapLen;
+    uint32_t linkType;
+} pcap_file_header;
+
+typedef struct pcap_record_header_t {
+    uint32_t sec;
+    uint32_t usec;
+    uint32_t capLen;
+    uint32_t len;
+} pcap_record_header;
+
+// Mirror every frame sent or received into a ring of `size` bytes, the
+// oldest making way for the newest; it's one allocation, so keep it to what
+// the heap can give in one go. Restarting throws away what was there.
+int pcap_start(uint32_t size);
+void pcap_stop();
+
+// Called by the device layer for each frame on the wire; a no-op when off.
+// Sent frames are caught on their way to the driver, so checksums left to
+// the card are still owed and super-segments appear whole.
+void pcap_capture(const uint8_t * frame, uint32_t len);
+
+// frames lost to the ring wrapping since pcap_start
+uint32_t pcap_overwritten();
+
+// Writes out the ring as a pcap file, oldest frame first, in as many
+// pieces as it takes. Nothing is captured meanwhile, so `write` may send.
+// Returns the bytes written.
+typedef void (*pcap_write_fn)(void * user, const void * data, uint32_t len);
+uint32_t pcap_export(pcap_write_fn write, void * user);
+
+// Hands each frame of the pcap file at `file` to `fn`, returning how many
+// or EINVALID if it isn't an ethernet pcap. Files of either byte order
+// are fine; a truncated last record is ignored.
+typedef void (*pcap_frame_fn)(void * user, const uint8_t * frame, uint32_t len);
+int pcap_replay(const uint8_t * file, uint32_t size, pcap_frame_fn fn, void * user);
@@ -0,0 +1,133 @@
+#include "net/route.h"
+#include "memory.h"
+#include "errno.h"
+
+#define MaxRoutes 32
+
+// A multibit trie, 8 bits per level. Prefixes that end part way through a
+// level are expanded to every slot they cover, longest last, so a lookup
+// is at most four array reads. The routes themselves live in a flat
+// table and the trie is rebuilt from it when they change.
+typedef struct route_node_t {
+    struct route_node_t * child[256];
+    uint8_t route[256];     // index into routes + 1, 0 for none
+} route_node;
+
+static route routes[MaxRoutes];
+static uint8_t nRoutes;
+static route_node * root;
+
+static inline uint32_t mask(uint8_t prefixLen) {
+    return prefixLen ? 0xffffffff << (32 - prefixLen) : 0;
+}
+
+static route_node * new_node() {
+    route_node * n = kmem_alloc(sizeof(route_node));
+    bzero(n, sizeof(route_node));
+    return n;
+}
+
+static void free_node(route_node * n) {
+    if (!n) return;
+    for (int i = 0; i < 256; i++) free_node(n->child[i]);
+    kmem_free(n);
+}
+
+static void insert(uint8_t index) {
+    const route * r = &routes[index];
+    route_node * n = root;
+    uint8_t level = 0;
+
+    // down to the level the prefix ends in
+    for (; r->prefixLen > (level + 1) * 8; level++) {
+        uint8_t b = r->dest >> (24 - level * 8);
+        if (!n->child[b]) n->child[b] = new_node();
+        n = n->child[b];
+    }
+
+    uint8_t bits = r->prefixLen - level * 8;
+    uint32_t first = bits ? (r->dest >> (24 - level * 8)) & 0xff & (0xff << (8 - bits)) : 0;
+    uint32_t count = 1 << (8 - bits);
+    for (uint32_t i = first; i < first + count; i++) {
+        n->route[i] = index + 1;
+    }
+}
+
+static void rebuild() {
+    free_node(root);
+    root = new_node();
+
+    for (uint8_t len = 0; len <= 32; len++) {
+        for (uint8_t i = 0; i < nRoutes; i++) {
+            if (routes[i].prefixLen == len) insert(i);
+        }
+    }
+}
+
+void init_route() {
+    nRoutes = 0;
+    rebuild();
+}
+
+static int find(uint32_t dest, uint8_t prefixLen) {
+    for (int i = 0; i < nRoutes; i++) {
+        if (routes[i].prefixLen == prefixLen && routes[i].dest == dest) return i;
+    }
+    return -1;
+}
+
+int route_add(uint32_t dest, uint8_t prefixLen, uint32_t gateway, struct netdevice * dev) {
+    if (prefixLen > 32 || !dev) return EINVALID;
+
+    dest &= mask(prefixLen);
+    if (find(dest, prefixLen) >= 0) return EADDRINUSE;
+    if (nRoutes == MaxRoutes) return EINVALID;
+
+    route * r = &routes[nRoutes++];
+    r->dest = dest;
+    r->prefixLen = prefixLen;
+    r->gateway = gateway;
+    r->dev = dev;
+
+    rebuild();
+    return EOK;
+}
+
+static void remove_at(int i) {
+    nRoutes--;
+    for (; i < nRoutes; i++) routes[i] = routes[i + 1];
+}
+
+int route_del(uint32_t dest, uint8_t prefixLen) {
+    int i = find(dest & mask(prefixLen), prefixLen);
+    if (i < 0) return ENOTFOUND;
+
+    remove_at(i);
+    rebuild();
+    return EOK;
+}
+
+void route_remove_device(struct netdevice * dev) {
+    for (int i = 0; i < nRoutes; ) {
+        if (routes[i].dev == dev) remove_at(i);
+        else i++;
+    }
+    rebuild();
+}
+
+const route * route_lookup(uint32_t dest, uint32_t * nextHop) {
+    uint8_t best = 0;
+    route_node * n = root;
+
+    for (int shift = 24; n && shift >= 0; shift -= 8) {
+        uint8_t b = dest >> shift;
+        if (n->route[b]) best = n->route[b];
+        n = n->child[b];
+    }
+
+    if (!best) return NULL;
+
+    const route * r = &routes[best - 1];
+    *nextHop = r->gateway ? r->gateway : dest;
+    return r;
+}
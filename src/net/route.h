@@ -0,0 +1,24 @@
+#pragma once
+
+#include "common.h"
+
+struct netdevice;
+
+// IPv4 routes, addresses in host order. A gateway of 0 means the
+// destination is on the link itself.
+typedef struct route_t {
+    uint32_t dest;
+    uint32_t gateway;
+    struct netdevice * dev;
+    uint8_t prefixLen;
+} route;
+
+void init_route();
+
+int route_add(uint32_t dest, uint8_t prefixLen, uint32_t gateway, struct netdevice * dev);
+int route_del(uint32_t dest, uint8_t prefixLen);
+void route_remove_device(struct netdevice * dev);
+
+// Longest prefix match. Returns NULL if there's no route, otherwise sets
+// `nextHop` to the address to resolve on the route's device.
+const route * route_lookup(uint32_t dest, uint32_t * nextHop);
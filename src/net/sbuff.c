@@ -1,5 +1,6 @@
 #include "net/sbuff.h"
 
+#include "net/checksum.h"
 #include "memory.h"
 
 sbuff * sbuff_free(void *p) {
@@ -12,4 +13,18 @@ sbuff* raw_sbuff_alloc(uint16_t size) {
     ret->totalSize = ret->currSize = size;
     ret->head = ret->data;
     ret->refs = 0;
+    ret->csumOffset = 0;
+    ret->csumStart = 0;
+    ret->gsoSize = 0;
+    return ret;
+}
+
+void sbuff_csum_complete(sbuff * s) {
+    if (!s->csumStart) return;
+
+    uint8_t * start = s->data + s->csumStart;
+    uint16_t * field = (uint16_t*)(start + s->csumOffset);
+    uint16_t sum = csum_fold(csum_partial(start, s->head + s->currSize - start, 0));
+    *field = sum ? sum : 0xffff;    // zero means no checksum to UDP
+    s->csumStart = 0;
 }
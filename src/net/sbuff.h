@@ -7,12 +7,26 @@ typedef struct sbuff_t {
     uint16_t currSize;
     uint8_t* head;
     uint8_t refs;
+    uint8_t csumOffset;     // checksum field, from csumStart
+    uint16_t csumStart;     // from data; 0 unless the checksum is still owed
+    uint16_t gsoSize;       // TCP payload per frame for a super-segment, else 0
     uint8_t data[];
 } sbuff;
 
 sbuff * raw_sbuff_alloc(uint16_t payload);
 sbuff * sbuff_free(void *);
 
+// Leave the transport checksum to the device: `field` already holds the
+// folded, uncomplemented pseudo header sum, and everything from `start`
+// to the end of the buffer still has to be added to it.
+static inline void sbuff_csum_partial(sbuff * s, const void * start, const void * field) {
+    s->csumStart = (const uint8_t*)start - s->data;
+    s->csumOffset = (const uint8_t*)field - (const uint8_t*)start;
+}
+
+// settle an owed checksum in software
+void sbuff_csum_complete(sbuff * s);
+
 static inline void sbuff_push(sbuff * s, uint16_t size) {
     if (size > s->currSize) {
         panic("net: sbuff overflow");
@@ -0,0 +1,63 @@
+#include "net/syncookie.h"
+#include "timer.h"
+
+// cookies are good for between one and two periods of 64 seconds
+#define CookiePeriodShift 6
+
+static const uint16_t mss_table[8] = {
+    536, 1024, 1200, 1360, 1400, 1440, 1452, 1460
+};
+
+static uint32_t secret;
+
+static uint32_t mix(uint32_t h, uint32_t v) {
+    h ^= v * 0xcc9e2d51;
+    h = (h << 13) | (h >> 19);
+    return h * 5 + 0xe6546b64;
+}
+
+static uint32_t cookie_hash(uint32_t localAddr, uint32_t remoteAddr,
+        uint16_t localPort, uint16_t remotePort, uint32_t theirSeq, uint32_t period) {
+    if (!secret) {
+        uint32_t lo, hi;
+        asm volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+        secret = (lo ^ hi) | 1;
+    }
+
+    uint32_t h = mix(secret, localAddr);
+    h = mix(h, remoteAddr);
+    h = mix(h, (uint32_t)localPort << 16 | remotePort);
+    h = mix(h, theirSeq);
+    h = mix(h, period);
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    return h;
+}
+
+static uint32_t current_period() {
+    return (uint32_t)(timer_ticks() / TIMER_HZ) >> CookiePeriodShift;
+}
+
+uint32_t syncookie_make(uint32_t localAddr, uint32_t remoteAddr,
+        uint16_t localPort, uint16_t remotePort, uint32_t theirSeq, uint16_t mss) {
+    uint32_t m = 7;
+    while (m && mss_table[m] > mss) m--;
+
+    uint32_t t = current_period() & 0x1f;
+    uint32_t h = cookie_hash(localAddr, remoteAddr, localPort, remotePort, theirSeq, t);
+
+    return t << 27 | m << 24 | (h & 0xffffff);
+}
+
+uint16_t syncookie_check(uint32_t localAddr, uint32_t remoteAddr,
+        uint16_t localPort, uint16_t remotePort, uint32_t theirSeq, uint32_t cookie) {
+    uint32_t t = cookie >> 27;
+    uint32_t now = current_period() & 0x1f;
+    if (t != now && t != ((now - 1) & 0x1f)) return 0;
+
+    uint32_t h = cookie_hash(localAddr, remoteAddr, localPort, remotePort, theirSeq, t);
+    if ((h & 0xffffff) != (cookie & 0xffffff)) return 0;
+
+    return mss_table[(cookie >> 24) & 7];
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "common.h"
+
+// Stateless SYN cookies: the initial sequence number we choose carries a
+// coarse timestamp and the peer's MSS, keyed by the connection quad.
+
+uint32_t syncookie_make(uint32_t localAddr, uint32_t remoteAddr,
+        uint16_t localPort, uint16_t remotePort, uint32_t theirSeq, uint16_t mss);
+
+// returns the encoded MSS, or 0 if `cookie` is not one of ours
+uint16_t syncookie_check(uint32_t localAddr, uint32_t remoteAddr,
+        uint16_t localPort, uint16_t remotePort, uint32_t theirSeq, uint32_t cookie);
@@ -3,7 +3,11 @@
 #include "net/sbuff.h"
 #include "net/ntox.h"
 #include "net/ip.h"
+#include "net/syncookie.h"
+#include "net/timewait.h"
+#include "net/gso.h"
 #include "memory.h"
+#include "timer.h"
 #include "errno.h"
 #include "console.h"
 
@@ -21,6 +25,24 @@ typedef enum TcpState_t {
     LastAck
 } TcpState;
 
+typedef struct sack_block_t {
+    uint32_t start;
+    uint32_t end;
+} sack_block;
+
+#define MaxSackBlocks 4
+
+typedef struct tcp_opts_t {
+    uint16_t mss;
+    uint8_t wscale;         // NoWindowScale if not offered
+    uint8_t sackOk;
+    uint8_t tsOk;
+    uint32_t tsVal;
+    uint32_t tsEcr;
+    uint8_t nSacks;
+    sack_block sacks[MaxSackBlocks];
+} tcp_opts;
+
 typedef struct stream_t {
     struct stream_t *next;
     struct netdevice * dev;
@@ -35,24 +57,68 @@ typedef struct stream_t {
     uint32_t ackSeq;
 
     uint8_t needsAck;
+    uint8_t fullSegments;   // received since we last acked
+    timer ackTimer;
+    timer closeTimer;       // from our fin, in case the peer goes quiet
 
     TcpState state;
 
+    // negotiated options
+    uint16_t sndMss;
+    uint8_t sndWscale;
+    uint8_t rcvWscale;
+    uint8_t sackOk;
+    uint8_t tsOk;
+    uint32_t tsRecent;
+    uint32_t sndWnd;
+
+    // what the peer has told us it holds beyond pendingAck
+    uint8_t nPeerSacks;
+    sack_block peerSacks[MaxSackBlocks];
+
+    // out of order data held in readBuf beyond readOffset, each block at
+    // readOffset + (start - ackSeq)
+    uint8_t nSacks;
+    sack_block sacks[MaxSackBlocks];
+
+    // a psh that came ahead of a hole, honoured once the hole fills
+    uint8_t pushHeld;
+    uint32_t pushSeq;
+
     uint8_t *readBuf;
     uint32_t readOffset;
     uint32_t readMax;
+    uint8_t paused;         // the reader can't take more yet
+    uint8_t eofHeld;        // the peer's fin, for once the reader has the rest
+
+    // what the peer's window won't take yet, and a fin to follow it
+    uint8_t *sendBuf;
+    uint32_t sendHead;
+    uint32_t sendLen;
+    uint8_t finPending;
+    tcp_writable_fn writable;
 
     tcp_read_fn readFn;
+    void * user;
+    void (*release)(void *);
 
 } stream;
 
-typedef struct {
-    uint32_t src;
-    uint32_t dst;
-    uint8_t zero;
-    uint8_t proto;
-    uint16_t len;
-} tcp_pseudo_hdr;
+enum TcpOption {
+    OptEnd = 0,
+    OptNop = 1,
+    OptMss = 2,
+    OptWindowScale = 3,
+    OptSackPermitted = 4,
+    OptSack = 5,
+    OptTimestamp = 8
+};
+
+#define NoWindowScale 0xff
+#define MaxWindowScale 14
+#define DefaultMss 536
+#define DelayedAckMs 40
+#define CloseTimeoutMs 60000
 
 enum {
     Fin = 0x001,
@@ -67,10 +133,25 @@ enum {
 };
 
 
+// A SYN we have answered; no stream exists until the handshake completes
+typedef struct half_open_t {
+    struct netdevice * dev;     // NULL when the slot is free
+    uint32_t remoteAddr;
+    uint16_t remotePort;
+    uint32_t irs;
+    uint32_t iss;
+    uint64_t expires;
+    tcp_opts opts;
+} half_open;
+
+#define SynBacklog 16
+#define SynReceivedTimeoutMs 5000
+
 typedef struct listen_state_t {
     uint16_t port;
     tcp_read_fn (*accept)();
     struct listen_state_t * next;
+    half_open backlog[SynBacklog];
 } listen_state;
 
 static stream * all_streams = NULL;
@@ -87,87 +168,345 @@ static void remove_stream(stream * s) {
     else
         all_streams = s->next;
 
+    timer_stop(&s->ackTimer);
+    timer_stop(&s->closeTimer);
+    if (s->release) s->release(s->user);
+    if (s->sendBuf) kmem_free(s->sendBuf);
     kmem_free(s);
 }
 
-static void tcp_checksum(sbuff *sb, uint16_t len, uint32_t src, uint32_t dest) {
-    tcp_hdr * hdr = (tcp_hdr*) sb->head;
+// sequence space comparisons, modulo 2^32
+static inline int seq_lt(uint32_t a, uint32_t b) { return (int)(a - b) < 0; }
+static inline int seq_le(uint32_t a, uint32_t b) { return (int)(a - b) <= 0; }
+
+static uint32_t tcp_now() {
+    return (uint32_t)timer_ticks();
+}
+
+static void parse_options(const tcp_hdr* hdr, uint32_t sz, tcp_opts* opts) {
+    bzero(opts, sizeof(*opts));
+    opts->wscale = NoWindowScale;
+
+    uint32_t len = hdr->offset * 4;
+    if (len <= sizeof(tcp_hdr) || len > sz) return;
+
+    const uint8_t* p = (const uint8_t*)hdr->options;
+    const uint8_t* end = (const uint8_t*)hdr + len;
+    while (p < end) {
+        uint8_t kind = p[0];
+        if (kind == OptEnd) break;
+        if (kind == OptNop) { p++; continue; }
+        if (p + 1 >= end || p[1] < 2 || p + p[1] > end) break;
+
+        uint8_t optLen = p[1];
+        switch (kind) {
+            case OptMss:
+                if (optLen == 4) opts->mss = p[2] << 8 | p[3];
+                break;
+            case OptWindowScale:
+                if (optLen == 3) opts->wscale = p[2] > MaxWindowScale ? MaxWindowScale : p[2];
+                break;
+            case OptSackPermitted:
+                opts->sackOk = optLen == 2;
+                break;
+            case OptTimestamp:
+                if (optLen == 10) {
+                    opts->tsOk = 1;
+                    memcpy(&opts->tsVal, p + 2, 4);
+                    memcpy(&opts->tsEcr, p + 6, 4);
+                    opts->tsVal = ntol(opts->tsVal);
+                    opts->tsEcr = ntol(opts->tsEcr);
+                }
+                break;
+            case OptSack:
+                for (const uint8_t* b = p + 2; b + 8 <= p + optLen
+                        && opts->nSacks < MaxSackBlocks; b += 8) {
+                    sack_block * block = &opts->sacks[opts->nSacks++];
+                    memcpy(&block->start, b, 4);
+                    memcpy(&block->end, b + 4, 4);
+                    block->start = ntol(block->start);
+                    block->end = ntol(block->end);
+                }
+                break;
+        }
+        p += optLen;
+    }
+}
+
+// what one frame on this link can carry, before options
+static uint16_t local_mss(const struct netdevice * dev) {
+    return netdev_mtu(dev) - 40;
+}
+
+static uint8_t sack_blocks_to_send(stream * stream) {
+    if (!stream->sackOk) return 0;
+    uint8_t room = stream->tsOk ? 3 : 4;
+    return stream->nSacks < room ? stream->nSacks : room;
+}
+
+static uint16_t options_size(stream* stream, uint8_t flags) {
+    uint16_t size = 0;
+    if (flags & Syn) {
+        size += 4;                              // mss
+        if (stream->sndWscale != NoWindowScale) size += 4; // nop, wscale
+        if (stream->sackOk || stream->tsOk) size += stream->tsOk ? 12 : 4;
+        return size;
+    }
+
+    if (flags & Rst) return 0;
+    if (stream->tsOk) size += 12;
+    uint8_t sacks = sack_blocks_to_send(stream);
+    if (sacks) size += 4 + 8 * sacks;
+    return size;
+}
+
+static uint8_t* put_timestamp(stream* stream, uint8_t* p) {
+    uint32_t val = ntol(tcp_now());
+    uint32_t ecr = ntol(stream->tsRecent);
+    *p++ = OptTimestamp;
+    *p++ = 10;
+    memcpy(p, &val, 4);
+    memcpy(p + 4, &ecr, 4);
+    return p + 8;
+}
+
+static void write_options(stream* stream, uint8_t* p, uint8_t flags) {
+    if (flags & Syn) {
+        uint16_t mss = local_mss(stream->dev);
+        *p++ = OptMss; *p++ = 4; *p++ = mss >> 8; *p++ = mss & 0xff;
+
+        if (stream->sackOk && stream->tsOk) {
+            *p++ = OptSackPermitted; *p++ = 2;
+            p = put_timestamp(stream, p);
+        }
+        else if (stream->tsOk) {
+            *p++ = OptNop; *p++ = OptNop;
+            p = put_timestamp(stream, p);
+        }
+        else if (stream->sackOk) {
+            *p++ = OptNop; *p++ = OptNop;
+            *p++ = OptSackPermitted; *p++ = 2;
+        }
+
+        if (stream->sndWscale != NoWindowScale) {
+            *p++ = OptNop;
+            *p++ = OptWindowScale; *p++ = 3; *p++ = stream->rcvWscale;
+        }
+        return;
+    }
+
+    if (flags & Rst) return;
+
+    if (stream->tsOk) {
+        *p++ = OptNop; *p++ = OptNop;
+        p = put_timestamp(stream, p);
+    }
 
-    tcp_pseudo_hdr *pseudo = (tcp_pseudo_hdr*)(sb->head - sizeof(tcp_pseudo_hdr));
-    pseudo->src = ntol(src);
-    pseudo->dst = ntol(dest);
-    pseudo->zero = 0;
-    pseudo->proto = IPPROTO_TCP;
-    pseudo->len = ntos(len);
-    checksum(pseudo, sizeof(*pseudo) + len, &hdr->chksum);
+    uint8_t sacks = sack_blocks_to_send(stream);
+    if (sacks) {
+        *p++ = OptNop; *p++ = OptNop;
+        *p++ = OptSack; *p++ = 2 + 8 * sacks;
+        for (uint8_t i = 0; i < sacks; i++) {
+            uint32_t start = ntol(stream->sacks[i].start);
+            uint32_t end = ntol(stream->sacks[i].end);
+            memcpy(p, &start, 4);
+            memcpy(p + 4, &end, 4);
+            p += 8;
+        }
+    }
 }
 
-static void header_from_stream(stream* stream, tcp_hdr* hdr, uint8_t flags) {
+// RFC 793: once past the syn, every segment carries the ack
+static int synchronized(const stream * stream) {
+    return stream->state != Closed && stream->state != Listen && stream->state != SynSent;
+}
+
+static uint16_t header_from_stream(stream* stream, tcp_hdr* hdr, uint8_t flags) {
+    uint16_t optSize = options_size(stream, flags);
+    uint32_t window = stream->readMax - stream->readOffset;
+    if (!(flags & Syn)) window >>= stream->rcvWscale;
+    if (window > 0xffff) window = 0xffff;
+
     hdr->srcPort = ntos(stream->localPort);
     hdr->destPort = ntos(stream->remotePort);
     hdr->sequence = ntol(stream->localSeq);
     hdr->ack = ntol(stream->ackSeq);
-    hdr->offset = 5;
+    hdr->offset = (sizeof(tcp_hdr) + optSize) / 4;
     hdr->reserved = 0;
-    hdr->window = ntos(stream->readMax - stream->readOffset);
-    hdr->flags = flags | (stream->needsAck ? Ack : 0);
+    hdr->window = ntos(window);
+    hdr->flags = flags | (stream->needsAck || synchronized(stream) ? Ack : 0);
     hdr->chksum = 0;
+    write_options(stream, (uint8_t*)hdr->options, flags);
+
+    // anything we send carries the ack, so nothing is left to delay
+    if (hdr->flags & Ack) {
+        stream->needsAck = 0;
+        stream->fullSegments = 0;
+        timer_stop(&stream->ackTimer);
+    }
+
+    return sizeof(tcp_hdr) + optSize;
+}
+
+// Build and transmit a segment for this stream carrying `sz` bytes of data.
+// With a `gsoSize` it's a super-segment, cut into pieces that size on the
+// way out.
+static void transmit(stream* stream, uint8_t flags, const void* data, uint16_t sz, uint16_t gsoSize) {
+    uint16_t hdrSize = sizeof(tcp_hdr) + options_size(stream, flags);
+    sbuff * sb = ip_sbuff_alloc(hdrSize + sz);
+    tcp_hdr * hdr = (tcp_hdr*) sb->head;
+    header_from_stream(stream, hdr, flags);
+    sb->gsoSize = gsoSize;
+
+    uint32_t sum = csum_pseudo(stream->dev->ip, stream->remoteAddr, IPPROTO_TCP, hdrSize + sz);
+    if (gsoSize || (stream->dev->features & NetdevTxCsum)) {
+        // the card sums the segment, or each piece gets summed as it's cut
+        if (sz) memcpy(sb->head + hdrSize, data, sz);
+        hdr->chksum = ~csum_fold(sum);
+        sbuff_csum_partial(sb, hdr, &hdr->chksum);
+    }
+    else {
+        // sum the payload while copying it, then add the header
+        if (sz) sum = csum_copy(sb->head + hdrSize, data, sz, sum);
+        hdr->chksum = csum_fold(csum_partial(hdr, hdrSize, sum));
+    }
+    ip_send(sb, IPPROTO_TCP, stream->remoteAddr, stream->dev);
+}
 
-    stream->needsAck = 0;
+static void send_segment(stream* stream, uint8_t flags, const void* data, uint16_t sz) {
+    transmit(stream, flags, data, sz, 0);
 }
 
-static void reset_stream(struct netdevice *dev, tcp_hdr* hdr, uint32_t srcIp) {
-    stream stream = {0, dev, ntos(hdr->destPort), ntol(dev->ip),
-                     ntos(hdr->srcPort), srcIp,
-                     0, 0, 0, 1 };
-    sbuff * sb = ip_sbuff_alloc(sizeof(tcp_hdr));
-    tcp_hdr * response = (tcp_hdr*) sb->head;
-    header_from_stream(&stream, response, Rst);
+// the most data a full sized segment from the peer carries
+static uint32_t peer_segment(stream * s) {
+    uint16_t opts = s->tsOk ? 12 : 0;
+    return s->sndMss > opts ? s->sndMss - opts : 1;
+}
+
+static void delayed_ack(void * user) {
+    stream * s = (stream*) user;
+    if (s->needsAck) send_segment(s, 0, NULL, 0);
+}
 
-    tcp_checksum(sb, sizeof(*hdr), dev->ip, srcIp);
+// Pure acks go out for every second full sized segment, or when the
+// window has too little left for another, otherwise after a short delay
+// unless outbound data picks them up first.
+static void schedule_ack(stream * s) {
+    if (!s->needsAck) return;
 
-    ip_send(sb, IPPROTO_TCP, srcIp, dev);
+    if (s->fullSegments >= 2 || s->readMax - s->readOffset < peer_segment(s)) {
+        send_segment(s, 0, NULL, 0);
+    }
+    else if (!s->ackTimer.pending) {
+        timer_start(&s->ackTimer, DelayedAckMs, delayed_ack, s);
+    }
 }
 
-static void connected(struct netdevice *dev,
-        uint16_t localPort, uint16_t remotePort,
-        uint32_t remoteAddr, uint32_t ackSeq, tcp_read_fn fn) {
-    uint32_t localSeq = 1;
-    const uint32_t MaxReadBufffer = 2048;
+// RFC 793: answer an ack with a reset at the sequence it expects;
+// anything else gets one that acks it
+static void reset_stream(struct netdevice *dev, tcp_hdr* hdr, uint32_t sz, uint32_t srcIp) {
+    stream stream = {
+        .dev = dev,
+        .localPort = ntos(hdr->destPort), .localAddr = dev->ip,
+        .remotePort = ntos(hdr->srcPort), .remoteAddr = srcIp };
 
-    sbuff * sb = ip_sbuff_alloc(sizeof(tcp_hdr));
-    tcp_hdr * hdr = (tcp_hdr*) sb->head;
+    if (hdr->flags & Ack) {
+        stream.localSeq = ntol(hdr->ack);
+    }
+    else {
+        uint32_t len = sz - hdr->offset * 4;
+        if (hdr->flags & Syn) len++;
+        if (hdr->flags & Fin) len++;
+        stream.ackSeq = ntol(hdr->sequence) + len;
+        stream.needsAck = 1;
+    }
 
-    stream * s = kmem_alloc(sizeof(stream) + MaxReadBufffer);
-    s->dev = dev;
+    send_segment(&stream, Rst, NULL, 0);
+}
+
+static uint8_t window_scale_for(uint32_t bufferSize) {
+    uint8_t shift = 0;
+    while (shift < MaxWindowScale && (bufferSize >> shift) > 0xffff) shift++;
+    return shift;
+}
+
+static void init_stream(stream * s, uint16_t localPort, const half_open * h) {
+    bzero(s, sizeof(stream));
+    s->dev = h->dev;
     s->localPort = localPort;
-    s->remotePort = remotePort;
-    s->localAddr = dev->ip;
-    s->remoteAddr = remoteAddr;
-    s->localSeq = localSeq;
-    s->ackSeq = ackSeq + 1;
-    s->needsAck = 0;
+    s->remotePort = h->remotePort;
+    s->localAddr = h->dev->ip;
+    s->remoteAddr = h->remoteAddr;
+    s->localSeq = h->iss;
+    s->pendingAck = h->iss;
+    s->ackSeq = h->irs + 1;
     s->state = SynReceived;
 
-    s->readFn = fn;
+    s->sndMss = h->opts.mss ? h->opts.mss : DefaultMss;
+    if (s->sndMss > local_mss(s->dev)) s->sndMss = local_mss(s->dev);
+    s->sndWscale = h->opts.wscale;
+    s->rcvWscale = h->opts.wscale == NoWindowScale ? 0 : window_scale_for(TcpReadBuffer);
+    s->sackOk = h->opts.sackOk;
+    s->tsOk = h->opts.tsOk;
+    s->tsRecent = h->opts.tsVal;
+
+    s->readMax = TcpReadBuffer;
+}
+
+static void send_synack(uint16_t localPort, const half_open * h) {
+    stream s;
+    init_stream(&s, localPort, h);
+    s.needsAck = 1;
+    send_segment(&s, Syn, NULL, 0);
+}
+
+// the final ack of the handshake arrived: now it's worth a stream
+static stream * connected(listen_state * l, const half_open * h) {
+    stream * s = kmem_alloc(sizeof(stream) + TcpReadBuffer);
+    init_stream(s, l->port, h);
+    s->localSeq++;
+    s->pendingAck = s->localSeq;
+
+    s->readFn = l->accept(s);
     s->readBuf = (void*)(s + 1);
-    s->readOffset = 0;
-    s->readMax = MaxReadBufffer;
 
     s->next = all_streams;
     all_streams = s;
 
-    // reply with syn-ack
-    header_from_stream(s, hdr, Syn | Ack);
-    s->localSeq++;
+    return s;
+}
+
+static void update_options(stream * stream, tcp_hdr * hdr, const tcp_opts * opts) {
+    // RFC 7323: only remember timestamps from segments covering the last ack
+    if (stream->tsOk && opts->tsOk && seq_le(ntol(hdr->sequence), stream->ackSeq)) {
+        stream->tsRecent = opts->tsVal;
+    }
+
+    if (stream->sackOk) {
+        stream->nPeerSacks = opts->nSacks;
+        memcpy(stream->peerSacks, opts->sacks, sizeof(sack_block) * opts->nSacks);
+    }
+
+    uint32_t window = ntos(hdr->window);
+    stream->sndWnd = stream->sndWscale == NoWindowScale ? window : window << stream->sndWscale;
+}
+
+// we closed first: keep just enough to answer stragglers for 2MSL
+static void time_wait(stream* stream) {
+    timewait_add(stream->localAddr, stream->localPort,
+            stream->remoteAddr, stream->remotePort,
+            stream->localSeq, stream->ackSeq);
 
-    tcp_checksum(sb, sizeof(*hdr), dev->ip, remoteAddr);
-    ip_send(sb, IPPROTO_TCP, remoteAddr, dev);
+    remove_stream(stream);
 }
 
-static void acked(stream * stream, tcp_hdr* hdr) {
-    if (hdr->ack >= stream->pendingAck) {
-        stream->pendingAck = hdr->ack;
+static void flush_send(stream * stream);
+
+// returns non-zero if the stream is gone
+static int acked(stream * stream, tcp_hdr* hdr) {
+    uint32_t ack = ntol(hdr->ack);
+    if (seq_le(stream->pendingAck, ack)) {
+        stream->pendingAck = ack;
         // TODO: delete retransmit buffers here
     }
     else {
@@ -175,95 +514,309 @@ static void acked(stream * stream, tcp_hdr* hdr) {
     }
 
     if (stream->state == SynReceived) stream->state = Established;
+
+    // the window may have opened for what's waiting
+    flush_send(stream);
+    if (stream->writable && stream->sendLen < TcpSendBuffer) stream->writable(stream);
+
+    // the rest waits for our fin to be sent and acked
+    if (stream->finPending || seq_lt(ack, stream->localSeq)) return 0;
+
     if (stream->state == FinWait1) stream->state = FinWait2;
-    if (stream->state == LastAck) remove_stream(stream);
+    if (stream->state == Closing) {
+        time_wait(stream);
+        return 1;
+    }
+    if (stream->state == LastAck) {
+        remove_stream(stream);
+        return 1;
+    }
+
+    return 0;
 }
 
-void tcp_close(stream *stream) {
-    sbuff * sb = ip_sbuff_alloc(sizeof(tcp_hdr));
-    tcp_hdr * response = (tcp_hdr*) sb->head;
-    header_from_stream(stream, response, Fin);
-    stream->state = FinWait1;
+void tcp_set_user(stream * stream, void * user, void (*release)(void *)) {
+    stream->user = user;
+    stream->release = release;
+}
 
-    tcp_checksum(sb, sizeof(*response), stream->dev->ip, stream->remoteAddr);
-    ip_send(sb, IPPROTO_TCP, stream->remoteAddr, stream->dev);
+void * tcp_user(stream * stream) {
+    return stream->user;
+}
+
+void tcp_set_writable(stream * stream, tcp_writable_fn fn) {
+    stream->writable = fn;
+}
+
+// what the peer's window has room for beyond what's in flight
+static uint32_t usable(stream * stream) {
+    uint32_t inFlight = stream->localSeq - stream->pendingAck;
+    return stream->sndWnd > inFlight ? stream->sndWnd - inFlight : 0;
+}
+
+static void send_fin(stream * stream) {
+    stream->finPending = 0;
+    send_segment(stream, Fin, NULL, 0);
     stream->localSeq ++;
 }
 
-void tcp_send(stream *stream, const void* data, uint16_t sz) {
-    //Segmentation would be good ... rcv window size, etc., etc.
+// Nothing is retransmitted, so a peer that's gone away would otherwise keep
+// a closing stream, FIN_WAIT_2 or LAST_ACK, for good.
+static void close_timeout(void * user) {
+    remove_stream((stream*) user);
+}
 
-    sbuff * sb = ip_sbuff_alloc(sizeof(tcp_hdr) + sz);
-    tcp_hdr * response = (tcp_hdr*) sb->head;
-    header_from_stream(stream, response, Psh);
+void tcp_close(stream *stream) {
+    if (stream->state == Established || stream->state == SynReceived) {
+        stream->state = FinWait1;
+    }
+    else if (stream->state == CloseWait) {
+        stream->state = LastAck;
+    }
+    else {
+        return;
+    }
+    timer_start(&stream->closeTimer, CloseTimeoutMs, close_timeout, stream);
 
-    uint8_t* dst = sb->head + sizeof(*response);
-    memcpy(dst, data, sz);
+    // after everything already written
+    if (stream->sendLen) stream->finPending = 1;
+    else send_fin(stream);
+}
 
-    tcp_checksum(sb, sizeof(*response) + sz, stream->dev->ip, stream->remoteAddr);
-    ip_send(sb, IPPROTO_TCP, stream->remoteAddr, stream->dev);
+static void push(stream *stream, const uint8_t * p, uint32_t sz) {
+    // every segment repeats the options, so they come out of the mss
+    uint16_t opts = options_size(stream, 0);
+    uint16_t mss = stream->sndMss > opts ? stream->sndMss - opts : 1;
+
+    // anything bigger goes down in super-segments, cut to size at the device
+    uint16_t most = GsoMaxSize / mss;
+    if (most > GsoMaxSegments) most = GsoMaxSegments;
+    if (!most) most = 1;
+    most *= mss;
+
+    while (sz) {
+        uint16_t chunk = sz < most ? sz : most;
+        transmit(stream, Psh, p, chunk, chunk > mss ? mss : 0);
+        stream->localSeq += chunk;
+        p += chunk;
+        sz -= chunk;
+    }
+}
 
-    stream->localSeq += sz;
+// sends what's waiting as far as the window goes
+static void flush_send(stream * stream) {
+    while (stream->sendLen) {
+        uint32_t n = usable(stream);
+        if (!n) return;
+
+        uint32_t run = TcpSendBuffer - stream->sendHead;
+        if (run > stream->sendLen) run = stream->sendLen;
+        if (n > run) n = run;
+
+        push(stream, stream->sendBuf + stream->sendHead, n);
+        stream->sendHead = (stream->sendHead + n) % TcpSendBuffer;
+        stream->sendLen -= n;
+    }
+
+    if (stream->finPending) send_fin(stream);
 }
 
-static void buffer_data(struct netdevice* dev, tcp_hdr *hdr,
-        stream * stream, uint32_t len) {
-    if (!len) return;
+uint32_t tcp_send_space(stream *stream) {
+    uint32_t room = TcpSendBuffer - stream->sendLen;
+    return stream->sendLen || stream->finPending ? room : room + usable(stream);
+}
 
-    if (stream->readOffset + len > stream->readMax) {
-        console_print_string("Out of buffer space in read ... dropping packet\n");
-        return;
+uint32_t tcp_send(stream *stream, const void* data, uint32_t sz) {
+    const uint8_t * p = (const uint8_t*) data;
+
+    // straight out if nothing's waiting ahead of it
+    uint32_t sent = 0;
+    if (!stream->sendLen && !stream->finPending) {
+        sent = usable(stream);
+        if (sent > sz) sent = sz;
+        push(stream, p, sent);
+    }
+
+    uint32_t queued = sz - sent;
+    if (queued > TcpSendBuffer - stream->sendLen) queued = TcpSendBuffer - stream->sendLen;
+    if (queued && !stream->sendBuf) stream->sendBuf = kmem_alloc(TcpSendBuffer);
+
+    for (uint32_t i = 0; i < queued; ) {
+        uint32_t tail = (stream->sendHead + stream->sendLen) % TcpSendBuffer;
+        uint32_t run = TcpSendBuffer - tail < queued - i ? TcpSendBuffer - tail : queued - i;
+        memcpy(stream->sendBuf + tail, p + sent + i, run);
+        stream->sendLen += run;
+        i += run;
+    }
+
+    return sent + queued;
+}
+
+static void drop_sack(stream * stream, uint8_t i) {
+    stream->nSacks--;
+    for (; i < stream->nSacks; i++) {
+        stream->sacks[i] = stream->sacks[i + 1];
+    }
+}
+
+// remember out of order data, most recent block first (RFC 2018)
+static void add_sack(stream * stream, uint32_t start, uint32_t end) {
+    for (uint8_t i = 0; i < stream->nSacks; ) {
+        sack_block * b = &stream->sacks[i];
+        if (seq_le(b->start, end) && seq_le(start, b->end)) {
+            if (seq_lt(b->start, start)) start = b->start;
+            if (seq_lt(end, b->end)) end = b->end;
+            drop_sack(stream, i);
+        }
+        else {
+            i++;
+        }
     }
 
-    stream->ackSeq = ntol(hdr->sequence) + len;
+    if (stream->nSacks == MaxSackBlocks) stream->nSacks--;
+    for (uint8_t i = stream->nSacks; i > 0; i--) {
+        stream->sacks[i] = stream->sacks[i - 1];
+    }
+    stream->sacks[0].start = start;
+    stream->sacks[0].end = end;
+    stream->nSacks++;
+}
+
+// Pull any held out of order blocks that now follow the in-order data
+static void advance_sacks(stream * stream) {
+    for (uint8_t i = 0; i < stream->nSacks; ) {
+        sack_block * b = &stream->sacks[i];
+        if (seq_le(b->start, stream->ackSeq)) {
+            if (seq_lt(stream->ackSeq, b->end)) {
+                stream->readOffset += b->end - stream->ackSeq;
+                stream->ackSeq = b->end;
+            }
+            drop_sack(stream, i);
+            i = 0;
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+// returns non-zero if the data arrived out of order
+static int buffer_data(struct netdevice* dev, tcp_hdr *hdr,
+        stream * stream, uint32_t len) {
+    if (!len) return 0;
 
     const uint8_t* data = (const uint8_t*)hdr + 4 * hdr->offset;
-    memcpy(stream->readBuf + stream->readOffset, data, len);
-    stream->readOffset += len;
+    uint32_t seq = ntol(hdr->sequence);
+
+    // trim anything we already have
+    if (seq_lt(seq, stream->ackSeq)) {
+        uint32_t dup = stream->ackSeq - seq;
+        stream->needsAck = 1;
+        if (dup >= len) return 0;
+        data += dup;
+        len -= dup;
+        seq = stream->ackSeq;
+    }
+
+    uint32_t offset = stream->readOffset + (seq - stream->ackSeq);
+    if (offset + len > stream->readMax) {
+        console_print_string("Out of buffer space in read ... dropping packet\n");
+        return 0;
+    }
+
+    memcpy(stream->readBuf + offset, data, len);
     stream->needsAck = 1;
+
+    if (seq == stream->ackSeq) {
+        // a coalesced segment counts for each frame it was
+        stream->fullSegments += len / peer_segment(stream);
+        stream->readOffset += len;
+        stream->ackSeq = seq + len;
+        advance_sacks(stream);
+        return 0;
+    }
+
+    if (stream->sackOk) {
+        add_sack(stream, seq, seq + len);
+    }
+    return 1;
+}
+
+// how far past ackSeq the held out of order data reaches
+static uint32_t held_extent(stream * stream) {
+    uint32_t extent = 0;
+    for (uint8_t i = 0; i < stream->nSacks; i++) {
+        uint32_t end = stream->sacks[i].end - stream->ackSeq;
+        if (end > extent) extent = end;
+    }
+    return extent;
 }
 
 static void pushit(stream * stream) {
+    if (stream->paused) return;
+
+    uint32_t window = stream->readMax - stream->readOffset;
     stream->readFn(stream, stream->readBuf, stream->readOffset);
+
+    // what's held stays just past the (now empty) in-order data
+    uint32_t held = held_extent(stream);
+    if (held) memmove(stream->readBuf, stream->readBuf + stream->readOffset, held);
     stream->readOffset = 0;
-}
 
-static void time_wait(stream* stream) {
-    // TODO ... schedule this for 2ms from now
+    // the peer may be stalled on the window we've just reopened
+    if (window < peer_segment(stream)) send_segment(stream, 0, NULL, 0);
+}
 
-    remove_stream(stream);
+void tcp_pause(stream * stream) {
+    stream->paused = 1;
 }
 
-static void fin(struct netdevice * dev, stream * s) {
-    if (s->state == FinWait2) {
-        // ack their fin
-        sbuff * sb = ip_sbuff_alloc(sizeof(tcp_hdr));
-        tcp_hdr * response = (tcp_hdr*) sb->head;
-        s->ackSeq++;
-        header_from_stream(s, response, Ack);
+void tcp_resume(stream * stream) {
+    if (!stream->paused) return;
+    stream->paused = 0;
+    if (stream->readOffset) pushit(stream);
 
-        tcp_checksum(sb, sizeof(*response), dev->ip, s->remoteAddr);
-        ip_send(sb, IPPROTO_TCP, s->remoteAddr, dev);
-        s->state = TimeWait;
+    // pushing may have paused it again
+    if (stream->eofHeld && !stream->paused && !stream->readOffset) {
+        stream->eofHeld = 0;
+        stream->readFn(stream, NULL, 0);
+    }
+}
 
-        time_wait(s);
+// returns non-zero if the stream is gone
+static int fin(struct netdevice * dev, stream * s) {
+    if (s->state == Established || s->state == SynReceived) {
+        s->ackSeq++;
+        s->needsAck = 1;
+        s->state = CloseWait;
+
+        // hand over what's left, then tell the application they're done,
+        // or once it resumes if it's paused. If it closes now, the fin goes
+        // out with the ack.
+        if (s->readOffset) pushit(s);
+        if (s->paused) s->eofHeld = 1;
+        else s->readFn(s, NULL, 0);
     }
-    else if (s->state == Established) {
-        // send a fin/ack ... we're assuming the 'application'
-        // has no more data, otherwise we'd need to Ack, wait for
-        // upper layer to shutdown/close, then Fin.
-        //
-        // But skip all that and the CloseWait state. Go straight to LastAck
-        //
-        sbuff * sb = ip_sbuff_alloc(sizeof(tcp_hdr));
-        tcp_hdr * response = (tcp_hdr*) sb->head;
+    else if (s->state == FinWait1) {
+        // simultaneous close, wait for the ack of our fin
         s->ackSeq++;
-        header_from_stream(s, response, Fin | Ack);
-
-        tcp_checksum(sb, sizeof(*response), dev->ip, s->remoteAddr);
-        ip_send(sb, IPPROTO_TCP, s->remoteAddr, dev);
-        s->state = LastAck;
+        s->needsAck = 1;
+        s->state = Closing;
+    }
+    else if (s->state == FinWait2) {
+        s->ackSeq++;
+        s->needsAck = 1;
+        send_segment(s, 0, NULL, 0);
+        time_wait(s);
+        return 1;
+    }
+    else {
+        // a retransmission of one we've already seen
+        s->needsAck = 1;
     }
+
+    if (s->needsAck) send_segment(s, 0, NULL, 0);
+    return 0;
 }
 
 static stream * find(struct netdevice *local, uint32_t src, tcp_hdr* hdr) {
@@ -283,22 +836,89 @@ static stream * find(struct netdevice *local, uint32_t src, tcp_hdr* hdr) {
 }
 
 
-static void syn(struct netdevice * dev, tcp_hdr *hdr, uint32_t srcIp) {
-    uint16_t dst = ntos(hdr->destPort);
-
+static listen_state * find_listener(uint16_t port) {
     listen_state * l = all_listeners;
     while(l) {
-        if (l->port == dst) break; // ONEDAY listen on iface? ...
+        if (l->port == port) break; // ONEDAY listen on iface? ...
         l = l->next;
     }
 
+    return l;
+}
+
+static void syn(struct netdevice * dev, tcp_hdr *hdr, uint32_t sz, uint32_t srcIp) {
+    uint16_t dst = ntos(hdr->destPort);
+
+    listen_state * l = find_listener(dst);
     if (l == NULL) {
-        reset_stream(dev, hdr, srcIp);
+        reset_stream(dev, hdr, sz, srcIp);
+        return;
+    }
+
+    half_open h = {
+        .dev = dev, .remoteAddr = srcIp, .remotePort = ntos(hdr->srcPort),
+        .irs = ntol(hdr->sequence) };
+    parse_options(hdr, sz, &h.opts);
+
+    // the cookie doubles as our initial sequence, so a half open entry
+    // that gets pushed out can still complete
+    h.iss = syncookie_make(dev->ip, srcIp, dst, h.remotePort, h.irs,
+            h.opts.mss ? h.opts.mss : DefaultMss);
+
+    uint64_t now = timer_ticks();
+    half_open * slot = NULL;
+    for (int i = 0; i < SynBacklog; i++) {
+        half_open * e = &l->backlog[i];
+        if (e->dev && e->expires <= now) e->dev = NULL;
+
+        if (e->dev == dev && e->remoteAddr == srcIp && e->remotePort == h.remotePort) {
+            slot = e; // a retransmitted syn
+            break;
+        }
+        if (!e->dev && !slot) slot = e;
+    }
+
+    if (slot) {
+        h.expires = now + SynReceivedTimeoutMs * TIMER_HZ / 1000;
+        *slot = h;
     }
     else {
-        tcp_read_fn fn = l->accept();
-        connected(dev, dst, ntos(hdr->srcPort), srcIp, ntol(hdr->sequence), fn);
+        // backlog full: the cookie is all we keep, so only offer what it encodes
+        h.opts.wscale = NoWindowScale;
+        h.opts.sackOk = h.opts.tsOk = 0;
     }
+
+    send_synack(dst, &h);
+}
+
+static stream * complete_handshake(struct netdevice * dev, tcp_hdr * hdr, uint32_t srcIp) {
+    if ((hdr->flags & (Syn | Rst | Ack)) != Ack) return NULL;
+
+    listen_state * l = find_listener(ntos(hdr->destPort));
+    if (l == NULL) return NULL;
+
+    uint16_t remotePort = ntos(hdr->srcPort);
+    uint32_t iss = ntol(hdr->ack) - 1;
+
+    for (int i = 0; i < SynBacklog; i++) {
+        half_open * e = &l->backlog[i];
+        if (e->dev == dev && e->remoteAddr == srcIp &&
+                e->remotePort == remotePort && e->iss == iss) {
+            half_open h = *e;
+            e->dev = NULL;
+            return connected(l, &h);
+        }
+    }
+
+    uint32_t irs = ntol(hdr->sequence) - 1;
+    uint16_t mss = syncookie_check(dev->ip, srcIp, l->port, remotePort, irs, iss);
+    if (!mss) return NULL;
+
+    half_open h = {
+        .dev = dev, .remoteAddr = srcIp, .remotePort = remotePort,
+        .irs = irs, .iss = iss,
+        .opts = { .mss = mss, .wscale = NoWindowScale } };
+    return connected(l, &h);
 }
 
 int tcp_listen(uint16_t port, tcp_read_fn (*accept)()) {
@@ -309,6 +929,7 @@ int tcp_listen(uint16_t port, tcp_read_fn (*accept)()) {
     }
 
     l = kmem_alloc(sizeof(listen_state));
+    bzero(l, sizeof(listen_state));
     l->next = all_listeners;
     all_listeners = l;
     l->port = port;
@@ -318,30 +939,90 @@ int tcp_listen(uint16_t port, tcp_read_fn (*accept)()) {
 }
 
 
+// returns non-zero if the segment belonged to the old connection
+static int timewait_segment(struct netdevice * dev, timewait * tw, tcp_hdr * hdr) {
+    uint32_t seq = ntol(hdr->sequence);
+
+    // a new connection may reuse the quad once it's clearly past the old one
+    if ((hdr->flags & (Syn | Ack)) == Syn && seq_lt(tw->rcvNxt, seq)) {
+        timewait_remove(tw);
+        return 0;
+    }
+
+    // their fin again: our ack was lost
+    if (hdr->flags & Fin) {
+        stream s = {
+            .dev = dev,
+            .localPort = tw->localPort, .localAddr = tw->localAddr,
+            .remotePort = tw->remotePort, .remoteAddr = tw->remoteAddr,
+            .localSeq = tw->sndNxt, .ackSeq = tw->rcvNxt,
+            .sndWscale = NoWindowScale,
+            .needsAck = 1 };
+        send_segment(&s, 0, NULL, 0);
+    }
+
+    return 1;
+}
+
 void tcp_segment(struct netdevice *dev, const uint8_t* data, uint32_t sz, uint32_t srcIp) {
     tcp_hdr * hdr = (tcp_hdr*)data;
+    stream * s = find(dev, srcIp, hdr);
 
-    if (hdr->flags & Syn) {
-        syn(dev, hdr, srcIp);
+    if (!s) {
+        timewait * tw = timewait_find(dev->ip, ntos(hdr->destPort), srcIp, ntos(hdr->srcPort));
+        if (tw && timewait_segment(dev, tw, hdr)) return;
     }
 
-    stream * s = find(dev, srcIp, hdr);
+    if ((hdr->flags & (Syn | Ack)) == Syn) {
+        if (s && s->state != LastAck && s->state != Closing && s->state != TimeWait) {
+            // not for an open connection, remind them where we are
+            s->needsAck = 1;
+            send_segment(s, 0, NULL, 0);
+            return;
+        }
+
+        // they're done with the old one, start afresh
+        if (s) remove_stream(s);
+        syn(dev, hdr, sz, srcIp);
+        return;
+    }
+
+    if (!s) s = complete_handshake(dev, hdr, srcIp);
     if (!s) {
-        reset_stream(dev, hdr, srcIp);
+        if (!(hdr->flags & Rst)) reset_stream(dev, hdr, sz, srcIp);
         return;
     }
 
+    tcp_opts opts;
+    parse_options(hdr, sz, &opts);
+    update_options(s, hdr, &opts);
+
     if (hdr->flags & Ack) {
-        acked(s, hdr);
+        if (acked(s, hdr)) return;
     }
 
-    buffer_data(dev, hdr, s, sz - hdr->offset * 4);
+    uint32_t len = sz - hdr->offset * 4;
+    if (buffer_data(dev, hdr, s, len)) {
+        // duplicate ack straight away so the sender sees the hole
+        send_segment(s, 0, NULL, 0);
+    }
 
     if (hdr->flags & Psh) {
+        uint32_t end = ntol(hdr->sequence) + len;
+        if (!s->pushHeld || seq_lt(s->pushSeq, end)) s->pushSeq = end;
+        s->pushHeld = 1;
+    }
+
+    // push only what's in order, and all of what the psh covered
+    if (s->pushHeld && seq_le(s->pushSeq, s->ackSeq)) {
+        s->pushHeld = 0;
         pushit(s);
     }
 
-    if (hdr->flags & Fin) {
-        fin(dev, s);
+    // only a fin that follows everything we've received counts
+    if ((hdr->flags & Fin) && ntol(hdr->sequence) + len == s->ackSeq) {
+        if (fin(dev, s)) return;
     }
+
+    schedule_ack(s);
 }
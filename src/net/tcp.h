@@ -17,13 +17,48 @@ typedef struct tcp_hdr_t {
     uint32_t options[];
 } tcp_hdr;
 
+// header flags, for those looking at segments from outside
+#define TcpFin 0x01
+#define TcpSyn 0x02
+#define TcpRst 0x04
+#define TcpPsh 0x08
+#define TcpAck 0x10
+
+// how much tcp_send holds beyond what the peer's window takes
+#define TcpSendBuffer 4096
+// the most a read callback is handed at once
+#define TcpReadBuffer 2048
+
 typedef struct stream_t stream;
 
 void tcp_segment(struct netdevice *dev, const uint8_t* data, uint32_t size, uint32_t ip);
 
+// Called with data == NULL and size 0 once the peer has closed its side;
+// the stream stays open for sending until tcp_close.
 typedef void (*tcp_read_fn)(stream*, const uint8_t*, uint32_t);
 
 int tcp_listen(uint16_t port, tcp_read_fn (*accept)(stream*));
-void tcp_send(stream *stream, const void* data, uint16_t sz);
+
+// Something of the application's to keep with the stream, handed to
+// `release` once the stream is gone.
+void tcp_set_user(stream *stream, void * user, void (*release)(void *));
+void * tcp_user(stream *stream);
+
+// Sends what the peer's window allows and holds the rest, up to a limit,
+// for when acks open it further. Returns how much was taken.
+uint32_t tcp_send(stream *stream, const void* data, uint32_t sz);
+// how much the next tcp_send would take
+uint32_t tcp_send_space(stream *stream);
+// called as acks make room, until it's set back to NULL
+typedef void (*tcp_writable_fn)(stream*);
+void tcp_set_writable(stream *stream, tcp_writable_fn fn);
+
+// For a reader that can't take more yet: what arrives is held, and the
+// window closes as it fills. Resuming hands over what's been held, then
+// the end of the stream if the peer has finished meanwhile.
+void tcp_pause(stream *stream);
+void tcp_resume(stream *stream);
+
+// The fin goes out once everything sent so far has.
 void tcp_close(stream *stream);
 
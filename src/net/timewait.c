@@ -0,0 +1,109 @@
+#include "net/timewait.h"
+#include "timer.h"
+
+#define TimeWaitSlots 512
+#define TimeWaitBuckets 128
+#define TimeWaitMs 60000
+
+// Every entry lives for the same time, so the slots are a ring in expiry
+// order: the oldest is at `oldest`, and a full table recycles it early.
+static timewait slots[TimeWaitSlots];
+static uint16_t buckets[TimeWaitBuckets];
+static uint32_t oldest;
+static uint32_t used;
+static uint32_t live;
+static timer expiry;
+
+static uint32_t bucket_for(uint32_t localAddr, uint16_t localPort,
+        uint32_t remoteAddr, uint16_t remotePort) {
+    uint32_t h = remoteAddr ^ localAddr ^ ((uint32_t)remotePort << 16 | localPort);
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+    return h % TimeWaitBuckets;
+}
+
+static void unhash(timewait * tw) {
+    uint16_t * p = &buckets[bucket_for(tw->localAddr, tw->localPort,
+            tw->remoteAddr, tw->remotePort)];
+    uint16_t me = tw - slots + 1;
+    while (*p && *p != me) p = &slots[*p - 1].next;
+    if (*p) *p = tw->next;
+
+    tw->live = 0;
+    live--;
+}
+
+static void expire(void * unused);
+
+static void arm() {
+    if (!used) return;
+    uint64_t now = timer_ticks();
+    uint64_t at = slots[oldest].expires;
+    uint32_t ms = at > now ? (at - now) * 1000 / TIMER_HZ : 0;
+    timer_start(&expiry, ms, expire, NULL);
+}
+
+static void drop_oldest() {
+    timewait * tw = &slots[oldest];
+    if (tw->live) unhash(tw);
+    oldest = (oldest + 1) % TimeWaitSlots;
+    used--;
+}
+
+static void expire(void * unused) {
+    uint64_t now = timer_ticks();
+    while (used && slots[oldest].expires <= now) {
+        drop_oldest();
+    }
+    arm();
+}
+
+void timewait_add(uint32_t localAddr, uint16_t localPort,
+        uint32_t remoteAddr, uint16_t remotePort,
+        uint32_t sndNxt, uint32_t rcvNxt) {
+    if (used == TimeWaitSlots) drop_oldest();
+
+    timewait * tw = &slots[(oldest + used) % TimeWaitSlots];
+    used++;
+    live++;
+
+    tw->localAddr = localAddr;
+    tw->localPort = localPort;
+    tw->remoteAddr = remoteAddr;
+    tw->remotePort = remotePort;
+    tw->sndNxt = sndNxt;
+    tw->rcvNxt = rcvNxt;
+    tw->expires = timer_ticks() + TimeWaitMs / 1000 * TIMER_HZ;
+    tw->live = 1;
+
+    uint16_t * bucket = &buckets[bucket_for(localAddr, localPort, remoteAddr, remotePort)];
+    tw->next = *bucket;
+    *bucket = tw - slots + 1;
+
+    if (!expiry.pending) arm();
+}
+
+timewait * timewait_find(uint32_t localAddr, uint16_t localPort,
+        uint32_t remoteAddr, uint16_t remotePort) {
+    uint16_t i = buckets[bucket_for(localAddr, localPort, remoteAddr, remotePort)];
+    while (i) {
+        timewait * tw = &slots[i - 1];
+        if (tw->remoteAddr == remoteAddr && tw->remotePort == remotePort &&
+                tw->localAddr == localAddr && tw->localPort == localPort) {
+            return tw;
+        }
+        i = tw->next;
+    }
+
+    return NULL;
+}
+
+void timewait_remove(timewait * tw) {
+    // the slot itself is reclaimed when its time comes round
+    if (tw->live) unhash(tw);
+}
+
+uint32_t timewait_count() {
+    return live;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "common.h"
+
+// Connections we closed first linger here for 2MSL instead of as streams.
+
+typedef struct timewait_t {
+    uint32_t localAddr;
+    uint32_t remoteAddr;
+    uint16_t localPort;
+    uint16_t remotePort;
+    uint32_t sndNxt;
+    uint32_t rcvNxt;
+    uint64_t expires;
+    uint16_t next;      // hash chain, slot + 1, 0 terminated
+    uint8_t live;
+} timewait;
+
+void timewait_add(uint32_t localAddr, uint16_t localPort,
+        uint32_t remoteAddr, uint16_t remotePort,
+        uint32_t sndNxt, uint32_t rcvNxt);
+
+timewait * timewait_find(uint32_t localAddr, uint16_t localPort,
+        uint32_t remoteAddr, uint16_t remotePort);
+
+void timewait_remove(timewait * tw);
+
+uint32_t timewait_count();
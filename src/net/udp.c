@@ -3,8 +3,8 @@
 #include "net/ip.h"
 #include "net/sbuff.h"
 #include "errno.h"
-#include "util/list.h"
 #include "memory.h"
+#include "task.h"
 
 typedef struct udp_header_t {
     uint16_t srcPort;
@@ -13,81 +13,210 @@ typedef struct udp_header_t {
     uint16_t chksum;
 } udp_header;
 
-typedef struct udp_listening_port {
+#define UdpBuckets 256
+#define UdpQueueLen 64
+
+// Datagrams wait in the socket's queue; those with a callback get it run
+// from a task, so the receive path only ever copies and enqueues.
+typedef struct udp_socket_t {
+    struct udp_socket_t * next;         // hash chain
+    struct udp_socket_t * nextReady;
     uint16_t port;
+    uint8_t ready;
     udp_notify cb;
-} udp_listening_port;
+    uint16_t head;
+    uint16_t count;
+    uint32_t drops;
+    udp_msg * queue[UdpQueueLen];
+} udp_socket;
 
-static list_t listening_ports;
+static udp_socket * sockets[UdpBuckets];
+static udp_socket * ready;
 
-static sbuff* udp_sbuff_alloc(uint32_t size) {
-    sbuff * p = ip_sbuff_alloc(size
-                    + sizeof(udp_header));
+static void deliver(void * unused);
+static Task deliver_task = {.task = deliver, .refs = 1};
 
-    sbuff_push(p, sizeof(udp_header));
-    return p;
+static inline udp_socket ** bucket_for(uint16_t port) {
+    return &sockets[(port ^ port >> 8) % UdpBuckets];
 }
 
-static int do_send(sbuff * sb, uint16_t len,
-        uint16_t dstPort, uint32_t dstIp,
-        uint16_t srcPort, struct netdevice* dev) {
-
-    sbuff_pop(sb, sizeof(udp_header));
-    udp_header  * hdr = (udp_header*)sb->head;
-    hdr->srcPort = ntos(srcPort);
-    hdr->destPort = ntos(dstPort);
-    hdr->len = ntos(len);
-    checksum(hdr, len, &hdr->chksum); // TODO udp checksum fix needed
+static udp_socket * find(uint16_t port) {
+    udp_socket * s = *bucket_for(port);
+    while (s && s->port != port) s = s->next;
+    return s;
+}
 
-    ip_send(sb, 17, dstIp, dev);
+static udp_msg * dequeue(udp_socket * s) {
+    udp_msg * m = s->queue[s->head];
+    s->head = (s->head + 1) % UdpQueueLen;
+    s->count--;
+    return m;
+}
 
-    return EOK;
+static void deliver(void * unused) {
+    while (ready) {
+        udp_socket * s = ready;
+        ready = s->nextReady;
+        s->ready = 0;
+
+        // only what's there now; anything arriving meanwhile reschedules
+        uint16_t port = s->port;
+        for (uint16_t n = s->count; n && s && s->count && s->cb; n--) {
+            udp_msg * m = dequeue(s);
+            s->cb(&m->quad, m->data, m->len);
+            kmem_free(m);
+
+            // the callback may have closed it, or read the rest itself
+            s = find(port);
+        }
+    }
 }
 
-void udp_datagram(struct netdevice* dev, const uint8_t * data, uint32_t srcIp) {
+#define UdpMaxBatch 32
+
+void udp_datagram(struct netdevice* dev, const uint8_t * data, uint32_t size, uint32_t srcIp) {
     const udp_header * udp = (const udp_header*)data;
+    uint16_t ulen = ntos(udp->len);
+    if (size < sizeof(udp_header) || ulen < sizeof(udp_header) || ulen > size) return;
 
-    list_node * node;
-    LIST_FOREACH(listening_ports, node) {
-        udp_listening_port* p = node->payload;
-        if (ntos(udp->destPort) == p->port) {
-            udp_quad quad;
-            quad.dst_port = ntos(udp->destPort);
-            quad.dst_addr = ntol(dev->ip);
-            quad.src_port = ntos(udp->srcPort);
-            quad.src_addr = srcIp;
-
-            p->cb(&quad, data + sizeof(udp), ntos(udp->len));
-        }
+    // zero means the sender didn't bother
+    if (udp->chksum &&
+            csum_fold(csum_partial(data, ulen, csum_pseudo(srcIp, dev->ip, IPPROTO_UDP, ulen)))) {
+        return;
+    }
+
+    udp_socket * s = find(ntos(udp->destPort));
+    if (!s) return;
+
+    if (s->count == UdpQueueLen) {
+        s->drops++;
+        return;
+    }
+
+    uint32_t len = ulen - sizeof(udp_header);
+    udp_msg * m = kmem_alloc(sizeof(udp_msg) + len);
+    m->quad.dst_port = ntos(udp->destPort);
+    m->quad.dst_addr = ntol(dev->ip);
+    m->quad.src_port = ntos(udp->srcPort);
+    m->quad.src_addr = srcIp;
+    m->len = len;
+    memcpy(m->data, data + sizeof(udp_header), len);
+
+    s->queue[(s->head + s->count) % UdpQueueLen] = m;
+    s->count++;
+
+    if (s->cb && !s->ready) {
+        s->ready = 1;
+        s->nextReady = ready;
+        ready = s;
+        task_enqueue(&deliver_task);
     }
 }
 
 int udp_listen(int port, udp_notify on_read) {
-    udp_listening_port * l = kmem_alloc(sizeof(udp_listening_port));
-    l->cb = on_read;
-    l->port = port;
+    if (port <= 0 || port > 0xffff) return EINVALID;
+    if (find(port)) return EADDRINUSE;
 
-    list_append(&listening_ports, l);
+    udp_socket * s = kmem_alloc(sizeof(udp_socket));
+    bzero(s, sizeof(udp_socket));
+    s->cb = on_read;
+    s->port = port;
+
+    udp_socket ** bucket = bucket_for(port);
+    s->next = *bucket;
+    *bucket = s;
 
     return EOK;
 }
 
-#include "console.h"
+int udp_bind(int port) {
+    return udp_listen(port, NULL);
+}
 
-int udp_send(udp_quad* quad, const uint8_t* data, uint32_t size) {
-    sbuff * sb = udp_sbuff_alloc(size);
-    memcpy(sb->head, data, size);
+int udp_recvmmsg(int port, udp_msg ** msgs, int max) {
+    udp_socket * s = find(port);
+    if (!s) return ENOTFOUND;
 
-    struct netdevice * dev = ip_resolve_local(quad->src_addr);
-    if (! dev) return EINVALID;
+    int n = 0;
+    while (n < max && s->count) {
+        msgs[n++] = dequeue(s);
+    }
+    return n;
+}
+
+uint32_t udp_drops(int port) {
+    udp_socket * s = find(port);
+    return s ? s->drops : 0;
+}
+
+void udp_close(int port) {
+    udp_socket ** p = bucket_for(port);
+    while (*p && (*p)->port != port) p = &(*p)->next;
+    udp_socket * s = *p;
+    if (!s) return;
+    *p = s->next;
+
+    if (s->ready) {
+        udp_socket ** r = &ready;
+        while (*r != s) r = &(*r)->nextReady;
+        *r = s->nextReady;
+    }
+
+    while (s->count) kmem_free(dequeue(s));
+    kmem_free(s);
+}
+
+static sbuff * build(const udp_quad * quad, struct netdevice * dev, const uint8_t * data, uint32_t size) {
+    uint16_t len = size + sizeof(udp_header);
+    sbuff * sb = ip_sbuff_alloc(len);
+    udp_header * hdr = (udp_header*)sb->head;
 
-    sbuff_pop(sb, sizeof(udp_header));
-    udp_header  * hdr = (udp_header*)sb->head;
     hdr->srcPort = ntos(quad->src_port);
     hdr->destPort = ntos(quad->dst_port);
-    hdr->len = ntos(size);
-    checksum(hdr, size, &hdr->chksum); // TODO udp checksum fix needed
+    hdr->len = ntos(len);
+
+    uint32_t sum = csum_pseudo(dev->ip, quad->dst_addr, IPPROTO_UDP, len);
+    if (dev->features & NetdevTxCsum) {
+        memcpy(sb->head + sizeof(udp_header), data, size);
+        hdr->chksum = ~csum_fold(sum);
+        sbuff_csum_partial(sb, hdr, &hdr->chksum);
+        return sb;
+    }
 
-    return ip_send(sb, 17, quad->dst_addr, dev);
+    // the payload is summed as it's copied in
+    sum = csum_copy(sb->head + sizeof(udp_header), data, size, sum);
+    hdr->chksum = 0;
+    hdr->chksum = csum_fold(csum_partial(hdr, sizeof(udp_header), sum));
+    if (!hdr->chksum) hdr->chksum = 0xffff;
+
+    return sb;
 }
 
+int udp_sendmmsg(const udp_quad* quad, const udp_buf* bufs, int count) {
+    struct netdevice * dev = ip_resolve_local(quad->src_addr);
+    if (! dev) return EINVALID;
+
+    for (int i = 0; i < count; i++) {
+        if (bufs[i].len > 0xffff - sizeof(udp_header) - 20) return EINVALID;
+    }
+
+    sbuff * batch[UdpMaxBatch];
+    for (int done = 0; done < count; ) {
+        uint16_t n = count - done < UdpMaxBatch ? count - done : UdpMaxBatch;
+        for (uint16_t i = 0; i < n; i++) {
+            batch[i] = build(quad, dev, bufs[done + i].data, bufs[done + i].len);
+        }
+
+        int rc = ip_send_batch(batch, n, IPPROTO_UDP, quad->dst_addr, dev);
+        if (rc != EOK) return done ? done : rc;
+        done += n;
+    }
+
+    return count;
+}
+
+int udp_send(udp_quad* quad, const uint8_t* data, uint32_t size) {
+    udp_buf buf = {data, size};
+    int rc = udp_sendmmsg(quad, &buf, 1);
+    return rc < 0 ? rc : EOK;
+}
@@ -3,7 +3,7 @@
 #include "net/device.h"
 #include "common.h"
 
-void udp_datagram(struct netdevice* dev, const uint8_t * data, uint32_t srcIp);
+void udp_datagram(struct netdevice* dev, const uint8_t * data, uint32_t size, uint32_t srcIp);
 
 typedef struct udp_quad {
     uint32_t src_addr;
@@ -13,6 +13,35 @@ typedef struct udp_quad {
     uint16_t dst_port;
 } udp_quad;
 
+typedef struct udp_msg_t {
+    udp_quad quad;
+    uint32_t len;
+    uint8_t data[];
+} udp_msg;
+
 typedef void (*udp_notify)(const udp_quad* quad, const uint8_t* data, uint32_t size);
+
+// Datagrams for `port` are queued and handed to `on_read` from a task.
 int udp_listen(int port, udp_notify on_read);
+
+// Queue datagrams for `port` until read with udp_recvmmsg.
+int udp_bind(int port);
+
+// Takes up to `max` queued datagrams, returning how many; each is the
+// caller's to kmem_free.
+int udp_recvmmsg(int port, udp_msg ** msgs, int max);
+
+// datagrams dropped because the queue was full
+uint32_t udp_drops(int port);
+void udp_close(int port);
+
+typedef struct udp_buf_t {
+    const uint8_t * data;
+    uint32_t len;
+} udp_buf;
+
 int udp_send(udp_quad* quad, const uint8_t* data, uint32_t size);
+
+// Sends each of `bufs` as its own datagram on `quad`, returning how many
+// went or an error if none did.
+int udp_sendmmsg(const udp_quad* quad, const udp_buf* bufs, int count);
@@ -69,3 +69,44 @@ void register_pci_device(uint16_t vendor, uint16_t device, pci_init_fn fn) {
         }
     }
 }
+
+uint32_t pci_config_read(const pci_device * dev, uint8_t offset) {
+    return readPciConfig(dev->bus, dev->slot, dev->func, offset);
+}
+
+void pci_config_write(const pci_device * dev, uint8_t offset, uint32_t value) {
+    uint32_t address = (dev->bus << 16) | (dev->slot << 11) | (dev->func << 8) | (1 << 31) | (offset & 0xfc);
+
+    outl(0xcf8, address);
+    outl(0xcfc, value);
+}
+
+uint64_t pci_bar(const pci_device * dev, uint8_t bar, int * io) {
+    uint32_t lo = pci_config_read(dev, 0x10 + bar * 4);
+    *io = lo & 1;
+    if (*io) return lo & ~3;
+
+    uint64_t addr = lo & ~0xf;
+    if (((lo >> 1) & 3) == 2) { // 64 bit
+        addr |= (uint64_t)pci_config_read(dev, 0x14 + bar * 4) << 32;
+    }
+    return addr;
+}
+
+void register_pci_dma_device(uint16_t vendor, uint16_t device, pci_dma_init_fn fn) {
+    for(uint16_t slot = 0; slot < 32; slot++) {
+        uint32_t vendev = readPciConfig(0, slot, 0, 0);
+        if (vendev == (device << 16 | vendor)) {
+            pci_device dev = {
+                .bus = 0, .slot = slot, .func = 0,
+                .intr = readPciConfig(0, slot, 0, 0x3c),
+                .vendor = vendor, .device = device };
+
+            // io space, memory space, bus master
+            uint32_t cmd = pci_config_read(&dev, 0x4) & 0xffff;
+            pci_config_write(&dev, 0x4, cmd | 0x7);
+
+            fn(&dev);
+        }
+    }
+}
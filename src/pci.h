@@ -6,3 +6,24 @@ typedef void (*pci_init_fn)(uint8_t, uint32_t);
 
 void init_pci();
 void register_pci_device(uint16_t vendor, uint16_t device, pci_init_fn);
+
+// Devices that do their own DMA get the whole function, so they can find
+// their BARs and capabilities, and are made bus masters first.
+typedef struct pci_device_t {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+    uint8_t intr;
+    uint16_t vendor;
+    uint16_t device;
+} pci_device;
+
+typedef void (*pci_dma_init_fn)(const pci_device *);
+
+void register_pci_dma_device(uint16_t vendor, uint16_t device, pci_dma_init_fn);
+
+uint32_t pci_config_read(const pci_device * dev, uint8_t offset);
+void pci_config_write(const pci_device * dev, uint8_t offset, uint32_t value);
+
+// Address of BAR `bar`, 64 bit BARs included. Sets `io` for port BARs.
+uint64_t pci_bar(const pci_device * dev, uint8_t bar, int * io);
@@ -0,0 +1,68 @@
+#include "service/capture.h"
+
+#include "net/udp.h"
+#include "net/pcap.h"
+#include "errno.h"
+
+#include "console.h"
+
+#define CapturePort 2003
+#define CaptureRing (16 * 1024)
+#define CaptureChunk 1400   // keeps each datagram in one frame
+
+typedef struct {
+    udp_quad reply;
+    uint8_t buf[CaptureChunk];
+    uint32_t len;
+} dump;
+
+static void flush(dump * d) {
+    if (!d->len) return;
+    if (EOK != udp_send(&d->reply, d->buf, d->len)) {
+        warn("Could not send capture.");
+    }
+    d->len = 0;
+}
+
+static void dump_write(void * user, const void * data, uint32_t len) {
+    dump * d = (dump*) user;
+    const uint8_t * p = (const uint8_t*) data;
+    while (len) {
+        uint32_t n = CaptureChunk - d->len < len ? CaptureChunk - d->len : len;
+        memcpy(d->buf + d->len, p, n);
+        d->len += n;
+        p += n;
+        len -= n;
+        if (d->len == CaptureChunk) flush(d);
+    }
+}
+
+static int is(const uint8_t * data, uint32_t sz, const char * cmd) {
+    uint32_t n = strlen(cmd);
+    // let a trailing newline through, as from echo
+    return (sz == n || (sz == n + 1 && data[n] == '\n')) && !memcmp(data, cmd, n);
+}
+
+static void capture_notify(const udp_quad * quad, const uint8_t * data, uint32_t sz) {
+    if (is(data, sz, "start")) {
+        if (EOK != pcap_start(CaptureRing)) warn("Cannot start capture.");
+    }
+    else if (is(data, sz, "stop")) {
+        pcap_stop();
+    }
+    else if (is(data, sz, "dump")) {
+        static dump d;
+        d.reply = (udp_quad) {
+            .src_port = quad->dst_port, .src_addr = quad->dst_addr,
+            .dst_port = quad->src_port, .dst_addr = quad->src_addr };
+        d.len = 0;
+        pcap_export(dump_write, &d);
+        flush(&d);
+    }
+}
+
+void init_capture() {
+    if (EOK != udp_listen(CapturePort, capture_notify)) {
+        warn("Cannot listen on port 2003 for capture");
+    }
+}
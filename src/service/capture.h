@@ -0,0 +1,7 @@
+#pragma once
+
+// Packet capture, driven over UDP port 2003: "start" begins mirroring
+// frames into a ring, "stop" throws it away, and "dump" sends it back as
+// a pcap file cut into datagrams, e.g.
+//   echo dump | nc -u -w1 <host> 2003 > out.pcap
+void init_capture();
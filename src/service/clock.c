@@ -2,8 +2,8 @@
 
 #include "common.h"
 #include "rtc.h"
-#include "interrupt.h"
 #include "task.h"
+#include "timer.h"
 #include "entry.h"
 
 static void update_clock(void* unused) {
@@ -29,19 +29,17 @@ static void update_clock(void* unused) {
     }
 }
 
-static void timer_irq(registers_t* regs, void *update_task) {
-    read_rtc();
-    task_enqueue((Task*)update_task);
-}
+static timer clock_timer;
 
 static void user_task(void * fn) {
+    read_rtc();
     update_clock(0);
     // call_user_function(fn);
+
+    timer_start(&clock_timer, 250, user_task, fn);
 }
 
 void init_clock() {
-    //enable the timer and display a clock
-    Task * update_task = task_alloc(user_task, update_clock);
-    add_ref(update_task);
-    register_interrupt_handler(IRQ0, timer_irq, update_task);
+    // display a clock, refreshed from the rtc a few times a second
+    user_task(update_clock);
 }
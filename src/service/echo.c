@@ -7,6 +7,11 @@
 #include "console.h"
 
 static void tcp_echo_read(stream* stream, const uint8_t* data, uint32_t sz) {
+    if (!data) {
+        tcp_close(stream);
+        return;
+    }
+
     tcp_send(stream, data, sz);
 }
 
@@ -1,45 +1,522 @@
+#include "service/http.h"
+#include "service/http_cache.h"
+#include "service/http_route.h"
 #include "net/tcp.h"
 
 #include "errno.h"
 #include "console.h"
 #include "memory.h"
+#include "timer.h"
 #include "fs/vfs.h"
 
-static void http_read(stream * stream, const uint8_t* request, uint32_t size) {
-    // console_print_string((const char*)request);
+#define HttpMaxHead 1024    // request line and headers
+#define HttpIdleMs 15000
+#define HttpChunk 1024      // read from a file at a time
 
-    const char* h1 =  "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: ";
-    static const char* seperator =  "\r\n\r\n";
-    static uint32_t sep_size = 4;
+// A persistent connection. Requests may come split across segments or
+// several to a segment; they're answered in order as each head completes,
+// each once the one before has all gone to the send buffer. Reading
+// pauses meanwhile, so what's buffered never outgrows buf.
+struct http_conn_t {
+    stream * stream;
+    timer idle;
+    uint8_t closing;
+    uint8_t head;           // the request being answered is a HEAD
+    uint32_t skip;          // request body still to pass over
+    uint32_t scanned;       // no blank line before here
+    uint32_t len;
+    char buf[HttpMaxHead + TcpReadBuffer];  // a partial head and a read
 
-    char body[256];
-    int count = read("HELLO~1.HTM", body, sizeof(body));
-    if (count < 0) {
-        warn("Cannot load HELLO~1.HTM");
+    // what the send buffer couldn't take yet, fed in as acks make room:
+    // first from memory, kept by one of entry or owned, then from a file
+    const char * from;
+    uint32_t fromLen;
+    http_cached * entry;
+    char * owned;
+    const char * file;
+    uint32_t offset;
+    uint32_t fileLen;
+};
+
+static char lower(char c) {
+    return c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c;
+}
+
+// case blind comparison with a lower case literal
+static int is(const char * s, uint32_t n, const char * lit) {
+    if (n != strlen(lit)) return 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (lower(s[i]) != lit[i]) return 0;
+    }
+    return 1;
+}
+
+static int has_token(const char * s, uint32_t n, const char * lit) {
+    while (n) {
+        while (n && (*s == ' ' || *s == '\t' || *s == ',')) s++, n--;
+        uint32_t t = 0;
+        while (t < n && s[t] != ',' && s[t] != ' ' && s[t] != '\t') t++;
+        if (t && is(s, t, lit)) return 1;
+        s += t;
+        n -= t;
+    }
+    return 0;
+}
+
+// `want` is one of a comma separated list
+static int has_exact(const char * s, uint32_t n, const char * want) {
+    uint32_t w = strlen(want);
+    while (n) {
+        while (n && (*s == ' ' || *s == '\t' || *s == ',')) s++, n--;
+        uint32_t t = 0;
+        while (t < n && s[t] != ',') t++;
+        uint32_t end = t;
+        while (end && (s[end - 1] == ' ' || s[end - 1] == '\t')) end--;
+        if (end == w && !memcmp(s, want, w)) return 1;
+        s += t;
+        n -= t;
+    }
+    return 0;
+}
+
+// Returns the length of the request head, blank line included, or 0 if
+// it isn't all here yet. Bare newlines are let through as well as CRLF.
+static uint32_t head_length(http_conn * c) {
+    uint32_t i = c->scanned > 1 ? c->scanned : 1;
+    for (; i < c->len; i++) {
+        if (c->buf[i] != '\n') continue;
+        if (c->buf[i - 1] == '\n') return i + 1;
+        if (i > 1 && c->buf[i - 1] == '\r' && c->buf[i - 2] == '\n') return i + 1;
+    }
+    c->scanned = i;
+    return 0;
+}
+
+// the next line of `len` from `p`, without its line ending
+static const char * line(const char * p, const char * end, uint32_t * len) {
+    const char * nl = p;
+    while (nl < end && *nl != '\n') nl++;
+    *len = nl - p;
+    if (*len && p[*len - 1] == '\r') (*len)--;
+    return nl < end ? nl + 1 : end;
+}
+
+static int parse_request_line(const char * s, uint32_t n, http_request * req) {
+    const char * end = s + n;
+    const char * sp = s;
+    while (sp < end && *sp != ' ') sp++;
+    if (sp == s || sp == end) return EINVALID;
+    req->method = s;
+    req->methodLen = sp - s;
+
+    s = sp + 1;
+    sp = s;
+    while (sp < end && *sp != ' ') sp++;
+    if (sp == s || sp == end) return EINVALID;
+    req->target = s;
+    req->targetLen = sp - s;
+
+    req->path = s;
+    req->pathLen = req->targetLen;
+    for (uint32_t i = 0; i < req->targetLen; i++) {
+        if (s[i] != '?') continue;
+        req->pathLen = i;
+        req->query = s + i + 1;
+        req->queryLen = req->targetLen - i - 1;
+        break;
+    }
+
+    // 1.1 stays open unless told otherwise, 1.0 only if asked
+    s = sp + 1;
+    if (end - s != 8 || strncmp(s, "HTTP/1.", 7)) return EINVALID;
+    if (s[7] == '1') req->keepAlive = 1;
+    else if (s[7] != '0') return EINVALID;
+
+    return EOK;
+}
+
+static int parse_header(const char * s, uint32_t n, http_request * req) {
+    const char * colon = s;
+    while (colon < s + n && *colon != ':') colon++;
+    if (colon == s || colon == s + n) return EINVALID;
+
+    uint32_t nameLen = colon - s;
+    const char * value = colon + 1;
+    uint32_t valueLen = s + n - value;
+    while (valueLen && (*value == ' ' || *value == '\t')) value++, valueLen--;
+
+    if (is(s, nameLen, "connection")) {
+        if (has_token(value, valueLen, "close")) req->keepAlive = 0;
+        if (has_token(value, valueLen, "keep-alive")) req->keepAlive = 1;
+    }
+    else if (is(s, nameLen, "content-length")) {
+        req->contentLength = 0;
+        for (uint32_t i = 0; i < valueLen; i++) {
+            if (value[i] < '0' || value[i] > '9') return EINVALID;
+            req->contentLength = req->contentLength * 10 + value[i] - '0';
+        }
+    }
+    else if (is(s, nameLen, "transfer-encoding")) {
+        req->chunked = 1;
+    }
+    else if (is(s, nameLen, "if-none-match")) {
+        req->ifNoneMatch = value;
+        req->ifNoneMatchLen = valueLen;
+    }
+    else if (is(s, nameLen, "if-modified-since")) {
+        req->ifModifiedSince = value;
+        req->ifModifiedSinceLen = valueLen;
+    }
+
+    return EOK;
+}
+
+static int parse(const char * head, uint32_t len, http_request * req) {
+    bzero(req, sizeof(*req));
+    const char * end = head + len;
+
+    uint32_t n;
+    const char * next = line(head, end, &n);
+    if (EOK != parse_request_line(head, n, req)) return EINVALID;
+
+    for (const char * p = next; p < end; p = next) {
+        next = line(p, end, &n);
+        if (!n) break;
+        if (EOK != parse_header(p, n, req)) return EINVALID;
+    }
+
+    return EOK;
+}
+
+static char * append(char * p, const char * s) {
+    uint32_t n = strlen(s);
+    memcpy(p, s, n);
+    return p + n;
+}
+
+static int pending(http_conn * c) {
+    return c->fromLen || c->fileLen;
+}
+
+static void sent_all(http_conn * c) {
+    if (c->entry) http_cache_release(c->entry);
+    if (c->owned) kmem_free(c->owned);
+    c->entry = NULL;
+    c->owned = NULL;
+    c->fromLen = 0;
+    c->file = NULL;
+    c->fileLen = 0;
+}
+
+// Gives the send buffer as much of what's waiting as it will take.
+// Returns non-zero once it's all gone.
+static int feed(http_conn * c) {
+    while (c->fromLen) {
+        uint32_t n = tcp_send(c->stream, c->from, c->fromLen);
+        if (!n) return 0;
+        c->from += n;
+        c->fromLen -= n;
+    }
+
+    while (c->fileLen) {
+        uint32_t want = c->fileLen < HttpChunk ? c->fileLen : HttpChunk;
+        if (tcp_send_space(c->stream) < want) return 0;
+
+        char chunk[HttpChunk];
+        int got = read_at(c->file, c->offset, chunk, want);
+        if (got <= 0) {
+            // too late to say so, the headers are gone: cut it short
+            c->closing = 1;
+            break;
+        }
+
+        tcp_send(c->stream, chunk, got);
+        c->offset += got;
+        c->fileLen -= got;
+    }
+
+    sent_all(c);
+    return 1;
+}
+
+// `data` is ours now, freed once sent
+static void send_owned(http_conn * c, char * data, uint32_t len) {
+    c->owned = data;
+    c->from = data;
+    c->fromLen = len;
+    feed(c);
+}
+
+static void send_cached(http_conn * c, http_cached * e, const char * data, uint32_t len) {
+    add_ref(e);
+    c->entry = e;
+    c->from = data;
+    c->fromLen = len;
+    feed(c);
+}
+
+static char * headers(char * p, http_conn * c, const char * status,
+        const char * contentType, uint32_t len) {
+    p = append(p, "HTTP/1.1 ");
+    p = append(p, status);
+    p = append(p, "\r\nContent-Type: ");
+    p = append(p, contentType);
+    p = append(p, "\r\nContent-Length: ");
+    p = to_str(len, p);
+    p = append(p, "\r\n");
+    if (c->closing) p = append(p, "Connection: close\r\n");
+    return append(p, "\r\n");
+}
+
+void http_respond(http_conn * c, const char * status, const char * contentType,
+        const char * body, uint32_t bodyLen) {
+    char * response = (char*) kmem_alloc(256 + bodyLen);
+    char * p = headers(response, c, status, contentType, bodyLen);
+    if (!c->head) {
+        memcpy(p, body, bodyLen);
+        p += bodyLen;
+    }
+
+    send_owned(c, response, p - response);
+}
+
+static void respond(http_conn * c, const char * status) {
+    http_respond(c, status, "text/html", "", 0);
+}
+
+// A prebuilt response is sent whole, unless it has to say we're closing.
+// `headLen` runs up to the blank line ending the headers.
+static void send_prebuilt(http_conn * c, http_cached * e, const char * data,
+        uint32_t headLen, uint32_t len) {
+    if (!c->closing) {
+        send_cached(c, e, data, len);
+        return;
+    }
+
+    static const char * close = "Connection: close\r\n\r\n";
+    char * response = (char*) kmem_alloc(len + strlen(close));
+    memcpy(response, data, headLen - 2);
+    char * p = append(response + headLen - 2, close);
+    memcpy(p, data + headLen, len - headLen);
+    p += len - headLen;
+
+    send_owned(c, response, p - response);
+}
+
+static int matches(const char * value, uint32_t len, const char * want) {
+    return len == strlen(want) && !memcmp(value, want, len);
+}
+
+// the client's copy is still good
+static int not_modified(const http_request * req, const http_cached * e) {
+    // an etag to compare trumps the date
+    if (req->ifNoneMatch) {
+        return matches(req->ifNoneMatch, req->ifNoneMatchLen, "*") ||
+            has_exact(req->ifNoneMatch, req->ifNoneMatchLen, e->etag);
+    }
+
+    return req->ifModifiedSince && e->lastModified[0] &&
+        matches(req->ifModifiedSince, req->ifModifiedSinceLen, e->lastModified);
+}
+
+static void serve_file(http_conn * c, const http_request * req, const http_route * r) {
+    http_cached * e = http_cache_get(r->file, strlen(r->file), r->file, r->contentType);
+    if (e) {
+        if (not_modified(req, e)) {
+            send_prebuilt(c, e, e->data + e->len, e->notModifiedLen, e->notModifiedLen);
+        }
+        else {
+            send_prebuilt(c, e, e->data, e->headLen, c->head ? e->headLen : e->len);
+        }
+        http_cache_release(e);
+        return;
+    }
+
+    // too big to keep, so it's read as it goes
+    file_info info;
+    if (EOK != stat(r->file, &info)) {
+        respond(c, "404 Not Found");
+        return;
+    }
+
+    if (!c->head) {
+        c->file = r->file;
+        c->offset = 0;
+        c->fileLen = info.size;
+    }
+
+    char * head = (char*) kmem_alloc(256);
+    char * p = headers(head, c, "200 OK", r->contentType, info.size);
+    send_owned(c, head, p - head);
+}
+
+static void serve(http_conn * c, const http_request * req) {
+    // methods are case sensitive
+    c->head = matches(req->method, req->methodLen, "HEAD");
+    if (!c->head && !matches(req->method, req->methodLen, "GET")) {
+        respond(c, "501 Not Implemented");
+        return;
+    }
+
+    const http_route * r = http_route_find(req->path, req->pathLen);
+    if (!r) {
+        respond(c, "404 Not Found");
+    }
+    else if (r->handler) {
+        r->handler(c, req);
+    }
+    else {
+        serve_file(c, req, r);
+    }
+}
+
+static void finish(http_conn * c) {
+    c->closing = 1;
+    timer_stop(&c->idle);
+    tcp_close(c->stream);
+}
+
+// closes once the last response has all gone to the send buffer
+static void done(http_conn * c) {
+    c->closing = 1;
+    if (!pending(c)) finish(c);
+}
+
+// answers every complete request buffered, leaving any partial one
+static void serve_all(http_conn * c) {
+    while (!c->closing && !c->skip && !pending(c)) {
+        uint32_t len = head_length(c);
+        if (!len) break;
+
+        http_request req;
+        c->head = 0;
+        if (EOK != parse(c->buf, len, &req) || req.chunked) {
+            // can't tell where the next one starts, so there isn't one
+            c->closing = 1;
+            respond(c, "400 Bad Request");
+            done(c);
+            return;
+        }
+
+        if (!req.keepAlive) c->closing = 1;
+        serve(c, &req);
+        if (c->closing) {
+            done(c);
+            return;
+        }
+
+        // we have no use for a body, but it mustn't be taken for a request
+        uint32_t body = c->len - len < req.contentLength ? c->len - len : req.contentLength;
+        c->skip = req.contentLength - body;
+        uint32_t used = len + body;
+
+        memmove(c->buf, c->buf + used, c->len - used);
+        c->len -= used;
+        c->scanned = 0;
+    }
+    if (c->closing) return;
+
+    // the rest waits until the response ahead of it has gone
+    if (pending(c)) {
+        tcp_pause(c->stream);
+        return;
+    }
+
+    // all that's left is the start of one request
+    if (c->len >= HttpMaxHead) {
+        c->closing = 1;
+        respond(c, "431 Request Header Fields Too Large");
+        done(c);
+        return;
+    }
+    tcp_resume(c->stream);
+}
+
+static void http_idle(void * user) {
+    http_conn * c = (http_conn*) user;
+    sent_all(c);
+    finish(c);
+}
+
+// acks have made room in the send buffer
+static void http_writable(stream * stream) {
+    http_conn * c = (http_conn*) tcp_user(stream);
+    if (!pending(c)) return;
+
+    timer_start(&c->idle, HttpIdleMs, http_idle, c);
+    if (!feed(c)) return;
+
+    if (c->closing) finish(c);
+    else serve_all(c);
+}
+
+static void http_read(stream * stream, const uint8_t* data, uint32_t size) {
+    http_conn * c = (http_conn*) tcp_user(stream);
+    if (!data) {
+        done(c);
         return;
     }
+    if (c->closing) return;
+
+    timer_start(&c->idle, HttpIdleMs, http_idle, c);
+
+    while (size) {
+        if (c->skip) {
+            uint32_t n = c->skip < size ? c->skip : size;
+            c->skip -= n;
+            data += n;
+            size -= n;
+            continue;
+        }
 
-    uint32_t total = count + strlen(h1) + sep_size * 2;
-    char * response = (char*) kmem_alloc(total);
-    strncpy(response, h1, strlen(h1));
-    char * next = to_str(count, response + strlen(h1));
-    strncpy(next, seperator, sep_size);
-    next += strlen(seperator);
-    strncpy(next, body, count);
-    strncpy(next + count, seperator, sep_size);
+        uint32_t n = sizeof(c->buf) - c->len < size ? sizeof(c->buf) - c->len : size;
+        if (!n) {
+            // nowhere to put it
+            done(c);
+            return;
+        }
+        memcpy(c->buf + c->len, data, n);
+        c->len += n;
+        data += n;
+        size -= n;
 
-    tcp_send(stream, response, total);
-    tcp_close(stream);
+        serve_all(c);
+        if (c->closing) return;
+    }
+}
 
-    kmem_free(response);
+static void http_release(void * user) {
+    http_conn * c = (http_conn*) user;
+    timer_stop(&c->idle);
+    sent_all(c);
+    kmem_free(c);
 }
 
 static tcp_read_fn http_accept(stream * stream) {
+    http_conn * c = (http_conn*) kmem_alloc(sizeof(http_conn));
+    bzero(c, sizeof(http_conn));
+    c->stream = stream;
+    tcp_set_user(stream, c, http_release);
+    tcp_set_writable(stream, http_writable);
+    timer_start(&c->idle, HttpIdleMs, http_idle, c);
+
     return http_read;
 }
 
+int http_listen(uint16_t port) {
+    return tcp_listen(port, http_accept);
+}
+
+static void health(http_conn * c, const http_request * req) {
+    http_respond(c, "200 OK", "text/plain", "ok\n", 3);
+}
+
 static void http_run() {
-    if (EOK != tcp_listen(80, http_accept)) {
+    http_route_file("/", "HELLO~1.HTM");
+    http_route_file("/index.html", "HELLO~1.HTM");
+    http_route_handler("/health", health);
+
+    if (EOK != http_listen(80)) {
         console_print_string("Failed to listen on port 80\n");
     }
 }
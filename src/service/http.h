@@ -1,3 +1,37 @@
 #pragma once
 
+#include "common.h"
+
 void init_http();
+
+// serve on another port as well
+int http_listen(uint16_t port);
+
+typedef struct http_conn_t http_conn;
+
+// A parsed request head. Everything points into the connection's buffer,
+// so it's only good until the handler returns.
+typedef struct http_request_t {
+    const char * method;
+    uint32_t methodLen;
+    const char * target;
+    uint32_t targetLen;
+    const char * path;          // the target up to any query
+    uint32_t pathLen;
+    const char * query;         // after the '?', or NULL
+    uint32_t queryLen;
+    uint8_t keepAlive;
+    uint8_t chunked;
+    uint32_t contentLength;
+    const char * ifNoneMatch;
+    uint32_t ifNoneMatchLen;
+    const char * ifModifiedSince;
+    uint32_t ifModifiedSinceLen;
+} http_request;
+
+// answers a request routed to it, with a single call to http_respond
+typedef void (*http_handler)(http_conn *, const http_request *);
+
+// The body is copied, and left off for a HEAD.
+void http_respond(http_conn * c, const char * status, const char * contentType,
+        const char * body, uint32_t len);
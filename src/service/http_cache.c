@@ -0,0 +1,189 @@
+#include "service/http_cache.h"
+
+#include "fs/vfs.h"
+#include "memory.h"
+#include "errno.h"
+
+static http_cached * entries[HttpCacheEntries];
+static uint32_t uses;
+
+static uint32_t hash_of(const char * s, uint32_t n) {
+    uint32_t h = 2166136261u;   // FNV-1a
+    for (uint32_t i = 0; i < n; i++) {
+        h = (h ^ (uint8_t)s[i]) * 16777619u;
+    }
+    return h;
+}
+
+static void entry_free(void * e) {
+    kmem_free(e);
+}
+
+void http_cache_release(http_cached * entry) {
+    release_ref(entry, entry_free);
+}
+
+static char * append(char * p, const char * s) {
+    uint32_t n = strlen(s);
+    memcpy(p, s, n);
+    return p + n;
+}
+
+static char * hex(char * p, uint32_t x) {
+    for (int shift = 28; shift >= 0; shift -= 4) {
+        *p++ = "0123456789abcdef"[(x >> shift) & 0xf];
+    }
+    return p;
+}
+
+static char * two_digits(char * p, uint32_t x) {
+    *p++ = '0' + x / 10 % 10;
+    *p++ = '0' + x % 10;
+    return p;
+}
+
+// RFC 7231's preferred form, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+static void http_date(uint32_t t, char * out) {
+    static const char * days = "ThuFriSatSunMonTueWed";
+    static const char * months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+    uint32_t z = t / 86400 + 719468;
+    uint32_t secs = t % 86400;
+    uint32_t weekday = t / 86400 % 7;
+
+    // civil from days, after Howard Hinnant
+    uint32_t era = z / 146097;
+    uint32_t doe = z - era * 146097;
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+    uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+    uint32_t year = yoe + era * 400 + (month <= 2);
+
+    char * p = out;
+    memcpy(p, days + 3 * weekday, 3);
+    p = append(p + 3, ", ");
+    p = two_digits(p, day);
+    *p++ = ' ';
+    memcpy(p, months + 3 * (month - 1), 3);
+    p += 3;
+    *p++ = ' ';
+    p = two_digits(p, year / 100);
+    p = two_digits(p, year);
+    *p++ = ' ';
+    p = two_digits(p, secs / 3600);
+    *p++ = ':';
+    p = two_digits(p, secs / 60 % 60);
+    *p++ = ':';
+    p = two_digits(p, secs % 60);
+    p = append(p, " GMT");
+    *p = 0;
+}
+
+// the validators both responses carry
+static char * validators(char * p, const http_cached * e) {
+    p = append(p, "ETag: ");
+    p = append(p, e->etag);
+    p = append(p, "\r\n");
+    if (e->lastModified[0]) {
+        p = append(p, "Last-Modified: ");
+        p = append(p, e->lastModified);
+        p = append(p, "\r\n");
+    }
+    return p;
+}
+
+static http_cached * load(const char * path, uint32_t pathLen, uint32_t hash,
+        const char * file, const char * contentType) {
+    file_info info = {0, 0};
+    if (EOK != stat(file, &info)) return NULL;
+    if (info.size > HttpCacheMaxBody) return NULL;
+
+    // room for both sets of headers around the body, in one allocation
+    uint32_t room = info.size + 512;
+    if (sizeof(http_cached) + room > kmem_largest()) return NULL;
+    http_cached * e = kmem_alloc(sizeof(http_cached) + room);
+    if (!e) return NULL;
+    bzero(e, sizeof(http_cached));
+
+    // read in behind room for the headers, which aren't known till after
+    char * body = e->data + 256;
+    int count = read(file, body, info.size);
+    if (count < 0) {
+        kmem_free(e);
+        return NULL;
+    }
+
+    e->hash = hash;
+    memcpy(e->path, path, pathLen);
+    e->pathLen = pathLen;
+
+    char * p = append(e->etag, "\"");
+    p = hex(p, hash_of(body, count));
+    p = append(p, "-");
+    p = hex(p, count);
+    append(p, "\"");
+    if (info.mtime) http_date(info.mtime, e->lastModified);
+
+    char head[256];
+    p = append(head, "HTTP/1.1 200 OK\r\nContent-Type: ");
+    p = append(p, contentType);
+    p = append(p, "\r\nContent-Length: ");
+    p = to_str(count, p);
+    p = append(p, "\r\n");
+    p = validators(p, e);
+    p = append(p, "\r\n");
+    e->headLen = p - head;
+
+    memcpy(e->data, head, e->headLen);
+    memmove(e->data + e->headLen, body, count);
+    e->len = e->headLen + count;
+
+    p = append(e->data + e->len, "HTTP/1.1 304 Not Modified\r\n");
+    p = validators(p, e);
+    p = append(p, "\r\n");
+    e->notModifiedLen = p - (e->data + e->len);
+
+    return e;
+}
+
+http_cached * http_cache_get(const char * path, uint32_t pathLen,
+        const char * file, const char * contentType) {
+    if (pathLen >= HttpCacheMaxPath) return NULL;
+
+    uint32_t hash = hash_of(path, pathLen);
+    http_cached ** victim = &entries[0];
+    for (int i = 0; i < HttpCacheEntries; i++) {
+        http_cached * e = entries[i];
+        if (!e) {
+            victim = &entries[i];
+            continue;
+        }
+
+        if (e->hash == hash && e->pathLen == pathLen && !memcmp(e->path, path, pathLen)) {
+            e->lastUsed = ++uses;
+            add_ref(e);
+            return e;
+        }
+
+        if (*victim && (int)(e->lastUsed - (*victim)->lastUsed) < 0) victim = &entries[i];
+    }
+
+    http_cached * e = load(path, pathLen, hash, file, contentType);
+    if (!e) return NULL;
+
+    // the least recently used makes way
+    if (*victim) http_cache_release(*victim);
+    *victim = e;
+    e->lastUsed = ++uses;
+    e->refs = 2;    // the cache's and the caller's
+    return e;
+}
+
+void http_cache_flush() {
+    for (int i = 0; i < HttpCacheEntries; i++) {
+        if (entries[i]) http_cache_release(entries[i]);
+        entries[i] = NULL;
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "common.h"
+
+#define HttpCacheEntries 32
+#define HttpCacheMaxPath 128
+#define HttpCacheMaxBody (16 * 1024)
+
+// A response ready to go: the 200 with its body, and a 304 after it for
+// clients that already have this version. Held by reference, so one can
+// still be sent from after it's been dropped from the cache.
+typedef struct http_cached_t {
+    uint32_t refs;
+    uint32_t hash;
+    uint32_t lastUsed;
+    char path[HttpCacheMaxPath];
+    uint16_t pathLen;
+
+    char etag[24];              // quoted, as it goes on the wire
+    char lastModified[32];      // empty if the file system doesn't know
+
+    uint32_t headLen;           // of the 200, up to and including the blank line
+    uint32_t len;               // the whole 200
+    uint32_t notModifiedLen;    // the 304, which follows at data + len
+    char data[];
+} http_cached;
+
+// Returns the response for `path`, building it from `file` first if it
+// isn't cached, or NULL if the file can't be had or is too big to keep.
+// Give it back with http_cache_release.
+http_cached * http_cache_get(const char * path, uint32_t pathLen,
+        const char * file, const char * contentType);
+void http_cache_release(http_cached * entry);
+
+// throw everything away, for when files change underneath
+void http_cache_flush();
@@ -0,0 +1,132 @@
+#include "service/http_route.h"
+
+#include "memory.h"
+#include "errno.h"
+
+// One path segment. Children hang off `child`, chained through `sibling`.
+typedef struct route_node_t {
+    struct route_node_t * child;
+    struct route_node_t * sibling;
+    http_route route;
+    uint32_t nameLen;
+    char name[];
+} route_node;
+
+static route_node root;
+
+static const struct {
+    const char * ext;
+    const char * type;
+} types[] = {
+    {"htm", "text/html"},
+    {"html", "text/html"},
+    {"txt", "text/plain"},
+    {"css", "text/css"},
+    {"js", "application/javascript"},
+    {"json", "application/json"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"ico", "image/x-icon"},
+    {"svg", "image/svg+xml"},
+};
+
+static char lower(char c) {
+    return c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c;
+}
+
+const char * http_content_type(const char * file) {
+    const char * dot = NULL;
+    for (const char * p = file; *p; p++) {
+        if (*p == '.') dot = p + 1;
+        if (*p == '/') dot = NULL;
+    }
+
+    if (dot) {
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            const char * a = dot;
+            const char * b = types[i].ext;
+            while (*a && *b && lower(*a) == *b) a++, b++;
+            if (!*a && !*b) return types[i].type;
+        }
+    }
+
+    return "application/octet-stream";
+}
+
+// the next segment of `len` from `*p`, leaving `*p` after it
+static const char * segment(const char ** p, const char * end, uint32_t * len) {
+    while (*p < end && **p == '/') (*p)++;
+    const char * s = *p;
+    while (*p < end && **p != '/') (*p)++;
+    *len = *p - s;
+    return s;
+}
+
+static route_node * child_of(route_node * parent, const char * name, uint32_t len) {
+    for (route_node * n = parent->child; n; n = n->sibling) {
+        if (n->nameLen == len && !memcmp(n->name, name, len)) return n;
+    }
+    return NULL;
+}
+
+static http_route * add(const char * path) {
+    if (*path != '/') return NULL;
+
+    const char * p = path;
+    const char * end = path + strlen(path);
+    route_node * node = &root;
+    while (1) {
+        uint32_t len;
+        const char * name = segment(&p, end, &len);
+        if (!len) break;
+
+        route_node * next = child_of(node, name, len);
+        if (!next) {
+            next = kmem_alloc(sizeof(route_node) + len);
+            bzero(next, sizeof(route_node));
+            memcpy(next->name, name, len);
+            next->nameLen = len;
+            next->sibling = node->child;
+            node->child = next;
+        }
+        node = next;
+    }
+
+    return &node->route;
+}
+
+int http_route_file(const char * path, const char * file) {
+    http_route * r = add(path);
+    if (!r) return EINVALID;
+
+    r->file = file;
+    r->contentType = http_content_type(file);
+    r->handler = NULL;
+    return EOK;
+}
+
+int http_route_handler(const char * path, http_handler handler) {
+    http_route * r = add(path);
+    if (!r) return EINVALID;
+
+    r->file = NULL;
+    r->contentType = NULL;
+    r->handler = handler;
+    return EOK;
+}
+
+const http_route * http_route_find(const char * path, uint32_t len) {
+    const char * p = path;
+    const char * end = path + len;
+    route_node * node = &root;
+    while (node) {
+        uint32_t n;
+        const char * name = segment(&p, end, &n);
+        if (!n) break;
+        node = child_of(node, name, n);
+    }
+
+    if (!node || (!node->route.file && !node->route.handler)) return NULL;
+    return &node->route;
+}
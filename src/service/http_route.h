@@ -0,0 +1,22 @@
+#pragma once
+
+#include "service/http.h"
+
+// What a path leads to: a file, with its type worked out when it was
+// added, or a function to answer for it.
+typedef struct http_route_t {
+    const char * file;
+    const char * contentType;
+    http_handler handler;
+} http_route;
+
+// Paths are matched a whole segment at a time, so "/a/b" and "/a/b/" are
+// the same route. A later route for a path replaces the earlier.
+int http_route_file(const char * path, const char * file);
+int http_route_handler(const char * path, http_handler handler);
+
+// the route for a path with any query already taken off, or NULL
+const http_route * http_route_find(const char * path, uint32_t len);
+
+// by the file's extension, application/octet-stream if it isn't known
+const char * http_content_type(const char * file);
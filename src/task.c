@@ -20,8 +20,15 @@ void task_enqueue_easy(tasklet t, void * user) {
     task_enqueue(task);
 }
 
+// Interrupt handlers enqueue too, so the list only changes with them off.
 void task_enqueue(Task * task) {
-    if (task->next || head == task) return; // already enqueued.
+    uint64_t flags = save_and_disable_interrupts();
+
+    // already enqueued; tail is only the last one while there's a head
+    if (task->next || head == task || (head && tail == task)) {
+        restore_interrupts(flags);
+        return;
+    }
 
     add_ref(task);
     if (!head) {
@@ -34,20 +41,19 @@ void task_enqueue(Task * task) {
     else {
         panic("Head without a tail");
     }
+    restore_interrupts(flags);
 }
 
 Task* task_get() {
-    if (head) {
-        disable_interrupts(); //replace with a proper lock
+    uint64_t flags = save_and_disable_interrupts();
 
-        Task * tmp = head;
-        head = head->next;
-        enable_interrupts();
+    Task * tmp = head;
+    if (tmp) {
+        head = tmp->next;
         tmp->next = NULL;
-        return tmp;
     }
-
-    return NULL;
+    restore_interrupts(flags);
+    return tmp;
 }
 
 void task_poll_for_work() {
@@ -0,0 +1,75 @@
+#include "timer.h"
+#include "interrupt.h"
+
+#define PIT_HZ 1193182
+
+static volatile uint64_t ticks;
+static timer * head;
+static volatile uint8_t queued;    // expire_task is waiting to run
+
+static void run_expired(void * unused);
+
+// never allocated, so hold a reference the task queue can't drop
+static Task expire_task = { .task = run_expired, .refs = 1 };
+
+uint64_t timer_ticks() {
+    return ticks;
+}
+
+void timer_tick() {
+    ticks++;
+    if (head && head->expires <= ticks && !queued) {
+        queued = 1;
+        task_enqueue(&expire_task);
+    }
+}
+
+static void remove_timer(timer * t) {
+    timer ** p = &head;
+    while (*p && *p != t) p = &(*p)->next;
+    if (*p) *p = t->next;
+    t->next = NULL;
+    t->pending = 0;
+}
+
+void timer_stop(timer * t) {
+    if (t->pending) remove_timer(t);
+}
+
+void timer_start(timer * t, uint32_t ms, tasklet fn, void * user) {
+    timer_stop(t);
+
+    uint32_t delay = (ms * TIMER_HZ + 999) / 1000;
+    t->expires = ticks + (delay ? delay : 1);
+    t->fn = fn;
+    t->user = user;
+    t->pending = 1;
+
+    // keep the list sorted so the tick only ever looks at the head
+    timer ** p = &head;
+    while (*p && (*p)->expires <= t->expires) p = &(*p)->next;
+    t->next = *p;
+    *p = t;
+}
+
+static void run_expired(void * unused) {
+    queued = 0;
+    while (head && head->expires <= ticks) {
+        timer * t = head;
+        remove_timer(t);
+        t->fn(t->user);
+    }
+}
+
+static void timer_irq(registers_t* regs, void * unused) {
+    timer_tick();
+}
+
+void init_timer() {
+    uint16_t divisor = PIT_HZ / TIMER_HZ;
+    outb(0x43, 0x36); // channel 0, lo/hi, square wave
+    outb(0x40, divisor & 0xff);
+    outb(0x40, divisor >> 8);
+
+    register_interrupt_handler(IRQ0, timer_irq, NULL);
+}
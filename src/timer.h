@@ -0,0 +1,23 @@
+#pragma once
+
+#include "common.h"
+#include "task.h"
+
+#define TIMER_HZ 100
+
+typedef struct timer_t {
+    struct timer_t * next;
+    uint64_t expires;
+    tasklet fn;
+    void * user;
+    uint8_t pending;
+} timer;
+
+void init_timer();
+
+uint64_t timer_ticks();
+void timer_tick();
+
+// (re)arm `t` to run `fn(user)` from the task queue, `ms` from now
+void timer_start(timer * t, uint32_t ms, tasklet fn, void * user);
+void timer_stop(timer * t);
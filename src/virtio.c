@@ -0,0 +1,275 @@
+#include "virtio.h"
+#include "memory.h"
+#include "console.h"
+#include "errno.h"
+
+// legacy port layout
+#define LegacyDeviceFeatures 0x00
+#define LegacyDriverFeatures 0x04
+#define LegacyQueueAddress 0x08
+#define LegacyQueueSize 0x0c
+#define LegacyQueueSelect 0x0e
+#define LegacyQueueNotify 0x10
+#define LegacyStatus 0x12
+#define LegacyIsr 0x13
+#define LegacyConfig 0x14
+
+// modern common configuration
+#define DeviceFeatureSelect 0x00
+#define DeviceFeature 0x04
+#define DriverFeatureSelect 0x08
+#define DriverFeature 0x0c
+#define DeviceStatus 0x14
+#define QueueSelect 0x16
+#define QueueSize 0x18
+#define QueueEnable 0x1c
+#define QueueNotifyOff 0x1e
+#define QueueDesc 0x20
+#define QueueDriver 0x28
+#define QueueDevice 0x30
+
+#define CapCommon 1
+#define CapNotify 2
+#define CapIsr 3
+#define CapDevice 4
+
+#define DescNext 1
+#define DescWrite 2
+
+#define UsedNoNotify 1
+
+#define barrier() __asm__ volatile("" ::: "memory")
+#define mb() __asm__ volatile("mfence" ::: "memory")
+
+#define R8(p, o) (*(volatile uint8_t*)((p) + (o)))
+#define R16(p, o) (*(volatile uint16_t*)((p) + (o)))
+#define R32(p, o) (*(volatile uint32_t*)((p) + (o)))
+
+static void write_status(virtio * v, uint8_t status) {
+    if (v->modern) R8(v->common, DeviceStatus) = status;
+    else outb(v->iobase + LegacyStatus, status);
+}
+
+static uint8_t read_status(virtio * v) {
+    return v->modern ? R8(v->common, DeviceStatus) : inb(v->iobase + LegacyStatus);
+}
+
+static void write64(volatile uint8_t * p, uint64_t v) {
+    R32(p, 0) = v;
+    R32(p, 4) = v >> 32;
+}
+
+// walk the capability list for the 1.0 structures
+static int find_modern(virtio * v, const pci_device * pci) {
+    if (!(pci_config_read(pci, 0x4) & (0x10 << 16))) return 0;
+
+    uint8_t cap = pci_config_read(pci, 0x34) & 0xfc;
+    while (cap) {
+        uint32_t head = pci_config_read(pci, cap);
+        if ((head & 0xff) == 0x09) { // vendor specific
+            uint8_t type = head >> 24;
+            uint8_t bar = pci_config_read(pci, cap + 4) & 0xff;
+            uint32_t offset = pci_config_read(pci, cap + 8);
+
+            int io;
+            volatile uint8_t * base = (volatile uint8_t*)(pci_bar(pci, bar, &io) + offset);
+            if (!io) {
+                if (type == CapCommon) v->common = base;
+                if (type == CapIsr) v->isr = base;
+                if (type == CapDevice) v->config = base;
+                if (type == CapNotify) {
+                    v->notify = base;
+                    v->notifyMultiplier = pci_config_read(pci, cap + 16);
+                }
+            }
+        }
+        cap = (head >> 8) & 0xfc;
+    }
+
+    return v->common && v->isr && v->notify;
+}
+
+int virtio_init(virtio * v, const pci_device * pci) {
+    bzero(v, sizeof(*v));
+
+    if (find_modern(v, pci)) {
+        v->modern = 1;
+    }
+    else {
+        int io;
+        v->iobase = pci_bar(pci, 0, &io);
+        if (!io) return EINVALID;
+    }
+
+    write_status(v, 0);
+    while (read_status(v)) ;
+    write_status(v, VirtioStatusAck);
+    write_status(v, VirtioStatusAck | VirtioStatusDriver);
+    return EOK;
+}
+
+uint64_t virtio_features(virtio * v) {
+    if (!v->modern) return inl(v->iobase + LegacyDeviceFeatures);
+
+    R32(v->common, DeviceFeatureSelect) = 0;
+    uint64_t lo = R32(v->common, DeviceFeature);
+    R32(v->common, DeviceFeatureSelect) = 1;
+    return lo | (uint64_t)R32(v->common, DeviceFeature) << 32;
+}
+
+int virtio_set_features(virtio * v, uint64_t features) {
+    if (!v->modern) {
+        outl(v->iobase + LegacyDriverFeatures, features);
+        return EOK;
+    }
+
+    R32(v->common, DriverFeatureSelect) = 0;
+    R32(v->common, DriverFeature) = features;
+    R32(v->common, DriverFeatureSelect) = 1;
+    R32(v->common, DriverFeature) = features >> 32;
+
+    uint8_t status = read_status(v) | VirtioStatusFeaturesOk;
+    write_status(v, status);
+    return read_status(v) & VirtioStatusFeaturesOk ? EOK : EINVALID;
+}
+
+uint8_t virtio_config8(virtio * v, uint16_t offset) {
+    return v->modern ? R8(v->config, offset) : inb(v->iobase + LegacyConfig + offset);
+}
+
+void virtio_driver_ok(virtio * v) {
+    write_status(v, read_status(v) | VirtioStatusDriverOk);
+}
+
+void virtio_fail(virtio * v) {
+    write_status(v, read_status(v) | VirtioStatusFailed);
+}
+
+uint8_t virtio_isr(virtio * v) {
+    return v->modern ? R8(v->isr, 0) : inb(v->iobase + LegacyIsr);
+}
+
+static inline uint32_t align(uint32_t x, uint32_t a) {
+    return (x + a - 1) & ~(a - 1);
+}
+
+int virtq_init(virtio * v, virtq * q, uint16_t index, uint16_t maxSize) {
+    bzero(q, sizeof(*q));
+    q->dev = v;
+    q->index = index;
+
+    uint16_t size;
+    if (v->modern) {
+        R16(v->common, QueueSelect) = index;
+        size = R16(v->common, QueueSize);
+        if (size > maxSize) size = maxSize;
+        R16(v->common, QueueSize) = size;
+    }
+    else {
+        outw(v->iobase + LegacyQueueSelect, index);
+        size = inw(v->iobase + LegacyQueueSize);
+    }
+    if (!size) return EINVALID;
+
+    // the legacy layout, which also satisfies the modern alignment rules
+    uint32_t availOffset = 16 * size;
+    uint32_t usedOffset = align(availOffset + 6 + 2 * size, 4096);
+    uint32_t bytes = usedOffset + align(6 + 8 * size, 4096);
+    if (bytes + 4096 > 28 * 1024) {
+        warn("virtio: queue too large");
+        return EINVALID;
+    }
+
+    q->mem = kmem_alloc(bytes + 4096);
+    uint8_t * base = (uint8_t*)(((uint64_t)q->mem + 4095) & ~4095ul);
+    bzero(base, bytes);
+
+    q->size = size;
+    q->desc = (volatile struct virtq_desc*) base;
+    q->avail = (volatile struct virtq_avail*)(base + availOffset);
+    q->used = (volatile struct virtq_used*)(base + usedOffset);
+    q->tokens = kmem_alloc(size * sizeof(void*));
+    bzero(q->tokens, size * sizeof(void*));
+
+    for (uint16_t i = 0; i < size; i++) q->desc[i].next = i + 1;
+    q->nFree = size;
+
+    if (v->modern) {
+        write64(v->common + QueueDesc, (uint64_t)q->desc);
+        write64(v->common + QueueDriver, (uint64_t)q->avail);
+        write64(v->common + QueueDevice, (uint64_t)q->used);
+        uint16_t off = R16(v->common, QueueNotifyOff);
+        q->notify = (volatile uint16_t*)(v->notify + off * v->notifyMultiplier);
+        R16(v->common, QueueEnable) = 1;
+    }
+    else {
+        outl(v->iobase + LegacyQueueAddress, (uint64_t)base >> 12);
+    }
+
+    return EOK;
+}
+
+int virtq_add(virtq * q, const virtq_buf * bufs, uint16_t out, uint16_t in, void * token) {
+    uint16_t n = out + in;
+    if (!n || n > q->nFree) return -1;
+
+    uint16_t head = q->freeHead, d = head, last = head;
+    for (uint16_t i = 0; i < n; i++) {
+        volatile struct virtq_desc * desc = &q->desc[d];
+        desc->addr = (uint64_t)bufs[i].addr;
+        desc->len = bufs[i].len;
+        desc->flags = (i < n - 1 ? DescNext : 0) | (i >= out ? DescWrite : 0);
+        last = d;
+        d = desc->next;
+    }
+    q->freeHead = q->desc[last].next;
+    q->nFree -= n;
+    q->tokens[head] = token;
+
+    q->avail->ring[q->avail->idx % q->size] = head;
+    barrier();
+    q->avail->idx++;
+    q->unkicked++;
+    return 0;
+}
+
+void virtq_kick(virtq * q) {
+    if (!q->unkicked) return;
+    q->unkicked = 0;
+
+    mb();
+    if (q->used->flags & UsedNoNotify) return;
+
+    if (q->dev->modern) *q->notify = q->index;
+    else outw(q->dev->iobase + LegacyQueueNotify, q->index);
+}
+
+int virtq_enable_interrupts(virtq * q) {
+    q->avail->flags = 0;
+    mb();
+    return virtq_has_used(q);
+}
+
+void * virtq_get(virtq * q, uint32_t * len) {
+    if (q->used->idx == q->lastUsed) return NULL;
+    barrier();
+
+    volatile struct virtq_used_elem * e = &q->used->ring[q->lastUsed % q->size];
+    uint16_t head = e->id;
+    if (len) *len = e->len;
+    q->lastUsed++;
+
+    // back on the free list
+    uint16_t d = head, n = 1;
+    while (q->desc[d].flags & DescNext) {
+        d = q->desc[d].next;
+        n++;
+    }
+    q->desc[d].next = q->freeHead;
+    q->freeHead = head;
+    q->nFree += n;
+
+    void * token = q->tokens[head];
+    q->tokens[head] = NULL;
+    return token;
+}
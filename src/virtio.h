@@ -0,0 +1,105 @@
+#pragma once
+
+#include "common.h"
+#include "pci.h"
+
+// Virtio over PCI: the modern (1.0) transport when the device has the
+// capabilities for it, the legacy port I/O one otherwise. Rings are
+// split virtqueues. DMA addresses are kernel addresses, which relies on
+// memory being identity mapped.
+
+#define VirtioStatusAck 1
+#define VirtioStatusDriver 2
+#define VirtioStatusDriverOk 4
+#define VirtioStatusFeaturesOk 8
+#define VirtioStatusFailed 128
+
+#define VirtioFVersion1 (1ul << 32)
+
+typedef struct virtio_t {
+    uint8_t modern;
+    uint16_t iobase;                // legacy
+    volatile uint8_t * common;      // modern
+    volatile uint8_t * isr;
+    volatile uint8_t * notify;
+    uint32_t notifyMultiplier;
+    volatile uint8_t * config;
+} virtio;
+
+struct virtq_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+};
+
+struct virtq_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+};
+
+struct virtq_used_elem {
+    uint32_t id;
+    uint32_t len;
+};
+
+struct virtq_used {
+    uint16_t flags;
+    uint16_t idx;
+    struct virtq_used_elem ring[];
+};
+
+typedef struct virtq_t {
+    virtio * dev;
+    uint16_t index;
+    uint16_t size;
+    volatile struct virtq_desc * desc;
+    volatile struct virtq_avail * avail;
+    volatile struct virtq_used * used;
+    volatile uint16_t * notify;     // modern
+    uint16_t freeHead;
+    uint16_t nFree;
+    uint16_t lastUsed;
+    uint16_t unkicked;
+    void ** tokens;                 // by head descriptor
+    void * mem;
+} virtq;
+
+typedef struct virtq_buf_t {
+    void * addr;
+    uint32_t len;
+} virtq_buf;
+
+// Resets the device and acknowledges it; 0 on success.
+int virtio_init(virtio * v, const pci_device * pci);
+
+uint64_t virtio_features(virtio * v);
+int virtio_set_features(virtio * v, uint64_t features);
+uint8_t virtio_config8(virtio * v, uint16_t offset);
+void virtio_driver_ok(virtio * v);
+void virtio_fail(virtio * v);
+
+// reading the ISR acknowledges the interrupt
+uint8_t virtio_isr(virtio * v);
+
+// Sets up queue `index` with at most `maxSize` entries (legacy devices
+// choose for themselves); 0 on success.
+int virtq_init(virtio * v, virtq * q, uint16_t index, uint16_t maxSize);
+
+// `out` device-readable buffers then `in` device-writable ones, as one
+// chain. `token` comes back from virtq_get when the device is done.
+// Returns 0, or -1 if there aren't enough free descriptors.
+int virtq_add(virtq * q, const virtq_buf * bufs, uint16_t out, uint16_t in, void * token);
+
+// Let the device know about everything added since the last kick.
+void virtq_kick(virtq * q);
+
+// The next buffer the device has finished with, or NULL.
+void * virtq_get(virtq * q, uint32_t * len);
+
+static inline void virtq_disable_interrupts(virtq * q) { q->avail->flags = 1; }
+// Turns interrupts back on. Returns 1 if buffers were used before the device
+// could have seen that, and no interrupt will come for them.
+int virtq_enable_interrupts(virtq * q);
+static inline int virtq_has_used(virtq * q) { return q->used->idx != q->lastUsed; }
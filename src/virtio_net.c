@@ -0,0 +1,225 @@
+#include "virtio_net.h"
+#include "virtio.h"
+#include "interrupt.h"
+#include "pci.h"
+
+#include "console.h"
+#include "memory.h"
+
+#include "net/ethernet.h"
+#include "net/ip.h"
+#include "net/sbuff.h"
+#include "net/device.h"
+
+#define VirtioNetFCsum (1 << 0)
+#define VirtioNetFMac (1 << 5)
+#define VirtioNetFHostTso4 (1 << 11)
+#define NeedsCsum 1
+#define GsoTcpV4 1
+
+#define RxQueue 0
+#define TxQueue 1
+#define MaxQueueSize 256
+#define RxBuffers 128
+#define MaxFrame 1514
+
+// struct virtio_net_hdr; 1.0 devices add num_buffers on the end
+#define LegacyHeader 10
+#define ModernHeader 12
+
+typedef struct net_hdr_t {
+    uint8_t flags;
+    uint8_t gsoType;
+    uint16_t hdrLen;
+    uint16_t gsoSize;
+    uint16_t csumStart;
+    uint16_t csumOffset;
+    uint16_t numBuffers;
+} __attribute__ ((packed)) net_hdr;
+
+typedef struct virtio_net_t {
+    struct netdevice netdev;    // first, the stack hands us this
+    virtio v;
+    virtq rx;
+    virtq tx;
+    net_hdr * txHeaders;        // by head descriptor
+    uint16_t rxPosted;
+    uint8_t hdrLen;
+} virtio_net;
+
+typedef struct rx_buffer_t {
+    virtio_net * nic;
+    uint8_t data[ModernHeader + MaxFrame];
+} rx_buffer;
+
+static const mac fallback_mac = {0x52, 0x54, 0x00, 0x12, 0x34, 0x56};
+
+static uint32_t myIp = 0xC0A80302;
+static uint32_t gateway = 0xC0A80301;
+
+// keep the device stocked with empty buffers
+static void post_rx(virtio_net * nic) {
+    while (nic->rxPosted < RxBuffers && nic->rx.nFree) {
+        rx_buffer * b = kmem_alloc(sizeof(rx_buffer));
+        b->nic = nic;
+        virtq_buf buf = {b->data, nic->hdrLen + MaxFrame};
+        virtq_add(&nic->rx, &buf, 0, 1, b);
+        nic->rxPosted++;
+    }
+}
+
+static void reclaim_tx(virtio_net * nic) {
+    sbuff * sb;
+    while ((sb = virtq_get(&nic->tx, NULL))) {
+        release_ref(sb, sbuff_free);
+    }
+}
+
+static int virtio_net_poll(struct netdevice * self, int budget) {
+    virtio_net * nic = (virtio_net*) self;
+    int done = 0;
+
+    rx_buffer * b;
+    uint32_t len;
+    while (done < budget && (b = virtq_get(&nic->rx, &len))) {
+        netdev_receive(self, b->data + nic->hdrLen, len - nic->hdrLen);
+        done++;
+
+        // straight back to the device
+        virtq_buf buf = {b->data, nic->hdrLen + MaxFrame};
+        virtq_add(&nic->rx, &buf, 0, 1, b);
+    }
+    virtq_kick(&nic->rx);
+
+    return done;
+}
+
+static void virtio_net_rx_unmask(struct netdevice * self) {
+    virtio_net * nic = (virtio_net*) self;
+    if (virtq_enable_interrupts(&nic->rx)) {
+        virtq_disable_interrupts(&nic->rx);
+        netdev_rx_schedule(self);
+    }
+}
+
+static void virtio_net_irq(registers_t * regs, void * user) {
+    virtio_net * nic = (virtio_net*) user;
+    if (!virtio_isr(&nic->v)) return; // someone else's
+
+    if (virtq_has_used(&nic->rx)) {
+        virtq_disable_interrupts(&nic->rx);
+        netdev_rx_schedule(&nic->netdev);
+    }
+
+    reclaim_tx(nic);
+}
+
+static void queue_tx(virtio_net * nic, sbuff * sb) {
+    add_ref(sb);
+
+    // the header goes with the descriptor that's about to be used
+    net_hdr * hdr = &nic->txHeaders[nic->tx.freeHead];
+    bzero(hdr, sizeof(net_hdr));
+    if (sb->csumStart) {
+        hdr->flags = NeedsCsum;
+        hdr->csumStart = sb->data + sb->csumStart - sb->head;
+        hdr->csumOffset = sb->csumOffset;
+    }
+    if (sb->gsoSize) {
+        const uint8_t * tcp = sb->data + sb->csumStart;
+        hdr->gsoType = GsoTcpV4;
+        hdr->gsoSize = sb->gsoSize;
+        hdr->hdrLen = tcp - sb->head + (tcp[12] >> 4) * 4;
+    }
+
+    virtq_buf bufs[2] = {
+        {hdr, nic->hdrLen},
+        {sb->head, sb->currSize} };
+
+    if (virtq_add(&nic->tx, bufs, 2, 0, sb)) {
+        release_ref(sb, sbuff_free); // ring full, drop it
+    }
+}
+
+static void virtio_net_send(struct netdevice * dev, sbuff * sb) {
+    virtio_net * nic = (virtio_net*) dev;
+
+    disable_interrupts();
+    reclaim_tx(nic);
+    queue_tx(nic, sb);
+    virtq_kick(&nic->tx);
+    enable_interrupts();
+}
+
+// one notification for the lot
+static void virtio_net_send_batch(struct netdevice * dev, sbuff ** sbuffs, uint16_t count) {
+    virtio_net * nic = (virtio_net*) dev;
+
+    disable_interrupts();
+    reclaim_tx(nic);
+    for (uint16_t i = 0; i < count; i++) {
+        queue_tx(nic, sbuffs[i]);
+    }
+    virtq_kick(&nic->tx);
+    enable_interrupts();
+}
+
+static void initialize(const pci_device * pci) {
+    virtio_net * nic = kmem_alloc(sizeof(virtio_net));
+    bzero(nic, sizeof(virtio_net));
+
+    if (virtio_init(&nic->v, pci)) {
+        warn("virtio-net: no usable transport");
+        kmem_free(nic);
+        return;
+    }
+
+    uint64_t wanted = VirtioNetFMac | VirtioNetFCsum | VirtioNetFHostTso4 |
+        (nic->v.modern ? VirtioFVersion1 : 0);
+    uint64_t features = virtio_features(&nic->v) & wanted;
+    if ((nic->v.modern && !(features & VirtioFVersion1)) ||
+            virtio_set_features(&nic->v, features)) {
+        warn("virtio-net: feature negotiation failed");
+        virtio_fail(&nic->v);
+        kmem_free(nic);
+        return;
+    }
+    nic->hdrLen = nic->v.modern ? ModernHeader : LegacyHeader;
+
+    if (virtq_init(&nic->v, &nic->rx, RxQueue, MaxQueueSize) ||
+            virtq_init(&nic->v, &nic->tx, TxQueue, MaxQueueSize)) {
+        warn("virtio-net: cannot set up queues");
+        virtio_fail(&nic->v);
+        return;
+    }
+    nic->txHeaders = kmem_alloc(nic->tx.size * sizeof(net_hdr));
+
+    struct netdevice * self = &nic->netdev;
+    self->send = virtio_net_send;
+    self->send_batch = virtio_net_send_batch;
+    init_netdev_poll(self, virtio_net_poll, virtio_net_rx_unmask);
+    if (features & VirtioNetFCsum) self->features |= NetdevTxCsum;
+    if (features & VirtioNetFCsum && features & VirtioNetFHostTso4) self->features |= NetdevTso;
+
+    console_print_string("Found virtio-net (%s) on IRQ %d with MAC ",
+            nic->v.modern ? "1.0" : "legacy", pci->intr);
+    for (int i = 0; i < 6; i++) {
+        self->mac[i] = features & VirtioNetFMac ? virtio_config8(&nic->v, i) : fallback_mac[i];
+        if (i) console_print_string(":");
+        console_put_hex8(self->mac[i]);
+    }
+    console_print_string("\n");
+
+    post_rx(nic);
+
+    register_interrupt_handler(pci->intr + 32, virtio_net_irq, nic);
+    virtio_driver_ok(&nic->v);
+    virtq_kick(&nic->rx);
+
+    ip_configure(self, myIp, 24, gateway);
+}
+
+void init_virtio_net() {
+    register_pci_dma_device(0x1af4, 0x1000, initialize); // transitional
+    register_pci_dma_device(0x1af4, 0x1041, initialize); // 1.0 only
+}
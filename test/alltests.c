@@ -13,6 +13,8 @@ void call_user_function(struct process * proc) {
 
 void disable_interrupts() {}
 void enable_interrupts() {}
+uint64_t save_and_disable_interrupts() { return 0; }
+void restore_interrupts(uint64_t flags) {}
 
 void register_interrupt_handler(int interrupt, void* handler) { }
 
@@ -16,6 +16,16 @@ TEST(memcmp) {
     ASSERT_INT_EQUALS(0, memcmp("ac", "ab", 1));
     ASSERT_INT_EQUALS(-1, memcmp("a", "b", 1));
     ASSERT_INT_EQUALS(1, memcmp("b", "a", 1));
+    ASSERT_INT_EQUALS(-1, memcmp("ab", "ac", 2));
+    ASSERT_INT_EQUALS(1, memcmp("\xff", "a", 1));
+}
+
+TEST(memmove) {
+    char buf[] = "abcdef";
+    memmove(buf + 2, buf, 3);
+    ASSERT_STRING_EQUALS("ababcf", buf);
+    memmove(buf, buf + 3, 3);
+    ASSERT_STRING_EQUALS("bcfbcf", buf);
 }
 
 TEST(strnchr) {
@@ -43,4 +53,8 @@ TEST(more_string) {
     ASSERT_STRING_EQUALS("10", b32);
     to_str(100001, b32);
     ASSERT_STRING_EQUALS("100001", b32);
+
+    // points at the terminator, to carry on from
+    ASSERT_EQUALS(b32 + 1, to_str(0, b32));
+    ASSERT_EQUALS(b32 + 2, to_str(42, b32));
 }
@@ -21,3 +21,25 @@ TEST(simpleAllocation) {
     kmem_free(m3);
 }
 
+
+TEST(freeBeyondTheFirstMaskWord) {
+    // single chunks, first fit, so enough of them fill every hole and run
+    // well past the first 32 chunks of the block
+    void * m[100];
+    for (int i = 0; i < 100; i++) m[i] = kmem_alloc(16);
+
+    kmem_free(m[70]);
+    void * again = kmem_alloc(16);
+    ASSERT_EQUALS(m[70], again);
+
+    for (int i = 0; i < 100; i++) kmem_free(m[i]);
+}
+
+TEST(largestAllocation) {
+    // a whole mask word of chunks, less the header
+    ASSERT_INT_EQUALS(32 * 0x100 - 8, kmem_largest());
+
+    char * m = kmem_alloc(kmem_largest());
+    m[kmem_largest() - 1] = 1;
+    kmem_free(m);
+}
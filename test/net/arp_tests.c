@@ -0,0 +1,116 @@
+#include "net/arp.h"
+#include "net/ip.h"
+#include "net/sbuff.h"
+#include "net/ntox.h"
+#include "net/device.h"
+#include "timer.h"
+#include "task.h"
+#include "memory.h"
+
+#include "../tinytest/tinytest.h"
+
+#include <string.h>
+
+static int g_requests, g_packets;
+static uint8_t g_dest[6];
+
+static void count(struct netdevice * dev, sbuff * buff) {
+    add_ref(buff);
+    uint16_t type = ntos(*(uint16_t*)(buff->head + 12));
+    if (type == 0x0806) g_requests++;
+    if (type == 0x0800) {
+        g_packets++;
+        memcpy(g_dest, buff->head, 6);
+    }
+    release_ref(buff, sbuff_free);
+}
+
+static void reset() {
+    g_requests = g_packets = 0;
+}
+
+static void advance(uint32_t ms) {
+    for (uint32_t i = 0; i < ms * TIMER_HZ / 1000; i++) {
+        timer_tick();
+        task_poll_for_work();
+    }
+}
+
+static void answer(struct netdevice * dev, uint32_t ip, const char * mac) {
+    uint8_t packet[28] = {0, 1, 8, 0, 6, 4, 0, 2};
+    memcpy(packet + 8, mac, 6);
+    *(uint32_t*)(packet + 14) = ntol(ip);
+    memcpy(packet + 18, dev->mac, 6);
+    *(uint32_t*)(packet + 24) = ntol(dev->ip);
+    arp_packet(dev, packet);
+}
+
+static void send_to(struct netdevice * dev, uint32_t ip) {
+    sbuff * sb = ip_sbuff_alloc(8);
+    bzero(sb->head, 8);
+    ip_send(sb, 17, ip, dev);
+}
+
+TEST(arp_holds_packets_until_resolved) {
+    static struct netdevice dev = {.ip = 0x0a000001, .mac = {2,0,0,0,0,1}, .send = count};
+    uint32_t objects = kmem_current_objects();
+    reset();
+
+    send_to(&dev, 0x0a000002);
+    send_to(&dev, 0x0a000002);
+    ASSERT_INT_EQUALS(1, g_requests); // only asks once
+    ASSERT_INT_EQUALS(0, g_packets);
+
+    answer(&dev, 0x0a000002, "\x02\x00\x00\x00\x00\x02");
+    ASSERT_INT_EQUALS(2, g_packets);
+    ASSERT_INT_EQUALS(2, g_dest[5]);
+
+    // resolved now, straight out
+    send_to(&dev, 0x0a000002);
+    ASSERT_INT_EQUALS(3, g_packets);
+    ASSERT_INT_EQUALS(1, g_requests);
+    ASSERT("nothing held", objects == kmem_current_objects());
+}
+
+TEST(arp_gives_up) {
+    static struct netdevice dev = {.ip = 0x0a000001, .mac = {2,0,0,0,0,1}, .send = count};
+    uint32_t objects = kmem_current_objects();
+    reset();
+
+    for (int i = 0; i < 6; i++) send_to(&dev, 0x0a000003);
+    ASSERT_INT_EQUALS(1, g_requests);
+    ASSERT("queue is bounded", kmem_current_objects() <= objects + 4);
+
+    advance(1000);
+    ASSERT_INT_EQUALS(2, g_requests);
+    advance(2000);
+    ASSERT_INT_EQUALS(3, g_requests);
+    ASSERT("dropped", objects == kmem_current_objects());
+    ASSERT_INT_EQUALS(0, g_packets);
+}
+
+TEST(arp_entries_age) {
+    static struct netdevice dev = {.ip = 0x0a000001, .mac = {2,0,0,0,0,1}, .send = count};
+    mac dest;
+    reset();
+
+    answer(&dev, 0x0a000004, "\x02\x00\x00\x00\x00\x04");
+    ASSERT("known", arp_lookup(&dev, 0x0a000004, dest));
+    ASSERT_INT_EQUALS(0, g_requests);
+
+    // getting old: still used, but checked
+    advance(61000);
+    ASSERT("still known", arp_lookup(&dev, 0x0a000004, dest));
+    ASSERT_INT_EQUALS(1, g_requests);
+    ASSERT("rate limited", arp_lookup(&dev, 0x0a000004, dest));
+    ASSERT_INT_EQUALS(1, g_requests);
+
+    answer(&dev, 0x0a000004, "\x02\x00\x00\x00\x00\x04");
+    advance(59000);
+    ASSERT("refreshed", arp_lookup(&dev, 0x0a000004, dest));
+    ASSERT_INT_EQUALS(1, g_requests);
+
+    advance(121000);
+    ASSERT("forgotten", !arp_lookup(&dev, 0x0a000004, dest));
+    ASSERT_INT_EQUALS(2, g_requests);
+}
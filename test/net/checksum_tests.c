@@ -0,0 +1,79 @@
+#include "net/checksum.h"
+#include "net/ip.h"
+#include "../tinytest/tinytest.h"
+
+#include <string.h>
+
+// the straightforward RFC 1071 loop, to check against
+static uint16_t reference(const uint8_t * data, uint32_t len) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < len; i += 2) {
+        sum += data[i] << 8 | (i + 1 < len ? data[i + 1] : 0);
+    }
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return ntos(~sum);
+}
+
+TEST(checksum_matches_reference) {
+    static uint8_t data[1500 + 3];
+    for (int i = 0; i < sizeof(data); i++) data[i] = i * 7 + 0xe5;
+
+    // every length up to 64 plus big ones, at every alignment
+    for (uint32_t len = 0; len < 1500; len = len < 64 ? len + 1 : len * 2 + 1) {
+        for (int offset = 0; offset < 4; offset++) {
+            ASSERT_INT_EQUALS(reference(data + offset, len),
+                    csum_fold(csum_partial(data + offset, len, 0)));
+        }
+    }
+
+    static uint8_t ones[1500];
+    memset(ones, 0xff, sizeof(ones));
+    ASSERT_INT_EQUALS(reference(ones, sizeof(ones)), csum_fold(csum_partial(ones, sizeof(ones), 0)));
+}
+
+TEST(checksum_copy) {
+    static uint8_t src[301], dest[301];
+    for (int i = 0; i < sizeof(src); i++) src[i] = i ^ 0x5a;
+    bzero(dest, sizeof(dest));
+
+    uint32_t sum = csum_copy(dest + 1, src + 3, 297, 0);
+
+    ASSERT_INT_EQUALS(0, memcmp(dest + 1, src + 3, 297));
+    ASSERT_INT_EQUALS(0, dest[0]);
+    ASSERT_INT_EQUALS(0, dest[298]);
+    ASSERT_INT_EQUALS(reference(src + 3, 297), csum_fold(sum));
+}
+
+TEST(checksum_pseudo_header) {
+    uint8_t segment[12] = {
+        0xc0, 0xa8, 0x03, 0x02, 0xc0, 0xa8, 0x03, 0x01, // addresses
+        0x00, 0x06, 0x00, 0x14 };                       // proto, length
+
+    uint32_t sum = csum_pseudo(0xc0a80302, 0xc0a80301, 6, 20);
+    ASSERT_INT_EQUALS(reference(segment, sizeof(segment)), csum_fold(sum));
+}
+
+TEST(checksum_incremental) {
+    uint8_t hdr[20] = {
+        0x45, 0x00, 0x00, 0x54, 0x12, 0x34, 0x40, 0x00, 0x40, 0x01,
+        0x00, 0x00, 0xc0, 0xa8, 0x03, 0x01, 0xc0, 0xa8, 0x03, 0x02 };
+    uint16_t * check = (uint16_t*)(hdr + 10);
+    checksum(hdr, sizeof(hdr), check);
+
+    // ttl and length go down, one field at a time
+    uint16_t was = *(uint16_t*)(hdr + 8);
+    hdr[8]--;
+    csum_replace2(check, was, *(uint16_t*)(hdr + 8));
+
+    was = *(uint16_t*)(hdr + 2);
+    hdr[3] = 0x40;
+    csum_replace2(check, was, *(uint16_t*)(hdr + 2));
+
+    uint32_t addr = *(uint32_t*)(hdr + 16);
+    hdr[19] = 0x63;
+    csum_replace4(check, addr, *(uint32_t*)(hdr + 16));
+
+    uint16_t patched = *check;
+    checksum(hdr, sizeof(hdr), check);
+    ASSERT_INT_EQUALS(*check, patched);
+}
@@ -0,0 +1,126 @@
+#include "net/device.h"
+#include "net/sbuff.h"
+#include "net/checksum.h"
+#include "task.h"
+#include "memory.h"
+
+#include "../tinytest/tinytest.h"
+
+static int backlog;
+static int polls;
+static int unmasked;
+
+static int fake_poll(struct netdevice * self, int budget) {
+    int n = backlog < budget ? backlog : budget;
+    backlog -= n;
+    polls++;
+    return n;
+}
+
+static void fake_unmask(struct netdevice * self) {
+    unmasked++;
+}
+
+static struct netdevice nic;
+
+TEST(netdev_poll_drains_then_unmasks) {
+    init_netdev_poll(&nic, fake_poll, fake_unmask);
+    uint32_t start = kmem_current_objects();
+
+    backlog = 2 * NetdevPollBudget + 3;
+    polls = unmasked = 0;
+
+    netdev_rx_schedule(&nic);
+    netdev_rx_schedule(&nic);   // already due
+    ASSERT_INT_EQUALS(0, polls);
+
+    task_poll_for_work();
+    ASSERT_INT_EQUALS(0, backlog);
+    ASSERT_INT_EQUALS(3, polls);
+    ASSERT_INT_EQUALS(1, unmasked);
+    ASSERT("no leaks", start == kmem_current_objects());
+}
+
+static int order[4];
+static int ran;
+
+static void other_work(void * user) {
+    order[ran++] = 0;
+}
+
+static int note_poll(struct netdevice * self, int budget) {
+    order[ran++] = 1;
+    return fake_poll(self, budget);
+}
+
+TEST(netdev_poll_yields_over_budget) {
+    init_netdev_poll(&nic, note_poll, fake_unmask);
+
+    backlog = NetdevPollBudget + 1;
+    ran = unmasked = 0;
+
+    netdev_rx_schedule(&nic);
+    task_enqueue_easy(other_work, NULL);
+    task_poll_for_work();
+
+    // a full budget goes to the back of the queue
+    ASSERT_INT_EQUALS(3, ran);
+    ASSERT_INT_EQUALS(1, order[0]);
+    ASSERT_INT_EQUALS(0, order[1]);
+    ASSERT_INT_EQUALS(1, order[2]);
+    ASSERT_INT_EQUALS(1, unmasked);
+}
+
+static sbuff * sent;
+
+static void capture(struct netdevice * self, sbuff * sb) {
+    sent = sb;
+}
+
+// 8 bytes of udp header then the payload, checksum owed
+static sbuff * owed_datagram(uint16_t * expected) {
+    static const uint8_t dgram[] = {
+        0x04, 0xd2, 0x16, 0x2e, 0x00, 0x0d, 0x00, 0x00,
+        'h', 'e', 'l', 'l', 'o' };
+    uint32_t pseudo = csum_pseudo(0x0a000001, 0x0a000002, 17, sizeof(dgram));
+
+    sbuff * sb = raw_sbuff_alloc(14 + sizeof(dgram));
+    sbuff_push(sb, 14);
+    memcpy(sb->head, dgram, sizeof(dgram));
+    *expected = csum_fold(csum_partial(sb->head, sizeof(dgram), pseudo));
+
+    uint16_t * field = (uint16_t*)(sb->head + 6);
+    *field = ~csum_fold(pseudo);
+    sbuff_csum_partial(sb, sb->head, field);
+    sbuff_pop(sb, 14);
+    return sb;
+}
+
+TEST(netdev_xmit_checksums_in_software) {
+    struct netdevice plain = {.send = capture};
+    uint16_t expected;
+    sbuff * sb = owed_datagram(&expected);
+
+    netdev_xmit(&plain, sb);
+    ASSERT_EQUALS(sb, sent);
+    ASSERT_INT_EQUALS(0, sb->csumStart);
+    ASSERT_INT_EQUALS(expected, *(uint16_t*)(sb->head + 14 + 6));
+    sbuff_free(sb);
+}
+
+TEST(netdev_xmit_leaves_checksum_to_device) {
+    struct netdevice offload = {.send = capture, .features = NetdevTxCsum};
+    uint16_t expected;
+    sbuff * sb = owed_datagram(&expected);
+    uint16_t before = *(uint16_t*)(sb->head + 14 + 6);
+
+    netdev_xmit(&offload, sb);
+    ASSERT_INT_EQUALS(14, sb->csumStart);
+    ASSERT_INT_EQUALS(6, sb->csumOffset);
+    ASSERT_INT_EQUALS(before, *(uint16_t*)(sb->head + 14 + 6));
+
+    // what the card would do
+    sbuff_csum_complete(sb);
+    ASSERT_INT_EQUALS(expected, *(uint16_t*)(sb->head + 14 + 6));
+    sbuff_free(sb);
+}
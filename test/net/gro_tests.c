@@ -0,0 +1,179 @@
+#include "net/gro.h"
+#include "net/device.h"
+#include "net/ethernet.h"
+#include "net/ip.h"
+#include "net/tcp.h"
+#include "net/arp.h"
+#include "net/sbuff.h"
+#include "net/ntox.h"
+#include "timer.h"
+#include "task.h"
+
+#include "../tinytest/tinytest.h"
+
+#define Remote 0xc0a80309
+#define Local 0xc0a80302
+
+static mac remote = {1,2,3,4,5,6};
+static uint32_t lastSeq;
+static uint32_t lastAck;
+
+static void capture(struct netdevice * dev, sbuff * sb) {
+    add_ref(sb);
+    tcp_hdr * hdr = (tcp_hdr*)(sb->head + 14 + 20);
+    lastSeq = ntol(hdr->sequence);
+    lastAck = ntol(hdr->ack);
+    release_ref(sb, sbuff_free);
+}
+
+static struct netdevice dev = {.ip = Local, .send = capture};
+
+static int reads;
+static int eof;
+static uint8_t got[1024];
+static uint32_t gotLen;
+
+static void on_read(stream * s, const uint8_t * data, uint32_t sz) {
+    if (!data) {
+        eof = 1;
+        return;
+    }
+    reads++;
+    memcpy(got + gotLen, data, sz);
+    gotLen += sz;
+}
+
+static tcp_read_fn accept(stream * s) { return on_read; }
+
+static uint8_t frame[1600];
+static uint8_t payload[300];
+
+// ethernet, ip, tcp and `n` bytes of the payload from `offset`
+static uint16_t build(uint16_t port, uint32_t seq, uint32_t ack, uint8_t flags,
+        uint16_t offset, uint16_t n) {
+    bzero(frame, sizeof(frame));
+    ((struct ethernet_frame*)frame)->sizeOrType = ntos(0x0800);
+
+    struct ipv4_header * ip = (struct ipv4_header*)(frame + 14);
+    ip->ihl = 5;
+    ip->version = 4;
+    ip->total_len = ntos(20 + sizeof(tcp_hdr) + n);
+    ip->ttl = 64;
+    ip->proto = IPPROTO_TCP;
+    ip->src = ntol(Remote);
+    ip->dest = ntol(Local);
+
+    tcp_hdr * tcp = (tcp_hdr*)(ip + 1);
+    tcp->srcPort = ntos(port);
+    tcp->destPort = ntos(90);
+    tcp->sequence = ntol(seq);
+    tcp->ack = ntol(ack);
+    tcp->offset = 5;
+    tcp->flags = flags;
+    tcp->window = ntos(8192);
+    memcpy(tcp->options, payload + offset, n);
+
+    return 14 + 20 + sizeof(tcp_hdr) + n;
+}
+
+// handshake from `port`; returns what our data should be acking
+static uint32_t connect(uint16_t port) {
+    for (int i = 0; i < sizeof(payload); i++) payload[i] = i;
+    reads = 0;
+    gotLen = 0;
+
+    tcp_listen(90, accept);
+    arp_store(remote, Remote);
+
+    build(port, 100, 0, TcpSyn, 0, 0);
+    tcp_segment(&dev, frame + 14 + 20, sizeof(tcp_hdr), Remote);
+    uint32_t ack = lastSeq + 1;
+
+    build(port, 101, ack, TcpAck, 0, 0);
+    tcp_segment(&dev, frame + 14 + 20, sizeof(tcp_hdr), Remote);
+    return ack;
+}
+
+TEST(gro_merges_in_order_segments) {
+    uint32_t ack = connect(5000);
+
+    uint16_t len = build(5000, 101, ack, TcpAck, 0, 100);
+    ASSERT_INT_EQUALS(1, gro_receive(&dev, frame, len));
+    len = build(5000, 201, ack, TcpAck, 100, 100);
+    ASSERT_INT_EQUALS(1, gro_receive(&dev, frame, len));
+    ASSERT_INT_EQUALS(0, reads);
+
+    // the push closes it off and it all goes up as one
+    len = build(5000, 301, ack, TcpAck | TcpPsh, 200, 100);
+    netdev_receive(&dev, frame, len);
+    ASSERT_INT_EQUALS(1, reads);
+    ASSERT_INT_EQUALS(300, gotLen);
+    ASSERT_INT_EQUALS(0, memcmp(got, payload, 300));
+
+    gro_flush();
+    ASSERT_INT_EQUALS(1, reads);
+}
+
+TEST(gro_flush_hands_up_held_data) {
+    uint32_t ack = connect(5001);
+
+    uint16_t len = build(5001, 101, ack, TcpAck, 0, 100);
+    netdev_receive(&dev, frame, len);
+    len = build(5001, 201, ack, TcpAck, 100, 100);
+    netdev_receive(&dev, frame, len);
+
+    lastAck = 0;
+    gro_flush();
+    for (int i = 0; i < TIMER_HZ; i++) {
+        timer_tick();
+        task_poll_for_work();
+    }
+    ASSERT_INT_EQUALS(301, lastAck);
+}
+
+TEST(gro_keeps_order_around_a_gap) {
+    uint32_t ack = connect(5002);
+
+    uint16_t len = build(5002, 101, ack, TcpAck, 0, 100);
+    netdev_receive(&dev, frame, len);
+
+    // out of order: what's held goes up first, and this waits for company
+    lastAck = 0;
+    len = build(5002, 301, ack, TcpAck, 200, 100);
+    netdev_receive(&dev, frame, len);
+    ASSERT_INT_EQUALS(0, lastAck);
+
+    gro_flush();
+    ASSERT_INT_EQUALS(201, lastAck);    // dup ack for the hole
+}
+
+TEST(gro_flushes_before_a_fin) {
+    uint32_t ack = connect(5003);
+    eof = 0;
+
+    uint16_t len = build(5003, 101, ack, TcpAck, 0, 100);
+    netdev_receive(&dev, frame, len);
+    len = build(5003, 201, ack, TcpAck, 100, 100);
+    netdev_receive(&dev, frame, len);
+
+    // the fin can't merge, and only counts if the data got there first
+    len = build(5003, 301, ack, TcpAck | TcpFin, 0, 0);
+    netdev_receive(&dev, frame, len);
+    ASSERT_INT_EQUALS(1, reads);
+    ASSERT_INT_EQUALS(200, gotLen);
+    ASSERT_INT_EQUALS(0, memcmp(got, payload, 200));
+    ASSERT_INT_EQUALS(1, eof);
+}
+
+TEST(gro_passes_up_what_it_cant_hold) {
+    uint32_t ack = connect(5004);
+
+    // bigger than a held flow, as a card's own receive offload might give
+    static uint8_t big[14 + GroMaxSize + 100];
+    uint16_t len = build(5004, 101, ack, TcpAck, 0, 0);
+    memcpy(big, frame, len);
+    struct ipv4_header * ip = (struct ipv4_header*)(big + 14);
+    ip->total_len = ntos(sizeof(big) - 14);
+
+    ASSERT_INT_EQUALS(0, gro_receive(&dev, big, sizeof(big)));
+}
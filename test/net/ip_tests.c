@@ -4,6 +4,11 @@
 #include "../tinytest/tinytest.h"
 #include "tobytes.h"
 #include "net/sbuff.h"
+#include "net/ntox.h"
+#include "net/ipfrag.h"
+#include "memory.h"
+#include "timer.h"
+#include "task.h"
 
 #include <string.h>
 
@@ -22,7 +27,7 @@ uint8_t gCalled = 0;
 void capture(struct netdevice* dev, sbuff * sbuff) {
     size_t capturedLen = sbuff->totalSize;
     ASSERT_INT_EQUALS(98, capturedLen);
-    char *reply = tobytes("45000054000000004001f355c0a80302c0a803010000eda80eb203a52d771b53000000006f38030000000000101112131415161718191a1b1c1d1e1f202122232425262728292a2b2c2d2e2f3031323334353637");
+    char *reply = tobytes("45000054000000004001f355c0a80302c0a80301000073d30eb203a52d771b53000000006f38030000000000101112131415161718191a1b1c1d1e1f202122232425262728292a2b2c2d2e2f3031323334353637");
 
     uint8_t* p = sbuff->data;
     for (int i = 14; i < capturedLen; i++) {
@@ -38,9 +43,7 @@ TEST(icmp_ping_replied) {
 
     uint8_t *arp = tobytes("000108000604000212c937989189c0a80301b0c420000000c0a80302");
     uint8_t *request = tobytes("45000054d19440004001e1c0c0a80301c0a8030208006bd30eb203a52d771b53000000006f38030000000000101112131415161718191a1b1c1d1e1f202122232425262728292a2b2c2d2e2f3031323334353637");
-    struct netdevice dev;
-    dev.ip = 0xC0A80302;
-    dev.send = capture;
+    struct netdevice dev = {.ip = 0xC0A80302, .send = capture};
 
     arp_packet(&dev, arp);
     ip_packet(&dev, request);
@@ -50,3 +53,80 @@ TEST(icmp_ping_replied) {
     free(arp);
     free(request);
 }
+
+static uint8_t g_reply[3000];
+static uint16_t g_fragments[4];
+static int g_nFragments;
+
+static void collect(struct netdevice* dev, sbuff * sbuff) {
+    add_ref(sbuff);
+    uint8_t * ip = sbuff->head + 14;
+    uint16_t fragment = ntos(*(uint16_t*)(ip + 6));
+    uint16_t len = ntos(*(uint16_t*)(ip + 2)) - 20;
+    if (g_nFragments < 4) g_fragments[g_nFragments++] = fragment;
+    memcpy(g_reply + (fragment & 0x1fff) * 8, ip + 20, len);
+    release_ref(sbuff, sbuff_free);
+}
+
+static void send_fragment(struct netdevice * dev, const uint8_t * icmp,
+        uint16_t offset, uint16_t len, int more) {
+    uint8_t packet[1500];
+    uint8_t * hdr = tobytes("45000000beef000040010000c0a80309c0a80302");
+    memcpy(packet, hdr, 20);
+    *(uint16_t*)(packet + 2) = ntos(20 + len);
+    *(uint16_t*)(packet + 6) = ntos((more ? 0x2000 : 0) | offset / 8);
+    checksum(packet, 20, (uint16_t*)(packet + 10));
+    memcpy(packet + 20, icmp + offset, len);
+    ip_packet(dev, packet);
+    free(hdr);
+}
+
+TEST(large_ping_reassembled_and_fragmented) {
+    static struct netdevice dev = {.ip = 0xC0A80302, .send = collect};
+    static uint8_t icmp[3000];
+    mac remote = {2, 0, 0, 0, 0, 9};
+    arp_store(remote, 0xc0a80309);
+    uint32_t objects = kmem_current_objects();
+
+    icmp[0] = 8;
+    for (int i = 4; i < sizeof(icmp); i++) icmp[i] = i;
+    checksum(icmp, sizeof(icmp), (uint16_t*)(icmp + 2));
+
+    // out of order, with a repeat
+    send_fragment(&dev, icmp, 2960, 40, 0);
+    send_fragment(&dev, icmp, 0, 1480, 1);
+    send_fragment(&dev, icmp, 0, 1480, 1);
+    ASSERT_INT_EQUALS(0, g_nFragments);
+    ASSERT_INT_EQUALS(1, ipfrag_pending());
+    send_fragment(&dev, icmp, 1480, 1480, 1);
+
+    ASSERT_INT_EQUALS(0, ipfrag_pending());
+    ASSERT_INT_EQUALS(3, g_nFragments);
+    ASSERT_INT_EQUALS(0x2000, g_fragments[0]);
+    ASSERT_INT_EQUALS(0x2000 | 185, g_fragments[1]);
+    ASSERT_INT_EQUALS(370, g_fragments[2]);
+
+    ASSERT_INT_EQUALS(0, g_reply[0]);   // echo reply
+    ASSERT_INT_EQUALS(0, memcmp(g_reply + 4, icmp + 4, sizeof(icmp) - 4));
+    ASSERT_INT_EQUALS(0, csum_fold(csum_partial(g_reply, sizeof(g_reply), 0)));
+    ASSERT("nothing held", objects == kmem_current_objects());
+}
+
+TEST(reassembly_rejects_overlaps) {
+    uint8_t data[64] = {0};
+    uint16_t total;
+
+    ASSERT("waiting", !ipfrag_add(1, 2, 3, 17, 0, 1, data, 32, &total));
+    ASSERT_INT_EQUALS(1, ipfrag_pending());
+    ASSERT("overlap", !ipfrag_add(1, 2, 3, 17, 24, 0, data, 16, &total));
+    ASSERT_INT_EQUALS(0, ipfrag_pending());
+
+    // and unfinished ones time out
+    ASSERT("waiting", !ipfrag_add(1, 2, 4, 17, 0, 1, data, 32, &total));
+    ASSERT_INT_EQUALS(1, ipfrag_pending());
+    for (int i = 0; i < 31 * TIMER_HZ; i++) {
+        timer_tick();
+        task_poll_for_work();
+    }
+    ASSERT_INT_EQUALS(0, ipfrag_pending());
+}
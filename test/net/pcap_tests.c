@@ -0,0 +1,124 @@
+#include "net/pcap.h"
+#include "net/device.h"
+#include "net/sbuff.h"
+#include "net/ntox.h"
+#include "memory.h"
+#include "errno.h"
+
+#include "../tinytest/tinytest.h"
+
+static void drop(struct netdevice * dev, sbuff * sb) {
+    add_ref(sb);
+    release_ref(sb, sbuff_free);
+}
+
+static struct netdevice nic = {.send = drop};
+
+static uint8_t file[4096];
+static uint32_t fileLen;
+
+static void to_file(void * user, const void * data, uint32_t len) {
+    memcpy(file + fileLen, data, len);
+    fileLen += len;
+}
+
+static uint8_t seen[16][64];
+static uint32_t seenLen[16];
+static int nSeen;
+
+static void record(void * user, const uint8_t * frame, uint32_t len) {
+    memcpy(seen[nSeen], frame, len < 64 ? len : 64);
+    seenLen[nSeen++] = len;
+}
+
+static void export_and_replay() {
+    fileLen = 0;
+    nSeen = 0;
+    pcap_export(to_file, NULL);
+    pcap_replay(file, fileLen, record, NULL);
+}
+
+// an ipv6 frame, which the stack passes over quietly, marked with `n`
+static uint8_t frame[60];
+static const uint8_t * numbered(uint8_t n) {
+    bzero(frame, sizeof(frame));
+    frame[12] = 0x86;
+    frame[13] = 0xdd;
+    frame[14] = n;
+    return frame;
+}
+
+TEST(pcap_captures_both_directions) {
+    ASSERT_INT_EQUALS(EOK, pcap_start(2048));
+
+    netdev_receive(&nic, numbered(1), 60);
+
+    sbuff * sb = raw_sbuff_alloc(42);
+    memcpy(sb->head, numbered(2), 42);
+    netdev_xmit(&nic, sb);
+
+    export_and_replay();
+    pcap_stop();
+
+    ASSERT_INT_EQUALS(2, nSeen);
+    ASSERT_INT_EQUALS(60, seenLen[0]);
+    ASSERT_INT_EQUALS(1, seen[0][14]);
+    ASSERT_INT_EQUALS(42, seenLen[1]);
+    ASSERT_INT_EQUALS(2, seen[1][14]);
+
+    pcap_file_header * h = (pcap_file_header*) file;
+    ASSERT_INT_EQUALS(PcapMagic, h->magic);
+    ASSERT_INT_EQUALS(PcapLinkEthernet, h->linkType);
+    ASSERT_INT_EQUALS(sizeof(*h) + 2 * sizeof(pcap_record_header) + 102, fileLen);
+}
+
+TEST(pcap_ring_keeps_the_newest) {
+    // room for two and a bit
+    uint32_t record = sizeof(pcap_record_header) + 60;
+    pcap_start(2 * record + 30);
+
+    for (int i = 0; i < 10; i++) {
+        netdev_receive(&nic, numbered(i), 60);
+    }
+    ASSERT_INT_EQUALS(8, pcap_overwritten());
+
+    export_and_replay();
+    pcap_stop();
+
+    ASSERT_INT_EQUALS(2, nSeen);
+    ASSERT_INT_EQUALS(8, seen[0][14]);
+    ASSERT_INT_EQUALS(9, seen[1][14]);
+}
+
+TEST(pcap_nothing_when_stopped) {
+    pcap_stop();
+    netdev_receive(&nic, numbered(1), 60);
+
+    export_and_replay();
+    ASSERT_INT_EQUALS(sizeof(pcap_file_header), fileLen);
+    ASSERT_INT_EQUALS(0, nSeen);
+}
+
+TEST(pcap_replay_reads_either_byte_order) {
+    pcap_file_header h = {
+        .magic = ntol(PcapMagic), .versionMajor = ntos(2), .versionMinor = ntos(4),
+        .snapLen = ntol(PcapSnapLen), .linkType = ntol(PcapLinkEthernet) };
+    pcap_record_header r = {.capLen = ntol(60), .len = ntol(60)};
+
+    fileLen = 0;
+    to_file(NULL, &h, sizeof(h));
+    to_file(NULL, &r, sizeof(r));
+    to_file(NULL, numbered(7), 60);
+    to_file(NULL, &r, sizeof(r));   // cut short
+
+    nSeen = 0;
+    ASSERT_INT_EQUALS(1, pcap_replay(file, fileLen + 10, record, NULL));
+    ASSERT_INT_EQUALS(60, seenLen[0]);
+    ASSERT_INT_EQUALS(7, seen[0][14]);
+
+    h.linkType = ntol(101);     // raw ip
+    memcpy(file, &h, sizeof(h));
+    ASSERT_INT_EQUALS(EINVALID, pcap_replay(file, fileLen, record, NULL));
+
+    ASSERT_INT_EQUALS(EINVALID, pcap_replay(frame, sizeof(frame), record, NULL));
+}
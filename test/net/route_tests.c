@@ -0,0 +1,107 @@
+#include "net/route.h"
+#include "net/ip.h"
+#include "net/arp.h"
+#include "net/sbuff.h"
+#include "net/ntox.h"
+#include "net/device.h"
+#include "errno.h"
+
+#include "../tinytest/tinytest.h"
+
+static struct netdevice lan = {.ip = 0xc0a80102};
+static struct netdevice wan = {.ip = 0x0a000002};
+
+TEST(route_longest_prefix) {
+    init_route();
+    uint32_t hop = 0;
+
+    ASSERT("no routes", route_lookup(0x08080808, &hop) == NULL);
+
+    ASSERT_INT_EQUALS(EOK, route_add(0, 0, 0x0a000001, &wan));
+    ASSERT_INT_EQUALS(EOK, route_add(0xc0a80100, 24, 0, &lan));
+    ASSERT_INT_EQUALS(EOK, route_add(0xc0a80180, 25, 0xc0a80101, &lan));
+    ASSERT_INT_EQUALS(EOK, route_add(0xc0a801fe, 32, 0, &wan));
+    ASSERT_INT_EQUALS(EADDRINUSE, route_add(0xc0a80123, 24, 0, &wan));
+
+    ASSERT_EQUALS(&wan, route_lookup(0x08080808, &hop)->dev);   // default
+    ASSERT_INT_EQUALS(0x0a000001, hop);
+
+    ASSERT_EQUALS(&lan, route_lookup(0xc0a80105, &hop)->dev);   // on link
+    ASSERT_INT_EQUALS(0xc0a80105, hop);
+
+    ASSERT_EQUALS(&lan, route_lookup(0xc0a80181, &hop)->dev);   // the /25
+    ASSERT_INT_EQUALS(0xc0a80101, hop);
+
+    ASSERT_EQUALS(&wan, route_lookup(0xc0a801fe, &hop)->dev);   // host route
+    ASSERT_INT_EQUALS(0xc0a801fe, hop);
+
+    ASSERT_INT_EQUALS(EOK, route_del(0xc0a80180, 25));
+    ASSERT_INT_EQUALS(ENOTFOUND, route_del(0xc0a80180, 25));
+    ASSERT_INT_EQUALS(0xc0a80181, (route_lookup(0xc0a80181, &hop), hop));
+
+    route_remove_device(&wan);
+    ASSERT("default gone", route_lookup(0x08080808, &hop) == NULL);
+    ASSERT_EQUALS(&lan, route_lookup(0xc0a801fe, &hop)->dev);
+
+    init_route();
+}
+
+static uint32_t g_asked;
+
+static void capture(struct netdevice * dev, sbuff * sb) {
+    add_ref(sb);
+    if (ntos(*(uint16_t*)(sb->head + 12)) == 0x0806) {
+        g_asked = ntol(*(uint32_t*)(sb->head + 14 + 24));
+    }
+    release_ref(sb, sbuff_free);
+}
+
+TEST(route_via_gateway) {
+    static struct netdevice dev = {.ip = 0xc0a80202, .send = capture};
+    init_route();
+    route_add(0xc0a80200, 24, 0, &dev);
+    route_add(0, 0, 0xc0a80201, &dev);
+
+    // off the subnet, so it's the gateway that gets resolved
+    sbuff * sb = ip_sbuff_alloc(8);
+    ip_send(sb, 17, 0x01020304, NULL);
+    ASSERT_INT_EQUALS(0xc0a80201, g_asked);
+
+    sb = ip_sbuff_alloc(8);
+    ip_send(sb, 17, 0xc0a80207, NULL);
+    ASSERT_INT_EQUALS(0xc0a80207, g_asked);
+
+    init_route();
+    init_arp();
+}
+
+static uint32_t g_src;
+
+static void capture_src(struct netdevice * dev, sbuff * sb) {
+    add_ref(sb);
+    struct ipv4_header * ip = (struct ipv4_header*)(sb->head + 14);
+    g_src = ntol(ip->src);
+    release_ref(sb, sbuff_free);
+}
+
+TEST(route_sends_from_the_way_out) {
+    static struct netdevice in = {.ip = 0xc0a80402, .send = capture_src};
+    static struct netdevice out = {.ip = 0xc0a80502, .send = capture_src};
+    init_route();
+    route_add(0xc0a80400, 24, 0, &in);
+    route_add(0xc0a80500, 24, 0, &out);
+    arp_store((char[6]){1,2,3,4,5,6}, 0xc0a80509);
+
+    // asked to go from `in`, but routed out of `out`
+    g_src = 0;
+    ip_send(ip_sbuff_alloc(8), 17, 0xc0a80509, &in);
+    ASSERT_INT_EQUALS(0xc0a80502, g_src);
+
+    g_src = 0;
+    sbuff * sbs[2] = {ip_sbuff_alloc(8), ip_sbuff_alloc(8)};
+    ASSERT_INT_EQUALS(EOK, ip_send_batch(sbs, 2, 17, 0xc0a80509, &in));
+    ASSERT_INT_EQUALS(0xc0a80502, g_src);
+
+    init_route();
+    init_arp();
+}
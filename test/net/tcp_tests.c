@@ -3,6 +3,11 @@
 #include "net/sbuff.h"
 #include "net/arp.h"
 #include "net/ntox.h"
+#include "net/timewait.h"
+#include "net/checksum.h"
+#include "timer.h"
+#include "task.h"
+#include "memory.h"
 
 
 #include "../tinytest/tinytest.h"
@@ -21,20 +26,30 @@ static uint16_t g_len = -1;
 static tcp_hdr * g_recv = NULL;
 static stream * last = NULL;
 
+static uint8_t got[64];
+static uint32_t gotLen;
+
 static void tcp_read(stream* stream, const uint8_t* d, uint32_t sz) {
     last = stream;
+    if (d && gotLen + sz <= sizeof(got)) {
+        memcpy(got + gotLen, d, sz);
+        gotLen += sz;
+    }
+    if (!d) tcp_close(stream);
 }
 
 static tcp_read_fn accept() { return tcp_read; }
 
 
 static void capture(struct netdevice *dev, sbuff* buff) {
+    add_ref(buff);
     size_t len = buff->totalSize;
     const uint8_t* ptr = buff->data;
     g_data = malloc(len);
     memcpy(g_data, ptr, len);
     g_len = len;
     g_recv = (tcp_hdr*)(g_data + 20 + 14);
+    release_ref(buff, sbuff_free);
 }
 
 static void cleanup() {
@@ -47,7 +62,7 @@ static void cleanup() {
 TEST(connection_refused) {
     struct BytesLen syn;
     syn = tobyteslen("92061fa31cf94a9700000000a0026db075c40000020406180402080a02ebc4ad0000000001030307");
-    struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
+    static struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
 
     arp_store(remote, 0xc0a80301);
     tcp_segment(&dev, syn.bytes, syn.len, 0xc0a80301);
@@ -57,6 +72,8 @@ TEST(connection_refused) {
     ASSERT_EQUALS(0x0203a8c0, *(uint32_t*)(g_data+26));
     ASSERT_EQUALS(0x0103a8c0, *(uint32_t*)(g_data+30));
     ASSERT_EQUALS(0x14, g_data[47]); // ack,rst
+    ASSERT_EQUALS(0, g_recv->sequence);
+    ASSERT_INT_EQUALS(0x1cf94a98, ntol(g_recv->ack)); // their syn, acked
 
     cleanup();
     free(syn.bytes);
@@ -65,7 +82,7 @@ TEST(connection_refused) {
 TEST(connection_synack) {
     struct BytesLen syn;
     syn = tobyteslen("c7780050ee75886200000000a00272109ec30000020405b40402080a04316d060000000001030307");
-    struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
+    static struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
 
     tcp_listen(80, accept);
 
@@ -73,11 +90,20 @@ TEST(connection_synack) {
     arp_store(remote, 0xc0a80301);
     tcp_segment(&dev, syn.bytes, syn.len, 0xc0a80301);
 
-    ASSERT_INT_EQUALS(54, g_len);
+    ASSERT_INT_EQUALS(74, g_len); // mss, sack ok, timestamps, window scale
     ASSERT_INT_EQUALS(0x0008, *(uint16_t*)(g_data+12));
     ASSERT_INT_EQUALS(0x0203a8c0, *(uint32_t*)(g_data+26));
     ASSERT_INT_EQUALS(0x0103a8c0, *(uint32_t*)(g_data+30));
     ASSERT_INT_EQUALS(0x12, g_data[47]); // ack,syn
+    ASSERT_INT_EQUALS(10, g_recv->offset);
+
+    uint8_t * opts = (uint8_t*)g_recv->options;
+    ASSERT_INT_EQUALS(2, opts[0]);      // mss 1460
+    ASSERT_INT_EQUALS(0x05b4, opts[2] << 8 | opts[3]);
+    ASSERT_INT_EQUALS(4, opts[4]);      // sack permitted
+    ASSERT_INT_EQUALS(8, opts[6]);      // timestamp, echoing theirs
+    ASSERT_INT_EQUALS(0x04316d06, ntol(*(uint32_t*)(opts + 12)));
+    ASSERT_INT_EQUALS(3, opts[17]);     // window scale
 
     cleanup();
     free(syn.bytes);
@@ -89,13 +115,13 @@ TEST(passive_close) {
     tcp_packet syn = {
         .hdr = {
             .srcPort = 1000, .destPort = ntos(80),
-            .sequence=1, .ack=0,
-            .offset = 4, .flags = 2 } };
+            .sequence=ntol(1), .ack=0,
+            .offset = 5, .flags = 2 } };
 
-    tcp_packet ack = syn; ack.hdr.flags = 0x10;
-    tcp_packet fin = syn; fin.hdr.flags = 1;
+    tcp_packet ack = syn; ack.hdr.flags = 0x10; ack.hdr.sequence = ntol(2);
+    tcp_packet fin = ack; fin.hdr.flags = 1;
 
-    struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
+    static struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
 
     tcp_listen(80, accept);
 
@@ -104,13 +130,15 @@ TEST(passive_close) {
     ASSERT_INT_EQUALS(0x12, g_recv->flags); // ack,syn
     ASSERT_INT_EQUALS(ntos(80), g_recv->srcPort);
 
+    ack.hdr.ack = ntol(ntol(g_recv->sequence) + 1);
     cleanup();
     tcp_segment(&dev, (const uint8_t*) &ack, sizeof(tcp_hdr), 0xc0a80301);
     ASSERT_EQUALS(g_recv, NULL);
 
     cleanup();
-    tcp_segment(&dev, (const uint8_t*)&fin, sizeof(fin), 0xc0a80301);
-    ASSERT_INT_EQUALS(0x11, g_recv->flags); // ack,fin
+    tcp_segment(&dev, (const uint8_t*)&fin, sizeof(tcp_hdr), 0xc0a80301);
+    ASSERT_INT_EQUALS(0x11, g_recv->flags); // ack,fin, from the eof callback
+    ASSERT_INT_EQUALS(ntol(3), g_recv->ack);
 
     cleanup();
 }
@@ -122,7 +150,7 @@ TEST(active_close) {
             .srcPort = 1000, .destPort = ntos(80),
             .sequence=ntol(1), .ack=0, .offset = 5, .flags = 2 } };
 
-    struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
+    static struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
 
     tcp_listen(80, accept);
 
@@ -132,30 +160,469 @@ TEST(active_close) {
     ASSERT_INT_EQUALS(ntos(80), g_recv->srcPort);
     ASSERT_INT_EQUALS(ntol(2), g_recv->ack);
 
-    cleanup();
-
     tcp_packet ack = syn;
     ack.hdr.flags = 0x18; // ack + psh, w/ no data
     ack.hdr.sequence = ntol(2);
+    ack.hdr.ack = ntol(ntol(g_recv->sequence) + 1);
+
+    cleanup();
 
     tcp_segment(&dev, (const uint8_t*) &ack, sizeof(tcp_hdr), 0xc0a80301);
     ASSERT_EQUALS(g_recv, NULL);
 
     tcp_close(last);
-    ASSERT_INT_EQUALS(0x1, g_recv->flags); //  fin
+    ASSERT_INT_EQUALS(0x11, g_recv->flags); // ack, fin
     ASSERT_INT_EQUALS(ntol(2), g_recv->ack);
 
     tcp_packet finack = ack;
     finack.hdr.flags = 0x11; // ack, fin
-    finack.hdr.ack = g_recv->sequence;
-    finack.hdr.sequence = ntol(3);
+    finack.hdr.ack = ntol(ntol(g_recv->sequence) + 1);
+    finack.hdr.sequence = ntol(2);
+
+    uint32_t waiting = timewait_count();
+    uint32_t objects = kmem_current_objects();
 
     cleanup();
     tcp_segment(&dev, finack.bytes, sizeof(tcp_hdr), 0xc0a80301);
 
     ASSERT_INT_EQUALS(0x10, g_recv->flags); // ack
     ASSERT_INT_EQUALS(ntol(3), g_recv->ack);
+    ASSERT_INT_EQUALS(waiting + 1, timewait_count());
+    ASSERT_INT_EQUALS(objects - 1, kmem_current_objects()); // stream is gone
+
+    // our ack got lost, they try again
+    cleanup();
+    tcp_segment(&dev, finack.bytes, sizeof(tcp_hdr), 0xc0a80301);
+    ASSERT_INT_EQUALS(0x10, g_recv->flags);
+    ASSERT_INT_EQUALS(ntol(3), g_recv->ack);
+    ASSERT_INT_EQUALS(finack.hdr.ack, g_recv->sequence);
+
+    // a stray old segment is dropped quietly
+    cleanup();
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr), 0xc0a80301);
+    ASSERT_EQUALS(g_recv, NULL);
+
+    // a new connection on the same quad takes over
+    syn.hdr.sequence = ntol(1000);
+    tcp_segment(&dev, syn.bytes, sizeof(tcp_hdr), 0xc0a80301);
+    ASSERT_INT_EQUALS(0x12, g_recv->flags);
+    ASSERT_INT_EQUALS(ntol(1001), g_recv->ack);
+    ASSERT_INT_EQUALS(waiting, timewait_count());
+
+    cleanup();
+}
+
+
+static int released;
+static void count_release(void * user) { released++; }
+
+TEST(silent_peer_is_reclaimed) {
+    tcp_packet syn = {
+        .hdr = {
+            .srcPort = ntos(1201), .destPort = ntos(80),
+            .sequence=ntol(1), .ack=0, .offset = 5, .flags = 2 } };
+
+    static struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
+
+    tcp_listen(80, accept);
+    arp_store(remote, 0xc0a80301);
+    tcp_segment(&dev, syn.bytes, sizeof(tcp_hdr), 0xc0a80301);
+
+    tcp_packet ack = syn;
+    ack.hdr.flags = 0x18; // ack + psh, so the reader hears of it
+    ack.hdr.sequence = ntol(2);
+    ack.hdr.ack = ntol(ntol(g_recv->sequence) + 1);
+    cleanup();
+    last = NULL;
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr), 0xc0a80301);
+    ASSERT("accepted", last != NULL);
+
+    ack.hdr.flags = 0x10;
+    released = 0;
+    tcp_set_user(last, NULL, count_release);
+    tcp_close(last);
+
+    // they ack our fin, then never send theirs
+    ack.hdr.ack = ntol(ntol(g_recv->sequence) + 1);
+    cleanup();
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr), 0xc0a80301);
+
+    for (int i = 0; i < 59 * TIMER_HZ; i++) timer_tick();
+    task_poll_for_work();
+    ASSERT_INT_EQUALS(0, released);
+
+    for (int i = 0; i < 2 * TIMER_HZ; i++) timer_tick();
+    task_poll_for_work();
+    ASSERT_INT_EQUALS(1, released);
+
+    // and it's forgotten
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr), 0xc0a80301);
+    ASSERT_INT_EQUALS(0x04, g_recv->flags);
+
+    cleanup();
+}
+
+TEST(out_of_order_sack) {
+    tcp_packet syn = {
+        .hdr = {
+            .srcPort = ntos(2000), .destPort = ntos(80),
+            .sequence=ntol(100), .ack=0, .offset = 6, .flags = 2,
+            .window = ntos(8192) } };
+    uint8_t * opts = (uint8_t*)syn.hdr.options;
+    opts[0] = 4; opts[1] = 2; opts[2] = 1; opts[3] = 1; // sack permitted
+
+    static struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
+
+    tcp_listen(80, accept);
+
+    arp_store(remote, 0xc0a80301);
+    tcp_segment(&dev, syn.bytes, 24, 0xc0a80301);
+    ASSERT_INT_EQUALS(0x12, g_recv->flags); // ack,syn
+    uint32_t iss = ntol(g_recv->sequence);
+
+    cleanup();
+    tcp_packet ack = { .hdr = syn.hdr };
+    ack.hdr.offset = 5;
+    ack.hdr.flags = 0x10;
+    ack.hdr.sequence = ntol(101);
+    ack.hdr.ack = ntol(iss + 1);
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr), 0xc0a80301);
+    ASSERT_EQUALS(g_recv, NULL);
+
+    // skip 10 bytes, send 5
+    ack.hdr.sequence = ntol(111);
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr) + 5, 0xc0a80301);
+    ASSERT("dup ack sent", g_recv != NULL);
+    ASSERT_INT_EQUALS(0x10, g_recv->flags);
+    ASSERT_INT_EQUALS(101, ntol(g_recv->ack));
+    ASSERT_INT_EQUALS(8, g_recv->offset);
+
+    uint8_t * sack = (uint8_t*)g_recv->options;
+    ASSERT_INT_EQUALS(5, sack[2]);
+    ASSERT_INT_EQUALS(10, sack[3]);
+    ASSERT_INT_EQUALS(111, ntol(*(uint32_t*)(sack + 4)));
+    ASSERT_INT_EQUALS(116, ntol(*(uint32_t*)(sack + 8)));
+
+    // fill the hole, the held data is now acknowledged too
+    cleanup();
+    ack.hdr.sequence = ntol(101);
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr) + 10, 0xc0a80301);
+    ack.hdr.flags = 0x18;
+    ack.hdr.sequence = ntol(116);
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr), 0xc0a80301);
+    tcp_send(last, "x", 1);
+    ASSERT_INT_EQUALS(116, ntol(g_recv->ack));
+    ASSERT_INT_EQUALS(5, g_recv->offset);
 
     cleanup();
 }
 
+TEST(push_waits_for_the_hole) {
+    tcp_packet syn = {
+        .hdr = {
+            .srcPort = ntos(2001), .destPort = ntos(80),
+            .sequence=ntol(100), .ack=0, .offset = 6, .flags = 2,
+            .window = ntos(8192) } };
+    uint8_t * opts = (uint8_t*)syn.hdr.options;
+    opts[0] = 4; opts[1] = 2; opts[2] = 1; opts[3] = 1; // sack permitted
+
+    static struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
+
+    tcp_listen(80, accept);
+
+    arp_store(remote, 0xc0a80301);
+    tcp_segment(&dev, syn.bytes, 24, 0xc0a80301);
+    uint32_t iss = ntol(g_recv->sequence);
+
+    cleanup();
+    tcp_packet ack = { .hdr = syn.hdr };
+    ack.hdr.offset = 5;
+    ack.hdr.flags = 0x10;
+    ack.hdr.sequence = ntol(101);
+    ack.hdr.ack = ntol(iss + 1);
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr), 0xc0a80301);
+    gotLen = 0;
+
+    // A in order, C pushed past a hole, then B fills it
+    memcpy(ack.bytes + sizeof(tcp_hdr), "aaaaa", 5);
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr) + 5, 0xc0a80301);
+
+    ack.hdr.flags = 0x18;
+    ack.hdr.sequence = ntol(111);
+    memcpy(ack.bytes + sizeof(tcp_hdr), "ccccc", 5);
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr) + 5, 0xc0a80301);
+    ASSERT_INT_EQUALS(0, gotLen);
+
+    ack.hdr.flags = 0x10;
+    ack.hdr.sequence = ntol(106);
+    memcpy(ack.bytes + sizeof(tcp_hdr), "bbbbb", 5);
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr) + 5, 0xc0a80301);
+    ASSERT_INT_EQUALS(15, gotLen);
+    ASSERT_INT_EQUALS(0, memcmp(got, "aaaaabbbbbccccc", 15));
+
+    cleanup();
+}
+
+TEST(delayed_ack) {
+    tcp_packet syn = {
+        .hdr = {
+            .srcPort = ntos(3000), .destPort = ntos(80),
+            .sequence=ntol(100), .ack=0, .offset = 5, .flags = 2 } };
+
+    static struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
+
+    tcp_listen(80, accept);
+
+    arp_store(remote, 0xc0a80301);
+    tcp_segment(&dev, syn.bytes, sizeof(tcp_hdr), 0xc0a80301);
+    uint32_t iss = ntol(g_recv->sequence);
+
+    cleanup();
+    tcp_packet data = syn;
+    data.hdr.flags = 0x10;
+    data.hdr.sequence = ntol(101);
+    data.hdr.ack = ntol(iss + 1);
+    tcp_segment(&dev, data.bytes, sizeof(tcp_hdr), 0xc0a80301);
+
+    // one small segment waits for the timer
+    data.hdr.flags = 0x18;
+    tcp_segment(&dev, data.bytes, sizeof(tcp_hdr) + 100, 0xc0a80301);
+    ASSERT_EQUALS(g_recv, NULL);
+
+    for (int i = 0; i < TIMER_HZ; i++) timer_tick();
+    task_poll_for_work();
+    ASSERT("delayed ack sent", g_recv != NULL);
+    ASSERT_INT_EQUALS(0x10, g_recv->flags);
+    ASSERT_INT_EQUALS(201, ntol(g_recv->ack));
+
+    // every second full segment is acked straight away; with no mss
+    // offered that's 536 bytes
+    cleanup();
+    data.hdr.flags = 0x10;
+    data.hdr.sequence = ntol(201);
+    tcp_segment(&dev, data.bytes, sizeof(tcp_hdr) + 536, 0xc0a80301);
+    ASSERT_EQUALS(g_recv, NULL);
+    data.hdr.sequence = ntol(737);
+    tcp_segment(&dev, data.bytes, sizeof(tcp_hdr) + 536, 0xc0a80301);
+    ASSERT("ack sent", g_recv != NULL);
+    ASSERT_INT_EQUALS(1273, ntol(g_recv->ack));
+
+    cleanup();
+}
+
+TEST(ack_when_the_window_runs_low) {
+    tcp_packet syn = {
+        .hdr = {
+            .srcPort = ntos(3001), .destPort = ntos(80),
+            .sequence=ntol(100), .ack=0, .offset = 6, .flags = 2 } };
+    uint8_t * opts = (uint8_t*)syn.hdr.options;
+    opts[0] = 2; opts[1] = 4; opts[2] = 1460 >> 8; opts[3] = 1460 & 0xff; // mss
+
+    static struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
+
+    tcp_listen(80, accept);
+
+    arp_store(remote, 0xc0a80301);
+    tcp_segment(&dev, syn.bytes, 24, 0xc0a80301);
+    uint32_t iss = ntol(g_recv->sequence);
+
+    cleanup();
+    tcp_packet data = syn;
+    data.hdr.offset = 5;
+    data.hdr.flags = 0x10;
+    data.hdr.sequence = ntol(101);
+    data.hdr.ack = ntol(iss + 1);
+    tcp_segment(&dev, data.bytes, sizeof(tcp_hdr), 0xc0a80301);
+
+    // one full segment leaves no room for another: say so now
+    tcp_segment(&dev, data.bytes, sizeof(tcp_hdr) + 1460, 0xc0a80301);
+    ASSERT("ack sent", g_recv != NULL);
+    ASSERT_INT_EQUALS(1561, ntol(g_recv->ack));
+    ASSERT_INT_EQUALS(2048 - 1460, ntos(g_recv->window));
+
+    // and once the reader has it, that the window's open again
+    cleanup();
+    data.hdr.flags = 0x18;
+    data.hdr.sequence = ntol(1561);
+    tcp_segment(&dev, data.bytes, sizeof(tcp_hdr) + 2048 - 1460, 0xc0a80301);
+    ASSERT("window update sent", g_recv != NULL);
+    ASSERT_INT_EQUALS(2149, ntol(g_recv->ack));
+    ASSERT_INT_EQUALS(2048, ntos(g_recv->window));
+
+    cleanup();
+}
+
+TEST(syn_cookies) {
+    tcp_packet syn = {
+        .hdr = {
+            .srcPort = ntos(4000), .destPort = ntos(80),
+            .sequence=ntol(500), .ack=0, .offset = 5, .flags = 2 } };
+
+    static struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
+
+    tcp_listen(80, accept);
+    arp_store(remote, 0xc0a80301);
+
+    // fill the backlog and then some; only the handshake allocates
+    uint32_t objects = kmem_current_objects();
+    uint32_t iss = 0;
+    for (int i = 0; i < 40; i++) {
+        syn.hdr.srcPort = ntos(4000 + i);
+        tcp_segment(&dev, syn.bytes, sizeof(tcp_hdr), 0xc0a80301);
+        ASSERT_INT_EQUALS(0x12, g_recv->flags);
+        iss = ntol(g_recv->sequence);
+        cleanup();
+    }
+    ASSERT_INT_EQUALS(objects, kmem_current_objects());
+
+    // the last one only exists as a cookie
+    last = NULL;
+    tcp_packet ack = syn;
+    ack.hdr.flags = 0x18;
+    ack.hdr.sequence = ntol(501);
+    ack.hdr.ack = ntol(iss + 1);
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr), 0xc0a80301);
+    ASSERT_EQUALS(g_recv, NULL);
+    ASSERT("connected", last != NULL);
+
+    // a forged ack gets reset, at the sequence it claims we're at
+    ack.hdr.srcPort = ntos(3999);
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr), 0xc0a80301);
+    ASSERT_INT_EQUALS(0x04, g_recv->flags);
+    ASSERT_INT_EQUALS(iss + 1, ntol(g_recv->sequence));
+    ASSERT_INT_EQUALS(0, g_recv->ack);
+
+    cleanup();
+}
+
+static uint8_t frames[4][1600];
+static uint16_t frameLens[4];
+static int nFrames;
+
+static void capture_all(struct netdevice *dev, sbuff* buff) {
+    add_ref(buff);
+    if (nFrames < 4) {
+        memcpy(frames[nFrames], buff->head, buff->currSize);
+        frameLens[nFrames] = buff->currSize;
+    }
+    nFrames++;
+    release_ref(buff, sbuff_free);
+}
+
+TEST(bulk_send_is_segmented) {
+    tcp_packet syn = {
+        .hdr = {
+            .srcPort = ntos(4000), .destPort = ntos(80),
+            .sequence=ntol(100), .ack=0, .offset = 6, .flags = 2,
+            .window = ntos(8192) } };
+    uint8_t * opts = (uint8_t*)syn.hdr.options;
+    opts[0] = 2; opts[1] = 4; opts[2] = 1024 >> 8; opts[3] = 1024 & 0xff; // mss
+
+    static struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
+
+    tcp_listen(80, accept);
+
+    arp_store(remote, 0xc0a80301);
+    tcp_segment(&dev, syn.bytes, 24, 0xc0a80301);
+    uint32_t iss = ntol(g_recv->sequence);
+
+    cleanup();
+    tcp_packet ack = { .hdr = syn.hdr };
+    ack.hdr.offset = 5;
+    ack.hdr.flags = 0x18;
+    ack.hdr.sequence = ntol(101);
+    ack.hdr.ack = ntol(iss + 1);
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr) + 1, 0xc0a80301);
+
+    static uint8_t body[2500];
+    for (int i = 0; i < sizeof(body); i++) body[i] = i * 7;
+
+    nFrames = 0;
+    dev.send = capture_all;
+    tcp_send(last, body, sizeof(body));
+    dev.send = capture;
+
+    ASSERT_INT_EQUALS(3, nFrames);
+    uint16_t sizes[] = {1024, 1024, 452};
+    for (int i = 0; i < 3; i++) {
+        tcp_hdr * hdr = (tcp_hdr*)(frames[i] + 14 + 20);
+        uint16_t tcpLen = frameLens[i] - 14 - 20;
+        ASSERT_INT_EQUALS(sizes[i], tcpLen - sizeof(tcp_hdr));
+        ASSERT_INT_EQUALS(tcpLen + 20, ntos(*(uint16_t*)(frames[i] + 14 + 2)));
+        ASSERT_INT_EQUALS(iss + 1 + i * 1024, ntol(hdr->sequence));
+        ASSERT_INT_EQUALS(i == 2 ? 0x18 : 0x10, hdr->flags);
+        ASSERT_INT_EQUALS(0, memcmp(hdr->options, body + i * 1024, sizes[i]));
+
+        // both checksums come out right
+        ASSERT_INT_EQUALS(0, csum_fold(csum_partial(frames[i] + 14, 20, 0)));
+        uint32_t pseudo = csum_pseudo(0xC0A80302, 0xc0a80301, 6, tcpLen);
+        ASSERT_INT_EQUALS(0, csum_fold(csum_partial(hdr, tcpLen, pseudo)));
+    }
+
+    cleanup();
+}
+
+TEST(send_waits_for_the_window) {
+    tcp_packet syn = {
+        .hdr = {
+            .srcPort = ntos(4001), .destPort = ntos(80),
+            .sequence=ntol(100), .ack=0, .offset = 6, .flags = 2,
+            .window = ntos(1000) } };
+    uint8_t * opts = (uint8_t*)syn.hdr.options;
+    opts[0] = 2; opts[1] = 4; opts[2] = 1024 >> 8; opts[3] = 1024 & 0xff; // mss
+
+    static struct netdevice dev = {.ip =  0xC0A80302, .send=capture};
+
+    tcp_listen(80, accept);
+
+    arp_store(remote, 0xc0a80301);
+    tcp_segment(&dev, syn.bytes, 24, 0xc0a80301);
+    uint32_t iss = ntol(g_recv->sequence);
+
+    cleanup();
+    tcp_packet ack = { .hdr = syn.hdr };
+    ack.hdr.offset = 5;
+    ack.hdr.flags = 0x18;
+    ack.hdr.sequence = ntol(101);
+    ack.hdr.ack = ntol(iss + 1);
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr) + 1, 0xc0a80301);
+
+    static uint8_t body[2500];
+    for (int i = 0; i < sizeof(body); i++) body[i] = i * 7;
+
+    // only a window's worth goes, the rest is held
+    nFrames = 0;
+    dev.send = capture_all;
+    ASSERT_INT_EQUALS(2500, tcp_send(last, body, sizeof(body)));
+    ASSERT_INT_EQUALS(1, nFrames);
+    ASSERT_INT_EQUALS(TcpSendBuffer - 1500, tcp_send_space(last));
+
+    // and the fin waits behind it
+    tcp_close(last);
+    ASSERT_INT_EQUALS(1, nFrames);
+
+    // each ack lets the next window's worth go
+    ack.hdr.flags = 0x10;
+    ack.hdr.sequence = ntol(102);
+    ack.hdr.ack = ntol(iss + 1 + 1000);
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr), 0xc0a80301);
+    ASSERT_INT_EQUALS(2, nFrames);
+    tcp_hdr * hdr = (tcp_hdr*)(frames[1] + 14 + 20);
+    ASSERT_INT_EQUALS(iss + 1 + 1000, ntol(hdr->sequence));
+    ASSERT_INT_EQUALS(TcpAck | TcpPsh, hdr->flags);    // nothing to ack, but still
+    ASSERT_INT_EQUALS(102, ntol(hdr->ack));
+    ASSERT_INT_EQUALS(0, memcmp(hdr->options, body + 1000, 1000));
+
+    ack.hdr.ack = ntol(iss + 1 + 2000);
+    tcp_segment(&dev, ack.bytes, sizeof(tcp_hdr), 0xc0a80301);
+    dev.send = capture;
+
+    ASSERT_INT_EQUALS(4, nFrames);
+    hdr = (tcp_hdr*)(frames[2] + 14 + 20);
+    ASSERT_INT_EQUALS(500, frameLens[2] - 14 - 20 - sizeof(tcp_hdr));
+    hdr = (tcp_hdr*)(frames[3] + 14 + 20);
+    ASSERT_INT_EQUALS(iss + 1 + 2500, ntol(hdr->sequence));
+    ASSERT_INT_EQUALS(TcpAck | TcpFin, hdr->flags);
+
+    cleanup();
+}
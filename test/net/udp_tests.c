@@ -7,6 +7,8 @@
 #include "net/ntox.h"
 #include "net/ip.h"
 #include "net/device.h"
+#include "task.h"
+#include "errno.h"
 
 #include "../tinytest/tinytest.h"
 
@@ -29,7 +31,8 @@ static void capture(struct netdevice *dev, sbuff * sbuff) {
 
 
 TEST(udp_send) {
-    struct netdevice dev = {.ip = ntol(9999), .send = capture};
+    static struct netdevice dev = {.send = capture};
+    dev.ip = ntol(9999);
     ip_add_device(&dev);
 
     mac mac;
@@ -50,15 +53,18 @@ TEST(udp_send) {
 
 TEST(udp_listen) {
                             //  src dst len chk payload
-    uint8_t* request = tobytes("e30a000700040000deadbeef");
+    uint8_t* request = tobytes("e30a0007000c0000deadbeef");
 
     struct netdevice dev;
     dev.ip = 0;
     dev.send = capture;
 
     // seed arp
+    g_data = NULL;
     udp_listen(7, udp_read);
-    udp_datagram(&dev, request, 0xc0a80301);
+    udp_datagram(&dev, request, 12, 0xc0a80301);
+    ASSERT_EQUALS(g_data, NULL); // not from the receive path
+    task_poll_for_work();
 
     ASSERT_INT_EQUALS(4, g_len);
     ASSERT_INT_EQUALS(7, g_quad.dst_port);
@@ -69,3 +75,116 @@ TEST(udp_listen) {
     free(request);
     free(g_data);
 }
+
+TEST(udp_queues_and_batches) {
+                            //  src dst len chk payload
+    uint8_t* datagram = tobytes("e30a2328000c0000deadbeef");
+    struct netdevice dev = {.ip = 0xc0a80302};
+    uint32_t objects = kmem_current_objects();
+
+    ASSERT_INT_EQUALS(EOK, udp_bind(9000));
+    ASSERT_INT_EQUALS(EADDRINUSE, udp_bind(9000));
+    ASSERT_INT_EQUALS(EOK, udp_bind(9000 + 256)); // same bucket
+
+    for (int i = 0; i < 3; i++) {
+        datagram[4 + 4 + 3] = i;
+        udp_datagram(&dev, datagram, 12, 0xc0a80301);
+    }
+
+    udp_msg * msgs[2];
+    ASSERT_INT_EQUALS(2, udp_recvmmsg(9000, msgs, 2));
+    ASSERT_INT_EQUALS(4, msgs[0]->len);
+    ASSERT_INT_EQUALS(0, msgs[0]->data[3]);
+    ASSERT_INT_EQUALS(1, msgs[1]->data[3]);
+    ASSERT_INT_EQUALS(58122, msgs[1]->quad.src_port);
+    kmem_free(msgs[0]);
+    kmem_free(msgs[1]);
+
+    ASSERT_INT_EQUALS(1, udp_recvmmsg(9000, msgs, 2));
+    ASSERT_INT_EQUALS(2, msgs[0]->data[3]);
+    kmem_free(msgs[0]);
+    ASSERT_INT_EQUALS(0, udp_recvmmsg(9000, msgs, 2));
+    ASSERT_INT_EQUALS(0, udp_recvmmsg(9000 + 256, msgs, 2));
+
+    // a slow reader loses the excess, not the rest of the stack
+    for (int i = 0; i < 100; i++) udp_datagram(&dev, datagram, 12, 0xc0a80301);
+    ASSERT_INT_EQUALS(36, udp_drops(9000));
+
+    udp_close(9000);
+    udp_close(9000 + 256);
+    ASSERT_INT_EQUALS(ENOTFOUND, udp_recvmmsg(9000, msgs, 2));
+    ASSERT("all freed", objects == kmem_current_objects());
+
+    free(datagram);
+}
+
+static int g_heard;
+
+static void close_on_read(const udp_quad* quad, const uint8_t* data, uint32_t sz) {
+    g_heard++;
+    udp_close(quad->dst_port);
+}
+
+TEST(udp_close_from_the_callback) {
+                            //  src dst len chk payload
+    uint8_t* datagram = tobytes("e30a2329000c0000deadbeef");
+    struct netdevice dev = {.ip = 0xc0a80302};
+    uint32_t objects = kmem_current_objects();
+
+    g_heard = 0;
+    ASSERT_INT_EQUALS(EOK, udp_listen(9001, close_on_read));
+    for (int i = 0; i < 3; i++) udp_datagram(&dev, datagram, 12, 0xc0a80301);
+    task_poll_for_work();
+
+    // the rest went with the socket
+    ASSERT_INT_EQUALS(1, g_heard);
+    ASSERT_INT_EQUALS(ENOTFOUND, udp_recvmmsg(9001, NULL, 0));
+    ASSERT("all freed", objects == kmem_current_objects());
+
+    free(datagram);
+}
+
+static int g_batches, g_frames, g_badSums;
+
+static void batch(struct netdevice * dev, sbuff ** sbuffs, uint16_t count) {
+    g_batches++;
+    for (uint16_t i = 0; i < count; i++) {
+        add_ref(sbuffs[i]);
+        uint8_t * udp = sbuffs[i]->head + 14 + 20;
+        uint16_t len = ntos(*(uint16_t*)(udp + 4));
+        if (len != 8 + 5 + i % 2) g_badSums++;
+        if (csum_fold(csum_partial(udp, len, csum_pseudo(dev->ip, 0x0a000009, 17, len)))) g_badSums++;
+        g_frames++;
+        release_ref(sbuffs[i], sbuff_free);
+    }
+}
+
+TEST(udp_sendmmsg) {
+    static struct netdevice dev = {.send_batch = batch};
+    dev.ip = 0x0a000001;
+    ip_add_device(&dev);
+    mac mac = {2, 0, 0, 0, 0, 9};
+    arp_store(mac, 0x0a000009);
+    uint32_t objects = kmem_current_objects();
+
+    udp_buf bufs[40];
+    for (int i = 0; i < 40; i++) {
+        bufs[i].data = (const uint8_t*)"hello!";
+        bufs[i].len = 5 + i % 2;
+    }
+
+    udp_quad quad = {
+        .src_port = 5000, .dst_port = 8125,
+        .src_addr = ntol(dev.ip), .dst_addr = 0x0a000009};
+
+    ASSERT_INT_EQUALS(40, udp_sendmmsg(&quad, bufs, 40));
+    ASSERT_INT_EQUALS(2, g_batches); // 32 + 8
+    ASSERT_INT_EQUALS(40, g_frames);
+    ASSERT_INT_EQUALS(0, g_badSums);
+    ASSERT("all freed", objects == kmem_current_objects());
+
+    quad.src_addr = 0x12345678;
+    ASSERT_INT_EQUALS(EINVALID, udp_sendmmsg(&quad, bufs, 1));
+
+    ip_remove_device(&dev);
+}
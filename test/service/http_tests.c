@@ -0,0 +1,424 @@
+#include "service/http.h"
+#include "service/http_cache.h"
+#include "service/http_route.h"
+#include "net/device.h"
+#include "net/ethernet.h"
+#include "net/ip.h"
+#include "net/tcp.h"
+#include "net/arp.h"
+#include "net/sbuff.h"
+#include "net/ntox.h"
+#include "fs/vfs.h"
+#include "timer.h"
+#include "task.h"
+#include "memory.h"
+#include "errno.h"
+
+#include "../tinytest/tinytest.h"
+
+#define Remote 0xc0a8030a
+#define Local 0xc0a80302
+#define HttpPort 8080
+
+static char page[] = "<html>hi</html>";
+static char big[20000];
+#define MidSize 10000     // under HttpCacheMaxBody, over what the test heap can give
+
+static int page_exists(file_system * fs, const char * name) {
+    if (!strncmp(name, "HELLO~1.HTM", 12) || !strncmp(name, "NOTES.TXT", 10) ||
+            !strncmp(name, "BIG.BIN", 8) || !strncmp(name, "MID.BIN", 8)) return EOK;
+    return ENOTFOUND;
+}
+
+static int page_read_at(file_system * fs, const char * name, uint32_t offset,
+        char * buf, size_t sz) {
+    const char * data = page;
+    uint32_t len = sizeof(page) - 1;
+    if (!strncmp(name, "BIG.BIN", 8)) {
+        data = big;
+        len = sizeof(big);
+    }
+    if (!strncmp(name, "MID.BIN", 8)) {
+        data = big;
+        len = MidSize;
+    }
+
+    if (offset >= len) return 0;
+    if (sz > len - offset) sz = len - offset;
+    memcpy(buf, data + offset, sz);
+    return sz;
+}
+
+static int page_slurp(file_system * fs, const char * name, char * buf, size_t sz) {
+    return page_read_at(fs, name, 0, buf, sz);
+}
+
+static int page_stat(file_system * fs, const char * name, file_info * info) {
+    info->size = !strncmp(name, "BIG.BIN", 8) ? sizeof(big) :
+        !strncmp(name, "MID.BIN", 8) ? MidSize : sizeof(page) - 1;
+    info->mtime = 784111777;
+    return EOK;
+}
+
+static file_system pages = {.exists = page_exists, .slurp = page_slurp, .stat = page_stat,
+    .read_at = page_read_at};
+
+static void hello(http_conn * c, const http_request * req) {
+    char body[64] = "hello ";
+    memcpy(body + 6, req->query, req->queryLen);
+    http_respond(c, "200 OK", "text/plain", body, 6 + req->queryLen);
+}
+
+static char said[32 * 1024];
+static uint32_t saidLen;
+static uint32_t lastSeq;
+static uint32_t endSeq;     // just past the last we sent
+static uint8_t finned;
+
+static void capture(struct netdevice * dev, sbuff * sb) {
+    add_ref(sb);
+    struct ipv4_header * ip = (struct ipv4_header*)(sb->head + 14);
+    tcp_hdr * hdr = (tcp_hdr*)(ip + 1);
+    uint32_t len = ntos(ip->total_len) - 20 - hdr->offset * 4;
+    memcpy(said + saidLen, (uint8_t*)hdr + hdr->offset * 4, len);
+    saidLen += len;
+    said[saidLen] = 0;
+    lastSeq = ntol(hdr->sequence);
+    endSeq = lastSeq + len + (hdr->flags & (TcpSyn | TcpFin) ? 1 : 0);
+    if (hdr->flags & TcpFin) finned = 1;
+    release_ref(sb, sbuff_free);
+}
+
+static struct netdevice dev = {.ip = Local, .send = capture};
+
+static uint16_t port;
+static uint32_t peerSeq;
+static uint32_t ourSeq;
+
+static uint8_t frame[1600];
+
+// where `what` is in what we said, from `from`, or -1
+static int find(const char * what, int from) {
+    uint32_t n = strlen(what);
+    for (int i = from; i + n <= saidLen; i++) {
+        if (!memcmp(said + i, what, n)) return i;
+    }
+    return -1;
+}
+
+static void segment(uint8_t flags, const char * data) {
+    uint32_t n = data ? strlen(data) : 0;
+    bzero(frame, 60);
+
+    tcp_hdr * tcp = (tcp_hdr*) frame;
+    tcp->srcPort = ntos(port);
+    tcp->destPort = ntos(HttpPort);
+    tcp->sequence = ntol(peerSeq);
+    tcp->ack = ntol(ourSeq);
+    tcp->offset = 5;
+    tcp->flags = flags;
+    tcp->window = ntos(8192);
+    memcpy(tcp->options, data, n);
+
+    tcp_segment(&dev, frame, sizeof(tcp_hdr) + n, Remote);
+    peerSeq += n + (flags & (TcpSyn | TcpFin) ? 1 : 0);
+}
+
+static void request(const char * data) {
+    saidLen = 0;
+    segment(TcpAck | TcpPsh, data);
+}
+
+static void connect() {
+    static int listening;
+    if (!listening) {
+        register_fs(&pages);
+        http_route_file("/", "HELLO~1.HTM");
+        http_route_file("/index.html", "HELLO~1.HTM");
+        http_route_file("/docs/notes", "NOTES.TXT");
+        http_route_file("/big.bin", "BIG.BIN");
+        http_route_file("/mid.bin", "MID.BIN");
+        http_route_handler("/hello", hello);
+        http_listen(HttpPort);
+        listening = 1;
+    }
+    arp_store((char[6]){1,2,3,4,5,6}, Remote);
+
+    port++;
+    peerSeq = 100;
+    finned = 0;
+    segment(TcpSyn, NULL);
+    ourSeq = lastSeq + 1;
+    segment(TcpAck, NULL);
+}
+
+#define Ok "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: 15\r\n"
+#define Page "\r\n\r\n<html>hi</html>"
+
+static int ok() {
+    return find(Ok, 0) == 0 && find(Page, 0) == saidLen - strlen(Page) &&
+        find("Last-Modified: Sun, 06 Nov 1994 08:49:37 GMT\r\n", 0) > 0;
+}
+
+TEST(http_keeps_the_connection) {
+    port = 6000;
+    connect();
+
+    request("GET / HTTP/1.1\r\nHost: x\r\n\r\n");
+    ASSERT_INT_EQUALS(1, ok());
+
+    request("GET / HTTP/1.1\r\nHost: x\r\n\r\n");
+    ASSERT_INT_EQUALS(1, ok());
+    ASSERT_INT_EQUALS(0, finned);
+}
+
+TEST(http_request_across_segments) {
+    port = 6010;
+    connect();
+
+    request("GET / HT");
+    ASSERT_INT_EQUALS(0, saidLen);
+    request("TP/1.1\r\nHo");
+    ASSERT_INT_EQUALS(0, saidLen);
+    request("st: x\r\n\r\n");
+    ASSERT_INT_EQUALS(1, ok());
+}
+
+TEST(http_pipelined_requests) {
+    port = 6020;
+    connect();
+
+    // a body to pass over, then the last one asks to close
+    request("POST / HTTP/1.1\r\nContent-Length: 4\r\n\r\nabcd"
+            "HEAD / HTTP/1.1\r\n\r\n"
+            "GET / HTTP/1.1\r\nConnection: close\r\n\r\n");
+    ASSERT_INT_EQUALS(0, find(
+            "HTTP/1.1 501 Not Implemented\r\nContent-Type: text/html\r\nContent-Length: 0\r\n\r\n"
+            Ok, 0));
+
+    // no body for the head
+    int get = find(Ok, find(Ok, 0) + 1);
+    ASSERT_INT_EQUALS(1, get > 0 && find("<html>", 0) > get);
+    ASSERT_INT_EQUALS(1, find("\r\nConnection: close\r\n\r\n<html>hi</html>", get) > get);
+    ASSERT_INT_EQUALS(1, finned);
+}
+
+TEST(http_not_modified) {
+    port = 6060;
+    connect();
+
+    request("GET /index.html HTTP/1.1\r\n\r\n");
+    int at = find("ETag: ", 0) + 6;
+    char etag[32] = {0};
+    memcpy(etag, said + at, find("\r\n", at) - at);
+
+    char req[128] = "GET /index.html HTTP/1.1\r\nIf-None-Match: \"other\", ";
+    memcpy(req + strlen(req), etag, strlen(etag));
+    memcpy(req + strlen(req), "\r\n\r\n", 5);
+    request(req);
+    ASSERT_INT_EQUALS(0, find("HTTP/1.1 304 Not Modified\r\n", 0));
+    ASSERT_INT_EQUALS(-1, find("<html>", 0));
+
+    request("GET /index.html HTTP/1.1\r\nIf-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n\r\n");
+    ASSERT_INT_EQUALS(0, find("HTTP/1.1 304 Not Modified\r\n", 0));
+
+    request("GET /index.html HTTP/1.1\r\nIf-None-Match: \"other\"\r\n\r\n");
+    ASSERT_INT_EQUALS(1, ok());
+}
+
+TEST(http_serves_from_the_cache) {
+    port = 6070;
+    connect();
+
+    request("GET /index.html HTTP/1.1\r\n\r\n");
+    ASSERT_INT_EQUALS(1, ok());
+
+    // no trip to the disk until it's flushed
+    page[6] = 'H';
+    request("GET /index.html HTTP/1.1\r\n\r\n");
+    ASSERT_INT_EQUALS(1, ok());
+
+    http_cache_flush();
+    request("GET /index.html HTTP/1.1\r\n\r\n");
+    ASSERT_INT_EQUALS(1, find("<html>Hi</html>", 0) > 0);
+
+    page[6] = 'h';
+    http_cache_flush();
+}
+
+TEST(http_1_0_closes_and_cleans_up) {
+    port = 6030;
+    http_cache_flush();
+    uint32_t before = kmem_current_objects();
+    connect();
+
+    request("GET / HTTP/1.0\r\n\r\n");
+    ASSERT_INT_EQUALS(1, finned);
+
+    // ack our fin, then send theirs
+    ourSeq = lastSeq + 1;
+    segment(TcpAck | TcpFin, NULL);
+    http_cache_flush();
+    ASSERT_INT_EQUALS(before, kmem_current_objects());
+}
+
+TEST(http_bad_request_closes) {
+    port = 6040;
+    connect();
+
+    request("nonsense\r\n\r\n");
+    ASSERT_INT_EQUALS(0, strncmp(said, "HTTP/1.1 400 Bad Request\r\n", 26));
+    ASSERT_INT_EQUALS(1, finned);
+}
+
+TEST(http_idle_connection_closes) {
+    port = 6050;
+    connect();
+
+    request("GET / HTTP/1.1\r\n\r\n");
+    for (int i = 0; i < 15 * TIMER_HZ && !finned; i++) {
+        timer_tick();
+        task_poll_for_work();
+    }
+    ASSERT_INT_EQUALS(1, finned);
+}
+
+TEST(http_routes_by_path) {
+    port = 6080;
+    connect();
+
+    request("GET /nowhere HTTP/1.1\r\n\r\n");
+    ASSERT_INT_EQUALS(0, find("HTTP/1.1 404 Not Found\r\n", 0));
+
+    // the query's no part of the path
+    request("GET /index.html?x=1 HTTP/1.1\r\n\r\n");
+    ASSERT_INT_EQUALS(1, ok());
+
+    request("GET /docs/notes/ HTTP/1.1\r\n\r\n");
+    ASSERT_INT_EQUALS(0, find("HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n", 0));
+
+    request("GET /docs HTTP/1.1\r\n\r\n");
+    ASSERT_INT_EQUALS(0, find("HTTP/1.1 404 Not Found\r\n", 0));
+
+    request("GET /hello?you HTTP/1.1\r\n\r\n");
+    ASSERT_INT_EQUALS(0, find("HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n"
+            "Content-Length: 9\r\n\r\nhello you", 0));
+}
+
+TEST(http_content_types) {
+    ASSERT_STRING_EQUALS("text/html", http_content_type("HELLO~1.HTM"));
+    ASSERT_STRING_EQUALS("text/html", http_content_type("index.html"));
+    ASSERT_STRING_EQUALS("image/png", http_content_type("LOGO.PNG"));
+    ASSERT_STRING_EQUALS("application/octet-stream", http_content_type("a.b/README"));
+    ASSERT_STRING_EQUALS("application/octet-stream", http_content_type("BIG.BIN"));
+}
+
+TEST(http_streams_a_big_file) {
+    port = 6090;
+    connect();
+    for (int i = 0; i < sizeof(big); i++) big[i] = i * 7;
+
+    // more than the window, with another request behind it
+    request("GET /big.bin HTTP/1.1\r\n\r\nGET /hello HTTP/1.1\r\n\r\n");
+    ASSERT_INT_EQUALS(0, find("HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+            "Content-Length: 20000\r\n\r\n", 0));
+    ASSERT_INT_EQUALS(1, saidLen < sizeof(big));
+
+    for (int i = 0; i < 20 && find("hello", 0) < 0; i++) {
+        ourSeq = endSeq;
+        segment(TcpAck, NULL);
+    }
+
+    int body = find("\r\n\r\n", 0) + 4;
+    ASSERT_INT_EQUALS(0, memcmp(said + body, big, sizeof(big)));
+    ASSERT_INT_EQUALS(body + sizeof(big), find("HTTP/1.1 200 OK\r\n", body));
+    ASSERT_INT_EQUALS(0, finned);
+}
+
+TEST(http_streams_what_the_heap_cant_cache) {
+    port = 6130;
+    connect();
+    for (int i = 0; i < sizeof(big); i++) big[i] = i * 7;
+
+    request("GET /mid.bin HTTP/1.1\r\n\r\n");
+    ASSERT_INT_EQUALS(0, find("HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n"
+            "Content-Length: 10000\r\n\r\n", 0));
+
+    int body = find("\r\n\r\n", 0) + 4;
+    for (int i = 0; i < 20 && saidLen < body + MidSize; i++) {
+        ourSeq = endSeq;
+        segment(TcpAck, NULL);
+    }
+    ASSERT_INT_EQUALS(body + MidSize, saidLen);
+    ASSERT_INT_EQUALS(0, memcmp(said + body, big, MidSize));
+    ASSERT_INT_EQUALS(0, finned);
+}
+
+TEST(http_methods_are_case_sensitive) {
+    port = 6100;
+    connect();
+
+    request("get / HTTP/1.1\r\n\r\n");
+    ASSERT_INT_EQUALS(0, find("HTTP/1.1 501 Not Implemented\r\n", 0));
+}
+
+TEST(http_oversized_head) {
+    port = 6110;
+    connect();
+
+    static char req[1400] = "GET / HTTP/1.1\r\nX: ";
+    for (uint32_t n = strlen(req); n < 1120; n++) req[n] = 'a';
+    request(req);
+    ASSERT_INT_EQUALS(0, find("HTTP/1.1 431 Request Header Fields Too Large\r\n", 0));
+    ASSERT_INT_EQUALS(1, finned);
+}
+
+TEST(http_requests_wait_behind_a_stream) {
+    port = 6120;
+    connect();
+
+    // more pipelined behind it than a head may be long
+    static char req[1400] = "GET /big.bin HTTP/1.1\r\n\r\n";
+    const char * next = "GET /hello HTTP/1.1\r\n\r\n";
+    for (int i = 0; i < 50; i++) {
+        memcpy(req + strlen(req), next, strlen(next) + 1);
+    }
+    request(req);
+
+    // and another, which tcp holds until they're done
+    segment(TcpAck | TcpPsh, "GET /hello?last HTTP/1.1\r\n\r\n");
+    ASSERT_INT_EQUALS(-1, find("hello", 0));
+
+    for (int i = 0; i < 40 && find("hello last", 0) < 0; i++) {
+        ourSeq = endSeq;
+        segment(TcpAck, NULL);
+    }
+
+    int responses = 0;
+    for (int at = find("HTTP/1.1 200 OK", 0); at >= 0; at = find("HTTP/1.1 200 OK", at + 1)) {
+        responses++;
+    }
+    ASSERT_INT_EQUALS(52, responses);
+    ASSERT_INT_EQUALS(1, find("hello last", 0) > 0);
+    ASSERT_INT_EQUALS(0, finned);
+}
+
+TEST(http_serves_what_came_before_the_fin) {
+    port = 6140;
+    connect();
+
+    request("GET /big.bin HTTP/1.1\r\n\r\nGET /hello?a HTTP/1.1\r\n\r\n");
+    segment(TcpAck | TcpPsh, "GET /hello?b HTTP/1.1\r\n\r\n");
+    segment(TcpAck | TcpFin, NULL);
+    ASSERT_INT_EQUALS(0, finned);
+
+    for (int i = 0; i < 40 && !finned; i++) {
+        ourSeq = endSeq;
+        segment(TcpAck, NULL);
+    }
+
+    int a = find("hello a", 0);
+    ASSERT_INT_EQUALS(1, a > 0);
+    ASSERT_INT_EQUALS(1, find("hello b", a) > a);
+    ASSERT_INT_EQUALS(1, finned);
+}
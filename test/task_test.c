@@ -52,3 +52,26 @@ TEST(tasksDontDoubleQueue) {
     ASSERT("no leaks", start == kmem_current_objects());
 }
 
+
+TEST(tasksDontDoubleQueueAtTheTail) {
+    int first = 0, last = 0;
+    uint32_t start = kmem_current_objects();
+
+    Task * t = task_alloc(bump, &last);
+    add_ref(t);
+    task_enqueue(task_alloc(bump, &first));
+    task_enqueue(t);
+    task_enqueue(t);
+    task_poll_for_work();
+
+    ASSERT_EQUALS(1, first);
+    ASSERT_EQUALS(1, last);
+
+    // and once run, it can go again
+    task_enqueue(t);
+    task_poll_for_work();
+    ASSERT_EQUALS(2, last);
+
+    release_ref(t, kmem_free);
+    ASSERT("no leaks", start == kmem_current_objects());
+}
@@ -0,0 +1,50 @@
+#include "timer.h"
+#include "task.h"
+#include "memory.h"
+#include "tinytest/tinytest.h"
+
+static void count(void* user) {
+    (*(int*)user) ++;
+}
+
+TEST(timersFireInOrder) {
+    int early = 0, late = 0, stopped = 0;
+    uint32_t start = kmem_current_objects();
+
+    timer a = {0}, b = {0}, c = {0};
+    timer_start(&b, 50, count, &late);
+    timer_start(&a, 10, count, &early);
+    timer_start(&c, 10, count, &stopped);
+    timer_stop(&c);
+
+    timer_tick();
+    task_poll_for_work();
+    ASSERT_INT_EQUALS(1, early);
+    ASSERT_INT_EQUALS(0, late);
+
+    for (int i = 0; i < 5; i++) timer_tick();
+    task_poll_for_work();
+    ASSERT_INT_EQUALS(1, early);
+    ASSERT_INT_EQUALS(1, late);
+    ASSERT_INT_EQUALS(0, stopped);
+    ASSERT("not pending", !a.pending && !b.pending);
+    ASSERT("no leaks", start == kmem_current_objects());
+}
+
+TEST(timerTicksWhileQueued) {
+    int fired = 0, other = 0;
+    uint32_t start = kmem_current_objects();
+
+    timer a = {0};
+    timer_start(&a, 10, count, &fired);
+
+    // expired on both ticks, but waiting behind another task throughout
+    task_enqueue(task_alloc(count, &other));
+    timer_tick();
+    timer_tick();
+    task_poll_for_work();
+
+    ASSERT_INT_EQUALS(1, other);
+    ASSERT_INT_EQUALS(1, fired);
+    ASSERT("no leaks", start == kmem_current_objects());
+}